@@ -24,6 +24,10 @@
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static pthread_cond_t maintenance_cond = PTHREAD_COND_INITIALIZER;
 
@@ -31,8 +35,9 @@ static pthread_cond_t maintenance_cond = PTHREAD_COND_INITIALIZER;
 typedef  unsigned long  int  ub4;   /* unsigned 4-byte quantities */
 typedef  unsigned       char ub1;   /* unsigned 1-byte quantities */
 
-/* how many powers of 2's worth of buckets we use */
-static unsigned int hashpower = 16;
+/* how many powers of 2's worth of buckets (or groups) we use */
+#define HASHPOWER_DEFAULT 16
+static unsigned int hashpower = HASHPOWER_DEFAULT;
 
 #define hashsize(n) ((ub4)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
@@ -49,6 +54,21 @@ static item** old_hashtable = 0;
 /* Number of items in the hash table. */
 static unsigned int hash_items = 0;
 
+/* What pages the primary and old table (of either kind) went in */
+static enum large_pages_type primary_pages = LARGE_PAGES_OFF;
+static enum large_pages_type old_pages = LARGE_PAGES_OFF;
+
+/* Allocates a zeroed table, in huge pages with -o hash_large_pages */
+static void *table_alloc(const size_t size, enum large_pages_type *how) {
+    if (settings.hash_large_pages) {
+        void *p = large_pages_alloc(size, how);
+        settings.hash_pages = *how;
+        return p;
+    }
+    *how = LARGE_PAGES_OFF;
+    return calloc(size, 1);
+}
+
 /* Flag: Are we in the middle of expanding now? */
 static bool expanding = false;
 
@@ -58,19 +78,236 @@ static bool expanding = false;
  */
 static unsigned int expand_bucket = 0;
 
-void assoc_init(void) {
-    primary_hashtable = calloc(hashsize(hashpower), sizeof(void *));
-    if (! primary_hashtable) {
-        fprintf(stderr, "Failed to init hashtable.\n");
-        exit(EXIT_FAILURE);
+/*
+ * With -o hash_table=open the index is an open addressing table instead:
+ * item pointers sit in groups the size of a cache line, next to a one
+ * byte tag from the top of each item's hash. A lookup compares its tag
+ * with every slot of a group at once and only looks at items whose tag
+ * matches, so it usually reads one line of the table plus the item it's
+ * after, rather than every item on a chain.
+ *
+ * An item goes in the first group from its home group on that has a free
+ * slot. Every group it passes counts it in "overflow", so lookups can stop
+ * at the first group nothing has overflowed from, and deletes don't leave
+ * tombstones. hashpower counts groups rather than buckets here.
+ */
+#define GROUP_SLOTS 7
+
+typedef struct {
+    uint8_t tags[GROUP_SLOTS];  /* 0 marks a free slot */
+    uint8_t overflow;           /* items placed past this group; sticks at 255 */
+    item *slots[GROUP_SLOTS];
+} assoc_group;
+
+/* Groups are cache line aligned; *_mem is what has to be freed */
+static assoc_group *primary_groups = 0;
+static assoc_group *old_groups = 0;
+static void *primary_groups_mem = 0;
+static void *old_groups_mem = 0;
+
+/* Grow at 90% full; a mostly full group just sends a few items onwards */
+#define group_table_full(n) \
+    ((uint64_t)hash_items * 10 > (uint64_t)hashsize(n) * GROUP_SLOTS * 9)
+
+#define group_table_bytes(n) (hashsize(n) * sizeof(assoc_group) + 64)
+
+static assoc_group *group_table_alloc(const unsigned int power, void **mem,
+                                      enum large_pages_type *how) {
+    char *p = table_alloc(group_table_bytes(power), how);
+    *mem = p;
+    if (p == NULL)
+        return NULL;
+    return (assoc_group *)(p + (64 - ((uintptr_t)p % 64)) % 64);
+}
+
+static inline uint8_t group_tag(const uint32_t hv) {
+    uint8_t tag = hv >> 24;
+    return tag == 0 ? 1 : tag;
+}
+
+/* Returns a mask with bit i set for every slot i tagged with tag */
+static inline unsigned int group_match(const assoc_group *g, const uint8_t tag) {
+#ifdef __SSE2__
+    __m128i tags = _mm_loadl_epi64((const __m128i *)g->tags);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8(tag)))
+        & ((1 << GROUP_SLOTS) - 1);
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < GROUP_SLOTS; i++) {
+        if (g->tags[i] == tag)
+            mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Finds a key in one table, returning its group and setting *slot. Gives up
+ * after every group, which only happens once overflow is stuck everywhere.
+ */
+static assoc_group *group_find(assoc_group *table, const unsigned int power,
+                               const char *key, const size_t nkey,
+                               const uint32_t hv, int *slot, int *depth) {
+    const uint8_t tag = group_tag(hv);
+    unsigned int g = hv & hashmask(power);
+    ub4 n;
+
+    for (n = 0; n < hashsize(power); n++) {
+        assoc_group *grp = &table[g];
+        unsigned int match = group_match(grp, tag);
+        while (match) {
+            int i = ffs(match) - 1;
+            item *it = grp->slots[i];
+            if ((hv == it->hv) && (nkey == it->nkey) &&
+                (memcmp(key, ITEM_key(it), nkey) == 0)) {
+                *slot = i;
+                return grp;
+            }
+            match &= match - 1;
+            ++*depth;
+        }
+        if (grp->overflow == 0)
+            return NULL;
+        g = (g + 1) & hashmask(power);
+    }
+    return NULL;
+}
+
+/*
+ * Puts an item in the first group from its home group on with a free slot,
+ * and counts it in the overflow of the groups before that one. Returns
+ * false if every slot is taken, which can only happen when the table
+ * couldn't grow.
+ */
+static bool group_insert(assoc_group *table, const unsigned int power,
+                         item *it) {
+    const unsigned int home = it->hv & hashmask(power);
+    unsigned int g = home, match = 0;
+    ub4 n, i;
+
+    for (n = 0; n < hashsize(power); n++) {
+        if ((match = group_match(&table[g], 0)) != 0)
+            break;
+        g = (g + 1) & hashmask(power);
+    }
+    if (match == 0)
+        return false;
+
+    table[g].tags[ffs(match) - 1] = group_tag(it->hv);
+    table[g].slots[ffs(match) - 1] = it;
+    for (i = 0; i < n; i++) {
+        assoc_group *grp = &table[(home + i) & hashmask(power)];
+        if (grp->overflow < 255)
+            grp->overflow++;
+    }
+    return true;
+}
+
+/* Empties a slot, and takes the item off the overflow counts it added to */
+static void group_remove(assoc_group *table, const unsigned int power,
+                         assoc_group *grp, const int slot) {
+    unsigned int g = grp->slots[slot]->hv & hashmask(power);
+
+    while (&table[g] != grp) {
+        if (table[g].overflow < 255)
+            table[g].overflow--;
+        g = (g + 1) & hashmask(power);
+    }
+    grp->tags[slot] = 0;
+    grp->slots[slot] = NULL;
+}
+
+static item *open_find(const char *key, const size_t nkey, const uint32_t hv) {
+    assoc_group *grp = NULL;
+    int slot = 0;
+    int depth = 0;
+
+    if (expanding)
+        grp = group_find(old_groups, hashpower - 1, key, nkey, hv, &slot, &depth);
+    if (grp == NULL)
+        grp = group_find(primary_groups, hashpower, key, nkey, hv, &slot, &depth);
+    MEMCACHED_ASSOC_FIND(key, nkey, depth);
+    return grp ? grp->slots[slot] : NULL;
+}
+
+static bool open_expand(void) {
+    old_groups = primary_groups;
+    old_groups_mem = primary_groups_mem;
+    old_pages = primary_pages;
+
+    primary_groups = group_table_alloc(hashpower + 1, &primary_groups_mem,
+                                       &primary_pages);
+    if (primary_groups) {
+        return true;
+    }
+    primary_groups = old_groups;
+    primary_groups_mem = old_groups_mem;
+    primary_pages = old_pages;
+    return false;
+}
+
+/* Moves everything in one group of the old table over to the new one */
+static void open_move_group(const unsigned int g) {
+    assoc_group *grp = &old_groups[g];
+    int i;
+
+    for (i = 0; i < GROUP_SLOTS; i++) {
+        if (grp->tags[i] != 0) {
+            item *it = grp->slots[i];
+            group_remove(old_groups, hashpower - 1, grp, i);
+            /* Can't fail: the new table has twice the slots of the old one */
+            group_insert(primary_groups, hashpower, it);
+        }
+    }
+}
+
+static void open_delete(const char *key, const size_t nkey, const uint32_t hv) {
+    assoc_group *grp = NULL;
+    int slot = 0;
+    int depth = 0;
+
+    if (expanding &&
+        (grp = group_find(old_groups, hashpower - 1, key, nkey, hv,
+                          &slot, &depth)) != NULL) {
+        group_remove(old_groups, hashpower - 1, grp, slot);
+    } else if ((grp = group_find(primary_groups, hashpower, key, nkey, hv,
+                                 &slot, &depth)) != NULL) {
+        group_remove(primary_groups, hashpower, grp, slot);
+    }
+    /* Callers only delete what they found */
+    assert(grp != NULL);
+}
+
+void assoc_init(const int hashpower_init) {
+    hashpower = hashpower_init ? hashpower_init : HASHPOWER_DEFAULT;
+    hash_items = 0;
+    expanding = false;
+    if (settings.hash_table == HASH_TABLE_OPEN) {
+        /* Start with about as many slots as the chained table has buckets */
+        if (!hashpower_init)
+            hashpower -= 3;
+        primary_groups = group_table_alloc(hashpower, &primary_groups_mem,
+                                           &primary_pages);
+        if (primary_groups)
+            return;
+    } else {
+        primary_hashtable = table_alloc(hashsize(hashpower) * sizeof(void *),
+                                        &primary_pages);
+        if (primary_hashtable)
+            return;
     }
+    fprintf(stderr, "Failed to init hashtable.\n");
+    exit(EXIT_FAILURE);
 }
 
-item *assoc_find(const char *key, const size_t nkey) {
-    uint32_t hv = hash(key, nkey, 0);
+item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
     item *it;
     unsigned int oldbucket;
 
+    if (settings.hash_table == HASH_TABLE_OPEN)
+        return open_find(key, nkey, hv);
+
     if (expanding &&
         (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
     {
@@ -82,75 +319,163 @@ item *assoc_find(const char *key, const size_t nkey) {
     item *ret = NULL;
     int depth = 0;
     while (it) {
-        if ((nkey == it->nkey) && (memcmp(key, ITEM_key(it), nkey) == 0)) {
+        if ((hv == it->hv) && (nkey == it->nkey) &&
+            (memcmp(key, ITEM_key(it), nkey) == 0)) {
             ret = it;
             break;
         }
-        it = it->h_next;
+        it = ITEM_h_next(it);
         ++depth;
     }
     MEMCACHED_ASSOC_FIND(key, nkey, depth);
     return ret;
 }
 
-/* returns the address of the item pointer before the key.  if *item == 0,
-   the item wasn't found */
+/* returns the address of the bucket a hash value goes in */
 
-static item** _hashitem_before (const char *key, const size_t nkey) {
-    uint32_t hv = hash(key, nkey, 0);
-    item **pos;
+static item** _hashbucket (const uint32_t hv) {
     unsigned int oldbucket;
 
     if (expanding &&
         (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
     {
-        pos = &old_hashtable[oldbucket];
+        return &old_hashtable[oldbucket];
     } else {
-        pos = &primary_hashtable[hv & hashmask(hashpower)];
+        return &primary_hashtable[hv & hashmask(hashpower)];
     }
+}
 
-    while (*pos && ((nkey != (*pos)->nkey) || memcmp(key, ITEM_key(*pos), nkey))) {
-        pos = &(*pos)->h_next;
+/*
+ * Pulls in the part of the table a lookup for hv starts at, and then the
+ * items that might be the one it's after: the first on the chain, or the
+ * ones whose tag matches in an open table. The header is enough to rule an
+ * item out, but the key usually runs into the next cache line.
+ */
+static void prefetch_bucket(const uint32_t hv) {
+    if (settings.hash_table == HASH_TABLE_OPEN) {
+        if (expanding)
+            prefetch(&old_groups[hv & hashmask(hashpower - 1)]);
+        prefetch(&primary_groups[hv & hashmask(hashpower)]);
+    } else {
+        prefetch(_hashbucket(hv));
     }
-    return pos;
 }
 
-/* grows the hashtable to the next power of 2. */
-static void assoc_expand(void) {
+static void prefetch_item(item *it) {
+    prefetch(it);
+    prefetch((char *)it + 64);
+}
+
+static void prefetch_items(const uint32_t hv) {
+    if (settings.hash_table == HASH_TABLE_OPEN) {
+        assoc_group *grp = &primary_groups[hv & hashmask(hashpower)];
+        unsigned int match;
+        if (expanding)
+            grp = &old_groups[hv & hashmask(hashpower - 1)];
+        match = group_match(grp, group_tag(hv));
+        while (match) {
+            prefetch_item(grp->slots[ffs(match) - 1]);
+            match &= match - 1;
+        }
+    } else {
+        item *it = *_hashbucket(hv);
+        if (it)
+            prefetch_item(it);
+    }
+}
+
+/*
+ * assoc_find() for n keys. Rather than taking the cache misses of one
+ * lookup after another, it first asks for the buckets of every key, then
+ * for the items in them, and only then compares keys, so the misses of
+ * different keys overlap.
+ */
+void assoc_find_many(const char **keys, const size_t *nkeys,
+                     const uint32_t *hvs, item **its, const int n) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        prefetch_bucket(hvs[i]);
+    for (i = 0; i < n; i++)
+        prefetch_items(hvs[i]);
+    for (i = 0; i < n; i++)
+        its[i] = assoc_find(keys[i], nkeys[i], hvs[i]);
+}
+
+static bool chained_expand(void) {
     old_hashtable = primary_hashtable;
+    old_pages = primary_pages;
 
-    primary_hashtable = calloc(hashsize(hashpower + 1), sizeof(void *));
+    primary_hashtable = table_alloc(hashsize(hashpower + 1) * sizeof(void *),
+                                    &primary_pages);
     if (primary_hashtable) {
+        return true;
+    }
+    primary_hashtable = old_hashtable;
+    primary_pages = old_pages;
+    return false;
+}
+
+/* grows the hashtable to the next power of 2. */
+static void assoc_expand(void) {
+    bool grown = settings.hash_table == HASH_TABLE_OPEN ?
+        open_expand() : chained_expand();
+
+    if (grown) {
         if (settings.verbose > 1)
             fprintf(stderr, "Hash table expansion starting\n");
         hashpower++;
         expanding = true;
         expand_bucket = 0;
         pthread_cond_signal(&maintenance_cond);
+    }
+    /* else bad news, but we can keep running. */
+}
+
+/*
+ * Bytes taken by the table, or both tables while expanding. Doesn't take
+ * the cache lock, so it may be a moment out of date.
+ */
+size_t assoc_memory(void) {
+    const unsigned int power = hashpower;
+    size_t bytes;
+
+    if (settings.hash_table == HASH_TABLE_OPEN) {
+        bytes = group_table_bytes(power);
+        if (expanding)
+            bytes += group_table_bytes(power - 1);
     } else {
-        primary_hashtable = old_hashtable;
-        /* Bad news, but we can keep running. */
+        bytes = hashsize(power) * sizeof(void *);
+        if (expanding)
+            bytes += hashsize(power - 1) * sizeof(void *);
     }
+    return bytes;
 }
 
-/* Note: this isn't an assoc_update.  The key must not already exist to call this */
+/*
+ * Note: this isn't an assoc_update.  The key must not already exist to call this.
+ * Returns 0 if an open table is full because it couldn't grow.
+ */
 int assoc_insert(item *it) {
-    uint32_t hv;
-    unsigned int oldbucket;
+    item **bucket;
 
-    assert(assoc_find(ITEM_key(it), it->nkey) == 0);  /* shouldn't have duplicately named things defined */
+    assert(assoc_find(ITEM_key(it), it->nkey, it->hv) == 0);  /* shouldn't have duplicately named things defined */
 
-    hv = hash(ITEM_key(it), it->nkey, 0);
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        it->h_next = old_hashtable[oldbucket];
-        old_hashtable[oldbucket] = it;
-    } else {
-        it->h_next = primary_hashtable[hv & hashmask(hashpower)];
-        primary_hashtable[hv & hashmask(hashpower)] = it;
+    if (settings.hash_table == HASH_TABLE_OPEN) {
+        if (!group_insert(primary_groups, hashpower, it))
+            return 0;
+        hash_items++;
+        if (! expanding && group_table_full(hashpower)) {
+            assoc_expand();
+        }
+        MEMCACHED_ASSOC_INSERT(ITEM_key(it), it->nkey, hash_items);
+        return 1;
     }
 
+    bucket = _hashbucket(it->hv);
+    it->h_next = ITEM_REF(*bucket);
+    *bucket = it;
+
     hash_items++;
     if (! expanding && hash_items > (hashsize(hashpower) * 3) / 2) {
         assoc_expand();
@@ -160,24 +485,43 @@ int assoc_insert(item *it) {
     return 1;
 }
 
-void assoc_delete(const char *key, const size_t nkey) {
-    item **before = _hashitem_before(key, nkey);
+void assoc_delete(const char *key, const size_t nkey, const uint32_t hv) {
+    item **bucket;
+    item *it, *before = NULL;
+
+    if (settings.hash_table == HASH_TABLE_OPEN) {
+        open_delete(key, nkey, hv);
+        hash_items--;
+        MEMCACHED_ASSOC_DELETE(key, nkey, hash_items);
+        return;
+    }
+
+    bucket = _hashbucket(hv);
+    it = *bucket;
+
+    while (it && ((hv != it->hv) || (nkey != it->nkey) ||
+                  memcmp(key, ITEM_key(it), nkey))) {
+        before = it;
+        it = ITEM_h_next(it);
+    }
 
-    if (*before) {
-        item *nxt;
+    if (it) {
         hash_items--;
         /* The DTrace probe cannot be triggered as the last instruction
          * due to possible tail-optimization by the compiler
          */
         MEMCACHED_ASSOC_DELETE(key, nkey, hash_items);
-        nxt = (*before)->h_next;
-        (*before)->h_next = 0;   /* probably pointless, but whatever. */
-        *before = nxt;
+        if (before) {
+            before->h_next = it->h_next;
+        } else {
+            *bucket = ITEM_h_next(it);
+        }
+        it->h_next = 0;   /* probably pointless, but whatever. */
         return;
     }
     /* Note:  we never actually get here.  the callers don't delete things
        they can't find. */
-    assert(*before != 0);
+    assert(it != 0);
 }
 
 
@@ -199,20 +543,33 @@ static void *assoc_maintenance_thread(void *arg) {
             item *it, *next;
             int bucket;
 
-            for (it = old_hashtable[expand_bucket]; NULL != it; it = next) {
-                next = it->h_next;
+            if (settings.hash_table == HASH_TABLE_OPEN) {
+                open_move_group(expand_bucket);
+            } else {
+                for (it = old_hashtable[expand_bucket]; NULL != it; it = next) {
+                    next = ITEM_h_next(it);
 
-                bucket = hash(ITEM_key(it), it->nkey, 0) & hashmask(hashpower);
-                it->h_next = primary_hashtable[bucket];
-                primary_hashtable[bucket] = it;
-            }
+                    bucket = it->hv & hashmask(hashpower);
+                    it->h_next = ITEM_REF(primary_hashtable[bucket]);
+                    primary_hashtable[bucket] = it;
+                }
 
-            old_hashtable[expand_bucket] = NULL;
+                old_hashtable[expand_bucket] = NULL;
+            }
 
             expand_bucket++;
             if (expand_bucket == hashsize(hashpower - 1)) {
                 expanding = false;
-                free(old_hashtable);
+                if (settings.hash_table == HASH_TABLE_OPEN) {
+                    large_pages_free(old_groups_mem,
+                                     group_table_bytes(hashpower - 1),
+                                     old_pages);
+                    old_groups = NULL;
+                } else {
+                    large_pages_free(old_hashtable,
+                                     hashsize(hashpower - 1) * sizeof(void *),
+                                     old_pages);
+                }
                 if (settings.verbose > 1)
                     fprintf(stderr, "Hash table expansion done\n");
             }
@@ -1,9 +1,12 @@
 /* associative array */
-void assoc_init(void);
-item *assoc_find(const char *key, const size_t nkey);
+void assoc_init(const int hashpower_init);
+item *assoc_find(const char *key, const size_t nkey, const uint32_t hv);
+void assoc_find_many(const char **keys, const size_t *nkeys,
+                     const uint32_t *hvs, item **its, const int n);
 int assoc_insert(item *item);
-void assoc_delete(const char *key, const size_t nkey);
+void assoc_delete(const char *key, const size_t nkey, const uint32_t hv);
 void do_assoc_move_next_bucket(void);
+size_t assoc_memory(void);
 int start_assoc_maintenance_thread(void);
 void stop_assoc_maintenance_thread(void);
 
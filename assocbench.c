@@ -0,0 +1,151 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Compares the hash tables assoc.c can use (see -o hash_table) at 50% and
+ * 90% load, by timing lookups of keys that are in the table and of keys
+ * that aren't, in random order. Each is timed one key at a time and in
+ * batches through assoc_find_many(), taking cache_lock around each lookup
+ * or batch the way item_get() and item_get_many() do. Use a hashpower big
+ * enough that the table and the items don't fit in the CPU caches.
+ *
+ * Usage: assocbench [hashpower]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "memcached.h"
+
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef ENABLE_COMPACT_ITEMS
+char *item_arena = NULL;
+#endif
+
+#define KEY_LEN 16
+#define LOOKUP_BATCH 4096
+#define LOOKUP_BATCHES 500
+
+/* Room for the item header and a key, keeping items aligned */
+#define BENCH_ITEM_SIZE ((sizeof(item) + KEY_LEN + 1 + CHUNK_ALIGN_BYTES - 1) \
+                         / CHUNK_ALIGN_BYTES * CHUNK_ALIGN_BYTES)
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int make_key(char *key, const unsigned int n) {
+    return snprintf(key, KEY_LEN + 1, "key:%012u", n);
+}
+
+/*
+ * Looks up random keys from base to base + limit, and returns the time per
+ * lookup in ns. Only the lookups are timed, not making and hashing keys.
+ * With batched set keys go to assoc_find_many() ITEM_GET_BATCH at a time.
+ */
+static double time_lookups(const unsigned int base, const unsigned int limit,
+                           const bool batched, unsigned int *found) {
+    static char keys[LOOKUP_BATCH][KEY_LEN + 1];
+    static const char *keyps[LOOKUP_BATCH];
+    static size_t nkeys[LOOKUP_BATCH];
+    static uint32_t hvs[LOOKUP_BATCH];
+    static item *its[LOOKUP_BATCH];
+    double start, spent = 0;
+    int i, j;
+
+    *found = 0;
+    for (i = 0; i < LOOKUP_BATCHES; i++) {
+        for (j = 0; j < LOOKUP_BATCH; j++) {
+            nkeys[j] = make_key(keys[j], base + random() % limit);
+            keyps[j] = keys[j];
+            hvs[j] = hash(keys[j], nkeys[j], 0);
+        }
+        start = now();
+        if (batched) {
+            for (j = 0; j < LOOKUP_BATCH; j += ITEM_GET_BATCH) {
+                pthread_mutex_lock(&cache_lock);
+                assoc_find_many(keyps + j, nkeys + j, hvs + j, its + j,
+                                ITEM_GET_BATCH);
+                pthread_mutex_unlock(&cache_lock);
+            }
+        } else {
+            for (j = 0; j < LOOKUP_BATCH; j++) {
+                pthread_mutex_lock(&cache_lock);
+                its[j] = assoc_find(keyps[j], nkeys[j], hvs[j]);
+                pthread_mutex_unlock(&cache_lock);
+            }
+        }
+        spent += now() - start;
+        for (j = 0; j < LOOKUP_BATCH; j++) {
+            if (its[j] != NULL)
+                (*found)++;
+        }
+    }
+    return spent * 1e9 / (LOOKUP_BATCHES * LOOKUP_BATCH);
+}
+
+static void run(const enum hash_table_type type, const int hashpower,
+                const int load, char *arena) {
+    /* Number of buckets, or of slots in groups of 7 for the open table */
+    unsigned int slots = type == HASH_TABLE_OPEN ?
+        (1U << (hashpower - 3)) * 7 : 1U << hashpower;
+    unsigned int n = (uint64_t)slots * load / 100;
+    unsigned int i, found;
+    double hit, miss, hit_batched, miss_batched;
+
+    settings.hash_table = type;
+    assoc_init(type == HASH_TABLE_OPEN ? hashpower - 3 : hashpower);
+
+    for (i = 0; i < n; i++) {
+        item *it = (item *)(arena + CHUNK_ALIGN_BYTES + i * BENCH_ITEM_SIZE);
+        memset(it, 0, sizeof(item));
+        it->nkey = make_key(ITEM_key(it), i);
+        it->hv = hash(ITEM_key(it), it->nkey, 0);
+        assoc_insert(it);
+    }
+
+    hit = time_lookups(0, n, false, &found);
+    hit_batched = time_lookups(0, n, true, &i);
+    if (found != LOOKUP_BATCHES * LOOKUP_BATCH || i != found) {
+        fprintf(stderr, "Lost some keys\n");
+        exit(EXIT_FAILURE);
+    }
+    miss = time_lookups(n, n, false, &found);
+    miss_batched = time_lookups(n, n, true, &i);
+    if (found != 0 || i != 0) {
+        fprintf(stderr, "Found keys that were never stored\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("%-8s %3d%% %10u items %6.1f/%-6.1f ns/hit %6.1f/%-6.1f ns/miss\n",
+           type == HASH_TABLE_OPEN ? "open" : "chained", load, n,
+           hit, hit_batched, miss, miss_batched);
+}
+
+int main(int argc, char **argv) {
+    /* Results are printed as one at a time/batched */
+    int hashpower = argc > 1 ? atoi(argv[1]) : 22;
+    size_t nitems = (size_t)1 << hashpower;
+    char *arena;
+
+    if (hashpower < 10 || hashpower > 28) {
+        fprintf(stderr, "hashpower must be between 10 and 28\n");
+        return 1;
+    }
+    arena = malloc(CHUNK_ALIGN_BYTES + nitems * BENCH_ITEM_SIZE);
+    if (arena == NULL) {
+        fprintf(stderr, "Can't allocate %lu items\n", (unsigned long)nitems);
+        return 1;
+    }
+#ifdef ENABLE_COMPACT_ITEMS
+    item_arena = arena;
+#endif
+    srandom(42);
+
+    run(HASH_TABLE_CHAINED, hashpower, 50, arena);
+    run(HASH_TABLE_OPEN, hashpower, 50, arena);
+    run(HASH_TABLE_CHAINED, hashpower, 90, arena);
+    run(HASH_TABLE_OPEN, hashpower, 90, arena);
+    return 0;
+}
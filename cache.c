@@ -83,6 +83,8 @@ void* cache_alloc(cache_t *cache) {
                 cache->constructor(object, NULL, 0) != 0) {
                 free(ret);
                 object = NULL;
+            } else {
+                cache->total++;
             }
         }
     }
@@ -139,6 +141,7 @@ void cache_free(cache_t *cache, void *ptr) {
                 cache->destructor(ptr, NULL);
             }
             free(ptr);
+            cache->total--;
 
         }
     }
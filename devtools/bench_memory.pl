@@ -0,0 +1,64 @@
+#! /usr/bin/perl
+#
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+
+use FindBin;
+
+@ARGV >= 1 and @ARGV <= 5
+    or die "Usage: $FindBin::Script HOST:PORT [COUNT] [KEYLEN] [VALLEN] [EXPTIME]\n";
+
+# Stores COUNT small items and reports how much slab memory they take, to
+# compare item layouts (e.g. a build with --enable-compact-items against
+# one without). Best run against a freshly started server with enough
+# memory that nothing gets evicted. Give an EXPTIME to see what items that
+# expire cost.
+my $addr = $ARGV[0];
+my $count = $ARGV[1] || 100_000;
+my $keylen = $ARGV[2] || 30;
+my $vallen = $ARGV[3] || 20;
+my $exptime = $ARGV[4] || 0;
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                 Timeout  => 3);
+die "$!\n" unless $sock;
+
+sub stats {
+    my $what = shift;
+    my %stats;
+    print $sock "stats $what\r\n";
+    while (my $line = <$sock>) {
+        last if $line =~ /^END/;
+        $stats{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return \%stats;
+}
+
+my $value = 'v' x $vallen;
+foreach my $i (1 .. $count) {
+    my $key = sprintf("%0${keylen}d", $i);
+    print $sock "set $key 0 $exptime $vallen noreply\r\n$value\r\n";
+}
+# Make sure everything went through before looking at the numbers
+print $sock "version\r\n";
+scalar <$sock>;
+
+my $stats = stats('');
+my $slabs = stats('slabs');
+my $used = 0;
+foreach my $k (keys %$slabs) {
+    next unless $k =~ /^(\d+):used_chunks$/;
+    $used += $slabs->{$k} * $slabs->{"$1:chunk_size"};
+}
+
+my $items = $stats->{curr_items} or die "No items stored\n";
+my $payload = $keylen + $vallen;
+printf("items stored:          %d\n", $items);
+printf("evictions:             %d\n", $stats->{evictions});
+printf("bytes (item sizes):    %d (%.1f per item)\n",
+       $stats->{bytes}, $stats->{bytes} / $items);
+printf("chunk memory used:     %d (%.1f per item)\n", $used, $used / $items);
+printf("overhead per item:     %.1f bytes over %d of key and value\n",
+       $used / $items - $payload, $payload);
@@ -0,0 +1,55 @@
+#! /usr/bin/perl
+#
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw(time sleep);
+
+use FindBin;
+
+@ARGV >= 2
+    or die "Usage: $FindBin::Script MEGABYTES MEMCACHED [ARGS...]\n";
+
+# Starts MEMCACHED with ARGS and "-m MEGABYTES", then fills its memory
+# with 10KB values over one connection, timing it from the moment the
+# server was started. Until every page has been used once, sets pay for
+# faulting memory in, so the time until the cache is full is the time it
+# takes to get to full speed. Compare runs with and without "-o prefault",
+# which moves that cost to startup and spreads it over several threads.
+my $megabytes = shift @ARGV;
+my $port = 22000 + $$ % 1000;
+my $vallen = 10240;
+my $count = int($megabytes * 1024 * 1024 * 0.9 / $vallen);
+
+my $start = time;
+my $pid = fork();
+die "fork: $!\n" unless defined $pid;
+if ($pid == 0) {
+    exec(@ARGV, '-m', $megabytes, '-p', $port, '-U', '0')
+        or die "exec: $!\n";
+}
+
+my $sock;
+for (my $tries = 0; $tries < 6000 && !$sock; $tries++) {
+    $sock = IO::Socket::INET->new(PeerAddr => "127.0.0.1:$port")
+        or sleep(0.01);
+}
+die "Couldn't connect to memcached\n" unless $sock;
+my $up = time;
+
+my $value = 'v' x $vallen;
+foreach my $i (1 .. $count) {
+    print $sock "set key$i 0 0 $vallen noreply\r\n$value\r\n";
+}
+print $sock "version\r\n";
+scalar <$sock>;
+my $full = time;
+kill 'TERM', $pid;
+waitpid($pid, 0);
+
+printf("accepting connections after %.2f seconds\n", $up - $start);
+printf("stored %d MB in             %.2f seconds (%.0f MB/s)\n",
+       $count * $vallen >> 20, $full - $up,
+       ($count * $vallen >> 20) / ($full - $up));
+printf("at full speed after         %.2f seconds\n", $full - $start);
@@ -0,0 +1,84 @@
+#! /usr/bin/perl
+#
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw(time sleep);
+
+use FindBin;
+
+@ARGV >= 2
+    or die "Usage: $FindBin::Script MEGABYTES MEMCACHED [ARGS...]\n";
+
+# Starts MEMCACHED with ARGS and "-m MEGABYTES" once with each allocator,
+# and sets values of mixed sizes (tens of bytes to several KB) under random
+# keys from a keyspace several times bigger than memory, until the cache
+# has been replaced a few times over. Then reports how much of the memory
+# holds items: the slab allocator loses the end of every chunk to rounding
+# and pages stuck in classes that no longer need them, the log loses the
+# dead space its cleaner hasn't reclaimed yet and pays for that by copying
+# items around.
+my $megabytes = shift @ARGV;
+my @memcached = @ARGV;
+my $port = 22000 + $$ % 1000;
+my $keys = int($megabytes * 1024 * 1024 / 1700) * 40;
+my $sets = $keys / 5;
+
+sub stats {
+    my ($sock, $what) = @_;
+    my %stats;
+    print $sock "stats $what\r\n";
+    while (my $line = <$sock>) {
+        last if $line =~ /^END/;
+        $stats{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return \%stats;
+}
+
+sub run {
+    my $allocator = shift;
+
+    my $pid = fork();
+    die "fork: $!\n" unless defined $pid;
+    if ($pid == 0) {
+        exec(@memcached, '-m', $megabytes, '-p', $port, '-U', '0',
+             '-o', "allocator=$allocator")
+            or die "exec: $!\n";
+    }
+
+    my $sock;
+    for (my $tries = 0; $tries < 6000 && !$sock; $tries++) {
+        $sock = IO::Socket::INET->new(PeerAddr => "127.0.0.1:$port")
+            or sleep(0.01);
+    }
+    die "Couldn't connect to memcached\n" unless $sock;
+
+    srand(1);
+    my $value = 'v' x 8000;
+    my $start = time;
+    foreach my $i (1 .. $sets) {
+        my $len = (10 + int(rand(90)), 100 + int(rand(900)),
+                   1000 + int(rand(7000)))[$i % 3];
+        my $key = int(rand($keys));
+        print $sock "set key$key 0 0 $len noreply\r\n",
+            substr($value, 0, $len), "\r\n";
+    }
+    my $stats = stats($sock, '');
+    my $elapsed = time - $start;
+    my $slabs = stats($sock, 'slabs');
+    kill 'TERM', $pid;
+    waitpid($pid, 0);
+
+    printf("%-5s %8.1f%% of the limit %8.1f%% of item memory %9d items"
+           . " %8.0f sets/s",
+           $allocator, 100 * $stats->{bytes} / $stats->{limit_maxbytes},
+           100 * $stats->{bytes} / $slabs->{total_malloced},
+           $stats->{curr_items}, $sets / $elapsed);
+    printf(" %6.1f moved/set", $slabs->{log_items_relocated} / $sets)
+        if $allocator eq 'log';
+    print "\n";
+}
+
+run('slab');
+run('log');
@@ -1,8 +1,8 @@
 /* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 /*
- * Hash table
+ * Hash functions
  *
- * The hash function used here is by Bob Jenkins, 1996:
+ * The default hash function is by Bob Jenkins, 1996:
  *    <http://burtleburtle.net/bob/hash/doobs.html>
  *       "By Bob Jenkins, 1996.  bob_jenkins@burtleburtle.net.
  *       You may use this code any way you wish, private, educational,
@@ -122,7 +122,7 @@ and these came close:
 }
 
 #if HASH_LITTLE_ENDIAN == 1
-uint32_t hash(
+uint32_t jenkins_hash(
   const void *key,       /* the key to hash */
   size_t      length,    /* length of the key */
   const uint32_t    initval)   /* initval */
@@ -303,7 +303,7 @@ uint32_t hash(
  * from hashlittle() on all machines.  hashbig() takes advantage of
  * big-endian byte ordering.
  */
-uint32_t hash( const void *key, size_t length, const uint32_t initval)
+uint32_t jenkins_hash( const void *key, size_t length, const uint32_t initval)
 {
   uint32_t a,b,c;
   union { const void *ptr; size_t i; } u; /* to cast key to (size_t) happily */
@@ -429,3 +429,65 @@ uint32_t hash( const void *key, size_t length, const uint32_t initval)
 #else /* HASH_XXX_ENDIAN == 1 */
 #error Must define HASH_BIG_ENDIAN or HASH_LITTLE_ENDIAN
 #endif /* HASH_XXX_ENDIAN == 1 */
+
+/*
+ * The hash function keys are looked up with; the others are in
+ * murmur3_hash.c and crc32c_hash.c. It's chosen once at startup, before
+ * anything is stored, since items keep their hash.
+ */
+hash_func hash = jenkins_hash;
+
+static void hash_many_each(const char **keys, const size_t *nkeys,
+                           uint32_t *hvs, const int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        hvs[i] = hash(keys[i], nkeys[i], 0);
+}
+
+static hash_many_func hash_many_impl = hash_many_each;
+
+/* Returns false if this build or this CPU can't run the hash function */
+bool hash_init(const enum hash_func_type type) {
+    switch (type) {
+    case JENKINS_HASH:
+        hash = jenkins_hash;
+        hash_many_impl = hash_many_each;
+        return true;
+    case MURMUR3_HASH:
+        hash = murmur3_hash;
+        hash_many_impl = hash_many_each;
+        return true;
+    case CRC32C_HASH:
+#ifdef HAVE_SSE42_CRC32C
+        if (crc32c_hash_supported()) {
+            hash = crc32c_hash;
+            hash_many_impl = crc32c_hash_many;
+            return true;
+        }
+#endif
+        return false;
+    }
+    return false;
+}
+
+const char *hash_name(const enum hash_func_type type) {
+    switch (type) {
+    case JENKINS_HASH:
+        return "jenkins";
+    case MURMUR3_HASH:
+        return "murmur3";
+    case CRC32C_HASH:
+        return "crc32c";
+    }
+    return "unknown";
+}
+
+/*
+ * Hashes n keys with the hash function in use. The result is the same as
+ * calling hash() on each, but some functions get through several keys at
+ * once faster than one after another.
+ */
+void hash_many(const char **keys, const size_t *nkeys, uint32_t *hvs,
+               const int n) {
+    hash_many_impl(keys, nkeys, hvs, n);
+}
@@ -5,11 +5,40 @@
 extern "C" {
 #endif
 
-uint32_t hash(const void *key, size_t length, const uint32_t initval);
+typedef uint32_t (*hash_func)(const void *key, size_t length,
+                              const uint32_t initval);
+typedef void (*hash_many_func)(const char **keys, const size_t *nkeys,
+                               uint32_t *hvs, const int n);
+
+/* MurmurHash3's finalizer: every input bit affects every output bit */
+static inline uint32_t fmix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* The hash function in use; see hash_init() */
+extern hash_func hash;
+
+bool hash_init(const enum hash_func_type type);
+const char *hash_name(const enum hash_func_type type);
+void hash_many(const char **keys, const size_t *nkeys, uint32_t *hvs,
+               const int n);
+
+uint32_t jenkins_hash(const void *key, size_t length, const uint32_t initval);
+uint32_t murmur3_hash(const void *key, size_t length, const uint32_t initval);
+#ifdef HAVE_SSE42_CRC32C
+bool crc32c_hash_supported(void);
+uint32_t crc32c_hash(const void *key, size_t length, const uint32_t initval);
+void crc32c_hash_many(const char **keys, const size_t *nkeys, uint32_t *hvs,
+                      const int n);
+#endif
 
 #ifdef    __cplusplus
 }
 #endif
 
 #endif    /* HASH_H */
-
@@ -0,0 +1,155 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Compares the hash functions -o hash_algorithm can pick. It prints:
+ *
+ *  - how long hashing takes per key for a range of key lengths, one key
+ *    at a time and ITEM_GET_BATCH at a time through hash_many(), the way
+ *    a multiget hashes its keys;
+ *  - how evenly sequential keys ("key:1", "key:2", ...) spread over the
+ *    buckets the low bits of the hash pick, and over the tags the open
+ *    hash table takes from the top byte. That's given as chi-squared
+ *    divided by its degrees of freedom, which is about 1.0 for a hash
+ *    that looks random, and as the fullest bucket.
+ *
+ * Usage: hashbench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "memcached.h"
+
+#define BENCH_KEYS 4096
+#define BENCH_ROUNDS 200
+#define DIST_KEYS (1 << 20)
+#define DIST_POWER 16
+
+static const size_t key_lengths[] = { 4, 8, 16, 32, 64, 128, 250 };
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Returns ns per key; batched hashes ITEM_GET_BATCH keys per call */
+static double time_hash(const char **keys, const size_t *nkeys,
+                        const bool batched) {
+    static uint32_t hvs[BENCH_KEYS];
+    uint32_t sum = 0;
+    double start = now();
+    int r, i;
+
+    for (r = 0; r < BENCH_ROUNDS; r++) {
+        if (batched) {
+            for (i = 0; i < BENCH_KEYS; i += ITEM_GET_BATCH)
+                hash_many(keys + i, nkeys + i, hvs + i, ITEM_GET_BATCH);
+        } else {
+            for (i = 0; i < BENCH_KEYS; i++)
+                hvs[i] = hash(keys[i], nkeys[i], 0);
+        }
+        sum += hvs[r % BENCH_KEYS];
+    }
+    /* Keep the compiler from dropping the work */
+    if (sum == 42)
+        printf(" ");
+    return (now() - start) * 1e9 / ((double)BENCH_ROUNDS * BENCH_KEYS);
+}
+
+static void throughput(char *buf) {
+    static const char *keys[BENCH_KEYS];
+    static size_t nkeys[BENCH_KEYS];
+    uint32_t hvs[ITEM_GET_BATCH];
+    size_t l;
+    int i;
+
+    for (l = 0; l < sizeof(key_lengths) / sizeof(key_lengths[0]); l++) {
+        double single, batched;
+
+        for (i = 0; i < BENCH_KEYS; i++) {
+            /* Keys at odd offsets, as they are in a request */
+            keys[i] = buf + i * (KEY_MAX_LENGTH + 1) + 1;
+            nkeys[i] = key_lengths[l];
+        }
+        hash_many(keys, nkeys, hvs, ITEM_GET_BATCH);
+        for (i = 0; i < ITEM_GET_BATCH; i++) {
+            if (hvs[i] != hash(keys[i], nkeys[i], 0)) {
+                fprintf(stderr, "hash_many() disagrees with hash()\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        single = time_hash(keys, nkeys, false);
+        batched = time_hash(keys, nkeys, true);
+        printf("  %3lu byte keys %7.1f ns/key %8.0f MB/s   batched %7.1f ns/key\n",
+               (unsigned long)key_lengths[l], single,
+               key_lengths[l] * 1e3 / single, batched);
+    }
+}
+
+/* chi-squared over degrees of freedom for n values spread over counts */
+static double spread(const unsigned int *counts, const unsigned int nbuckets,
+                     const unsigned int n, unsigned int *fullest) {
+    double expected = (double)n / nbuckets;
+    double chi2 = 0;
+    unsigned int i;
+
+    *fullest = 0;
+    for (i = 0; i < nbuckets; i++) {
+        double d = counts[i] - expected;
+        chi2 += d * d / expected;
+        if (counts[i] > *fullest)
+            *fullest = counts[i];
+    }
+    return chi2 / (nbuckets - 1);
+}
+
+static void distribution(void) {
+    static unsigned int buckets[1 << DIST_POWER];
+    static unsigned int tags[256];
+    char key[32];
+    unsigned int i, fullest_bucket, fullest_tag;
+    double bucket_chi2, tag_chi2;
+
+    memset(buckets, 0, sizeof(buckets));
+    memset(tags, 0, sizeof(tags));
+    for (i = 0; i < DIST_KEYS; i++) {
+        int nkey = snprintf(key, sizeof(key), "key:%u", i);
+        uint32_t hv = hash(key, nkey, 0);
+        buckets[hv & ((1 << DIST_POWER) - 1)]++;
+        tags[hv >> 24]++;
+    }
+    bucket_chi2 = spread(buckets, 1 << DIST_POWER, DIST_KEYS, &fullest_bucket);
+    tag_chi2 = spread(tags, 256, DIST_KEYS, &fullest_tag);
+    printf("  %u keys in %u buckets: chi2/df %.3f, fullest %u (mean %u)\n",
+           DIST_KEYS, 1 << DIST_POWER, bucket_chi2, fullest_bucket,
+           DIST_KEYS >> DIST_POWER);
+    printf("  top byte tags: chi2/df %.3f, fullest %u (mean %u)\n",
+           tag_chi2, fullest_tag, DIST_KEYS / 256);
+}
+
+int main(void) {
+    const enum hash_func_type types[] = { JENKINS_HASH, MURMUR3_HASH,
+                                          CRC32C_HASH };
+    char *buf = malloc(BENCH_KEYS * (KEY_MAX_LENGTH + 1) + 1);
+    size_t i;
+
+    if (buf == NULL) {
+        fprintf(stderr, "Can't allocate keys\n");
+        return 1;
+    }
+    srandom(42);
+    for (i = 0; i < BENCH_KEYS * (KEY_MAX_LENGTH + 1) + 1; i++)
+        buf[i] = 'a' + random() % 26;
+
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (!hash_init(types[i])) {
+            printf("%s: not supported here\n", hash_name(types[i]));
+            continue;
+        }
+        printf("%s:\n", hash_name(types[i]));
+        throughput(buf);
+        distribution();
+    }
+    return 0;
+}
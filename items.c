@@ -12,6 +12,9 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#ifdef ENABLE_LZ4
+#include <lz4.h>
+#endif
 
 /* Forward Declarations */
 static void item_link_q(item *it);
@@ -24,12 +27,38 @@ static void item_unlink_q(item *it);
  */
 #define ITEM_UPDATE_INTERVAL 60
 
+/*
+ * Items with an exptime are also kept in an expiry index: a hierarchical
+ * timer wheel keyed on exptime. The first level has one-second slots and
+ * is per slab class so the allocator can look for items about to expire;
+ * each coarser level is shared and covers TTL_WHEEL_SLOTS times the span
+ * of the level below. Whenever the finest level wraps around, the matching
+ * slot of the next level is cascaded down, so every item in the first
+ * level slot for time t (t less than TTL_BUCKETS seconds ahead) expires at
+ * t or has already expired.
+ */
+#define TTL_BUCKETS_POWER 8
+#define TTL_BUCKETS (1 << TTL_BUCKETS_POWER)
+#define TTL_WHEEL_POWER 6
+#define TTL_WHEEL_SLOTS (1 << TTL_WHEEL_POWER)
+#define TTL_WHEEL_LEVELS 3
+
+/* Number of expired items the expiry thread unlinks per lock acquisition */
+#define TTL_EXPIRE_BATCH 500
+
+/* evicted_ttl_remaining histogram, power of two buckets up to ~97 days */
+#define TTL_HISTOGRAM 24
+
 #define LARGEST_ID POWER_LARGEST
 typedef struct {
     unsigned int evicted;
     unsigned int evicted_nonzero;
+    unsigned int evicted_ttl_remaining[TTL_HISTOGRAM];
     rel_time_t evicted_time;
     unsigned int reclaimed;
+    unsigned int expired;
+    unsigned int crawler_reclaimed;
+    unsigned int ghost_hits;
     unsigned int outofmemory;
     unsigned int tailrepairs;
 } itemstats_t;
@@ -38,6 +67,46 @@ static item *heads[LARGEST_ID];
 static item *tails[LARGEST_ID];
 static itemstats_t itemstats[LARGEST_ID];
 static unsigned int sizes[LARGEST_ID];
+/*
+ * Number of linked items per 32 byte size bucket, up to 1MB, kept up to
+ * date on link/unlink so "stats sizes" doesn't have to walk every item.
+ */
+#define SIZE_HISTOGRAM_BUCKETS 32768
+static unsigned int size_histogram[SIZE_HISTOGRAM_BUCKETS];
+
+/*
+ * Ghost lists: hashes of the keys most recently evicted from each class,
+ * direct mapped on the hash. A store whose key is found here would have
+ * been a hit if the class had been a bit bigger; the slab automover uses
+ * the count of those to decide which class to give pages to. Only kept
+ * while automove is enabled.
+ */
+#define GHOST_SLOTS 256
+static uint32_t ghosts[LARGEST_ID][GHOST_SLOTS];
+
+/*
+ * Head of an expiry index slot. The pprev of the first item points at it,
+ * so with compact items the heads are in the arena (see
+ * start_item_expiry_thread()) and 8 bytes apart, like item links.
+ */
+typedef struct {
+    ITEM_LINK(struct _stritem) first;
+#ifdef ENABLE_COMPACT_ITEMS
+    uint32_t        unused;
+#endif
+} ttl_slot;
+
+static ttl_slot (*ttl_buckets)[TTL_BUCKETS];      /* [LARGEST_ID] */
+static ttl_slot (*ttl_wheel)[TTL_WHEEL_SLOTS];    /* [TTL_WHEEL_LEVELS] */
+/* The next second the expiry thread will process. */
+static rel_time_t ttl_wheel_time = 0;
+
+/*
+ * GreedyDual "inflation" value L: the priority of the most recently evicted
+ * item. New and re-accessed items are valued relative to it, so items that
+ * stop being accessed age out without having to touch every priority.
+ */
+static double gdsf_clock = 0;
 
 void item_stats_reset(void) {
     pthread_mutex_lock(&cache_lock);
@@ -66,68 +135,301 @@ uint64_t get_cas_id(void) {
 /**
  * Generates the variable-sized part of the header for an object.
  *
- * key     - The key
  * nkey    - The length of the key
  * flags   - key flags
  * nbytes  - Number of bytes to hold value and addition CRLF terminator
- * suffix  - Buffer for the "VALUE" line suffix (flags, size).
- * nsuffix - The length of the suffix is stored here.
+ * nsuffix - The space needed for the flags is stored here.
  *
  * Returns the total size of the header.
  */
 static size_t item_make_header(const uint8_t nkey, const int flags, const int nbytes,
-                     char *suffix, uint8_t *nsuffix) {
-    /* suffix is defined at 40 chars elsewhere.. */
-    *nsuffix = (uint8_t) snprintf(suffix, 40, " %d %d\r\n", flags, nbytes - 2);
+                     uint8_t *nsuffix) {
+    /* The flags are stored in binary, and not at all if they are 0 */
+    *nsuffix = flags == 0 ? 0 : sizeof(uint32_t);
     return sizeof(item) + nkey + *nsuffix + nbytes;
 }
 
-/*@null@*/
-item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes) {
-    uint8_t nsuffix;
-    item *it = NULL;
-    char suffix[40];
-    size_t ntotal = item_make_header(nkey + 1, flags, nbytes, suffix, &nsuffix);
+/*
+ * The whole size of an item: the header above plus the optional parts
+ * do_item_alloc() adds for the settings in use and the exptime.
+ */
+static size_t item_ntotal(const size_t nkey, const int flags,
+                          const rel_time_t exptime, const int nbytes,
+                          uint8_t *nsuffix) {
+    size_t ntotal = item_make_header(nkey + 1, flags, nbytes, nsuffix);
+
     if (settings.use_cas) {
         ntotal += sizeof(uint64_t);
     }
+    if (settings.gdsf) {
+        ntotal += sizeof(item_gdsf);
+    }
+    if (exptime != 0) {
+        ntotal += sizeof(item_ttl);
+    }
+    return ntotal;
+}
 
-    unsigned int id = slabs_clsid(ntotal);
-    if (id == 0)
+static unsigned int *item_size_bucket(item *it) {
+    size_t ntotal = ITEM_ntotal(it);
+    size_t bucket = ntotal / 32;
+    if ((ntotal % 32) != 0) bucket++;
+    return bucket < SIZE_HISTOGRAM_BUCKETS ? &size_histogram[bucket] : NULL;
+}
+
+/* Whether an item was invalidated by flush_all. */
+static bool item_is_flushed(item *it) {
+    rel_time_t oldest_live = settings.oldest_live;
+
+    if (oldest_live == 0 || oldest_live > current_time)
+        return false;
+    if (it->time != oldest_live)
+        return it->time < oldest_live;
+    /* Same second as an immediate flush_all: linked before or after it? */
+    return !settings.flush_gen_live || it->flush_gen != settings.flush_gen;
+}
+
+/* Recomputes the GDSF priority of an item: H = L + freq * cost / size */
+static void item_gdsf_prioritize(item *it) {
+    item_gdsf *gdsf = ITEM_gdsf(it);
+    gdsf->priority = gdsf_clock +
+        (double)gdsf->freq * gdsf->cost / ITEM_ntotal(it);
+}
+
+/*
+ * Picks the eviction victim in GDSF mode: the unreferenced item with the
+ * lowest priority among the last 50 items of the LRU. Expired items are
+ * taken right away since they're worth nothing.
+ */
+static item *item_gdsf_victim(const unsigned int id) {
+    int tries = 50;
+    item *search, *victim = NULL;
+
+    for (search = tails[id]; tries > 0 && search != NULL;
+         tries--, search = ITEM_prev(search)) {
+        if (search->refcount != 0)
+            continue;
+        if ((ITEM_exptime(search) != 0 && ITEM_exptime(search) <= current_time) ||
+            item_is_flushed(search))
+            return search;
+        if (victim == NULL ||
+            ITEM_gdsf(search)->priority < ITEM_gdsf(victim)->priority) {
+            victim = search;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Priority of the item GDSF would evict next from a class, or 0 if the
+ * class holds nothing worth keeping there: no item it could evict, or an
+ * expired one. Slab automove takes pages from the class where this is
+ * lowest.
+ */
+static double item_gdsf_tail_priority(const unsigned int id) {
+    item *victim = item_gdsf_victim(id);
+
+    if (victim == NULL ||
+        (ITEM_exptime(victim) != 0 && ITEM_exptime(victim) <= current_time) ||
+        item_is_flushed(victim))
         return 0;
+    return ITEM_gdsf(victim)->priority;
+}
+
+/* Adds an item with an exptime to the expiry index. */
+static void item_ttl_link(item *it) {
+    ITEM_LINK(struct _stritem) *head;
+    item_ttl *ttl = ITEM_ttl(it);
+    rel_time_t expires = ITEM_exptime(it);
+    rel_time_t delta;
+    int level;
+
+    /* Already expired: reclaim it on the next tick. */
+    if (expires < ttl_wheel_time)
+        expires = ttl_wheel_time;
+
+    delta = expires - ttl_wheel_time;
+    if (delta < TTL_BUCKETS) {
+        head = &ttl_buckets[it->slabs_clsid][expires % TTL_BUCKETS].first;
+    } else {
+        for (level = 0; level < TTL_WHEEL_LEVELS - 1; level++) {
+            if (delta < 1U << (TTL_BUCKETS_POWER + (level + 1) * TTL_WHEEL_POWER))
+                break;
+        }
+        if (level == TTL_WHEEL_LEVELS - 1 &&
+            delta >= 1U << (TTL_BUCKETS_POWER + TTL_WHEEL_LEVELS * TTL_WHEEL_POWER)) {
+            /* Beyond the wheel; park it in the furthest slot and let the
+             * cascade put it back in when that one comes around. */
+            expires = ttl_wheel_time - 1 +
+                (1U << (TTL_BUCKETS_POWER + TTL_WHEEL_LEVELS * TTL_WHEEL_POWER));
+        }
+        head = &ttl_wheel[level][(expires >> (TTL_BUCKETS_POWER +
+                                              level * TTL_WHEEL_POWER))
+                                 % TTL_WHEEL_SLOTS].first;
+    }
 
-    /* do a quick check if we have any expired items in the tail.. */
+    ttl->pprev = ITEM_REF(head);
+    ttl->next = *head;
+    if (ttl->next) ITEM_ttl(TTL_next(ttl))->pprev = ITEM_REF(&ttl->next);
+    *head = ITEM_REF(it);
+}
+
+static void item_ttl_unlink(item *it) {
+    item_ttl *ttl = ITEM_ttl(it);
+
+    assert(ttl->pprev != 0);
+    *TTL_pprev(ttl) = ttl->next;
+    if (ttl->next) ITEM_ttl(TTL_next(ttl))->pprev = ttl->pprev;
+    ttl->next = 0;
+    ttl->pprev = 0;
+}
+
+/*
+ * Finds the unreferenced item of a class with the least remaining lifetime:
+ * an expired one the expiry thread hasn't got to yet, or one that expires
+ * within settings.ttl_evict_window seconds. Gives up after looking at 50
+ * items, same as the LRU tail search.
+ */
+static item *item_ttl_victim(const unsigned int id) {
     int tries = 50;
+    rel_time_t last = current_time + settings.ttl_evict_window;
+    rel_time_t t;
     item *search;
 
-    for (search = tails[id];
-         tries > 0 && search != NULL;
-         tries--, search=search->prev) {
-        if (search->refcount == 0 &&
-            (search->exptime != 0 && search->exptime < current_time)) {
-            it = search;
-            /* I don't want to actually free the object, just steal
-             * the item to avoid to grab the slab mutex twice ;-)
-             */
+    if (last >= ttl_wheel_time + TTL_BUCKETS)
+        last = ttl_wheel_time + TTL_BUCKETS - 1;
+
+    for (t = ttl_wheel_time; t <= last; t++) {
+        for (search = ITEM_PTR(ttl_buckets[id][t % TTL_BUCKETS].first);
+             search != NULL; search = TTL_next(ITEM_ttl(search))) {
+            if (search->refcount == 0)
+                return search;
+            if (--tries == 0)
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Maps the remaining lifetime of an evicted item to its histogram slot */
+static int item_ttl_histogram_slot(rel_time_t remaining) {
+    int slot = 0;
+    while (remaining > 1 && slot < TTL_HISTOGRAM - 1) {
+        remaining >>= 1;
+        slot++;
+    }
+    return slot;
+}
+
+/*
+ * With -o allocator=log, evicting an item frees memory only once the
+ * cleaner finds a segment with enough dead space to be worth compacting.
+ * After LOG_EVICT_ANY evictions for one allocation it takes any segment
+ * that makes room; after LOG_EVICT_MAX it gives up.
+ */
+#define LOG_EVICT_ANY 400
+#define LOG_EVICT_MAX 4000
+
+/*
+ * Evicts one item from the tail of class id's LRU, or whatever item the
+ * eviction policy picks. Returns false if there was nothing to evict.
+ */
+static bool do_item_evict(const unsigned int id) {
+    int tries = 50;
+    item *search;
+
+    /*
+     * try to get one off the right LRU
+     * don't necessariuly unlink the tail because it may be locked: refcount>0
+     * search up from tail an item with refcount==0 and unlink it; give up after 50
+     * tries
+     */
+
+    /* Items that expired or are about to go before any live data */
+    search = item_ttl_victim(id);
+
+    if (search != NULL) {
+        /* found in the expiry index */
+    } else if (settings.gdsf) {
+        search = item_gdsf_victim(id);
+        /* L only moves forward, and only on evictions: expired and
+         * flushed victims are reclaims, and their priority is stale. A
+         * class's lowest priority can also be below an L that another
+         * class's eviction already set. */
+        if (search != NULL &&
+            (ITEM_exptime(search) == 0 || ITEM_exptime(search) > current_time) &&
+            !item_is_flushed(search) &&
+            ITEM_gdsf(search)->priority > gdsf_clock)
+            gdsf_clock = ITEM_gdsf(search)->priority;
+    } else {
+        item *best = NULL;
+        uint32_t least = UINT32_MAX;
+
+        for (search = tails[id]; tries > 0 && search != NULL; tries--, search = ITEM_prev(search)) {
+            if (search->refcount != 0)
+                continue;
+            if (settings.allocator == ALLOCATOR_SLAB) {
+                best = search;
+                break;
+            }
+            /* The log gets memory back a segment at a time; of the items
+             * at the tail, evict the one in the emptiest segment */
+            if (slabs_log_live(search) < least) {
+                least = slabs_log_live(search);
+                best = search;
+            }
+        }
+        search = best;
+    }
+
+    if (search != NULL) {
+        if ((ITEM_exptime(search) == 0 || ITEM_exptime(search) > current_time) &&
+            !item_is_flushed(search)) {
+            itemstats[id].evicted++;
+            itemstats[id].evicted_time = current_time - search->time;
+            if (ITEM_exptime(search) != 0) {
+                itemstats[id].evicted_nonzero++;
+                itemstats[id].evicted_ttl_remaining[
+                    item_ttl_histogram_slot(ITEM_exptime(search) - current_time)]++;
+            }
             STATS_LOCK();
-            stats.reclaimed++;
+            stats.evictions++;
             STATS_UNLOCK();
+            if (settings.slab_automove) {
+                ghosts[id][search->hv % GHOST_SLOTS] = search->hv;
+            }
+        } else {
             itemstats[id].reclaimed++;
-            it->refcount = 1;
-            do_item_unlink(it);
-            /* Initialize the item block: */
-            it->slabs_clsid = 0;
-            it->refcount = 0;
-            break;
+            STATS_LOCK();
+            stats.reclaimed++;
+            STATS_UNLOCK();
         }
+        do_item_unlink(search);
     }
+    return search != NULL;
+}
+
+/*
+ * Gets ntotal bytes from slab class id, evicting an item from the tail of
+ * the class' LRU if the class is out of memory.
+ */
+static void *do_item_alloc_mem(const size_t ntotal, const unsigned int id) {
+    void *ret;
+    int tries, evictions;
+    item *search;
+
+    /* Expired items are reclaimed by the expiry thread, so there is no
+     * point looking for them in the tail before allocating. */
+    if ((ret = slabs_alloc(ntotal, id, 0)) == NULL) {
+        /* Compacting the log frees memory without evicting anything */
+        if (settings.allocator == ALLOCATOR_LOG && slabs_log_clean(0, false) &&
+            (ret = slabs_alloc(ntotal, id, 0)) != NULL) {
+            return ret;
+        }
 
-    if (it == NULL && (it = slabs_alloc(ntotal, id)) == NULL) {
         /*
-        ** Could not find an expired item at the tail, and memory allocation
-        ** failed. Try to evict some items!
+        ** Memory allocation failed. Try to evict some items!
         */
-        tries = 50;
 
         /* If requested to not push old items out of cache when memory runs out,
          * we're out of luck at this point...
@@ -138,40 +440,22 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_tim
             return NULL;
         }
 
-        /*
-         * try to get one off the right LRU
-         * don't necessariuly unlink the tail because it may be locked: refcount>0
-         * search up from tail an item with refcount==0 and unlink it; give up after 50
-         * tries
-         */
-
         if (tails[id] == 0) {
             itemstats[id].outofmemory++;
             return NULL;
         }
 
-        for (search = tails[id]; tries > 0 && search != NULL; tries--, search=search->prev) {
-            if (search->refcount == 0) {
-                if (search->exptime == 0 || search->exptime > current_time) {
-                    itemstats[id].evicted++;
-                    itemstats[id].evicted_time = current_time - search->time;
-                    if (search->exptime != 0)
-                        itemstats[id].evicted_nonzero++;
-                    STATS_LOCK();
-                    stats.evictions++;
-                    STATS_UNLOCK();
-                } else {
-                    itemstats[id].reclaimed++;
-                    STATS_LOCK();
-                    stats.reclaimed++;
-                    STATS_UNLOCK();
-                }
-                do_item_unlink(search);
+        do_item_evict(id);
+        ret = slabs_alloc(ntotal, id, 0);
+        for (evictions = 1; ret == NULL && settings.allocator == ALLOCATOR_LOG &&
+                 evictions < LOG_EVICT_MAX; evictions++) {
+            if (!slabs_log_clean(ntotal, evictions >= LOG_EVICT_ANY) &&
+                !do_item_evict(id)) {
                 break;
             }
+            ret = slabs_alloc(ntotal, id, 0);
         }
-        it = slabs_alloc(ntotal, id);
-        if (it == 0) {
+        if (ret == 0) {
             itemstats[id].outofmemory++;
             /* Last ditch effort. There is a very rare bug which causes
              * refcount leaks. We've fixed most of them, but it still happens,
@@ -181,37 +465,151 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_tim
              * free it anyway.
              */
             tries = 50;
-            for (search = tails[id]; tries > 0 && search != NULL; tries--, search=search->prev) {
-                if (search->refcount != 0 && search->time + TAIL_REPAIR_TIME < current_time) {
+            for (search = tails[id]; tries > 0 && search != NULL; tries--, search = ITEM_prev(search)) {
+                if (search->refcount != 0 && search->time + TAIL_REPAIR_TIME < current_time &&
+                    (search->it_flags & ITEM_CRAWLER) == 0) {
                     itemstats[id].tailrepairs++;
                     search->refcount = 0;
                     do_item_unlink(search);
                     break;
                 }
             }
-            it = slabs_alloc(ntotal, id);
-            if (it == 0) {
-                return NULL;
-            }
+            ret = slabs_alloc(ntotal, id, 0);
         }
     }
+    return ret;
+}
+
+/*
+ * Allocates the chunks for the part of a chunked item's value that doesn't
+ * fit in the item itself. Every chunk but the last comes from the item's
+ * (largest) class; the last one comes from the smallest class it fits in,
+ * if that class has room.
+ */
+static int do_item_alloc_chunks(item *it, const int inline_len) {
+    const unsigned int largest = it->slabs_clsid;
+    const int chunk_max = settings.slab_chunk_size_max - sizeof(item_chunk);
+    item_chunk *prev = NULL;
+    int offset = inline_len;
+
+    while (offset < it->nbytes) {
+        const int len = it->nbytes - offset;
+        item_chunk *ch = NULL;
+        unsigned int id;
+        size_t ntotal;
+
+        if (len < chunk_max) {
+            ntotal = sizeof(item_chunk) + len;
+            id = slabs_clsid(ntotal);
+            ch = do_item_alloc_mem(ntotal, id);
+        }
+        if (ch == NULL) {
+            ntotal = sizeof(item_chunk) + (len < chunk_max ? len : chunk_max);
+            id = largest;
+            ch = do_item_alloc_mem(ntotal, id);
+            if (ch == NULL)
+                return -1;
+        }
+
+        ch->next = 0;
+        ch->prev = ITEM_REF(prev);
+        ch->head = ITEM_REF(it);
+        ch->offset = offset;
+        ch->size = ntotal;
+        ch->nbytes = ntotal - sizeof(item_chunk);
+        ch->refcount = 0;
+        ch->it_flags = ITEM_CHUNK;
+        ch->slabs_clsid = id;
+        if (prev != NULL) {
+            prev->next = ITEM_REF(ch);
+        } else {
+            *ITEM_chunks(it) = ITEM_REF(ch);
+        }
+        prev = ch;
+        offset += ch->nbytes;
+    }
+    return 0;
+}
+
+/*@null@*/
+item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes, const uint32_t hv) {
+    uint8_t nsuffix;
+    item *it = NULL;
+    size_t ntotal = item_ntotal(nkey, flags, exptime, nbytes, &nsuffix);
+    unsigned int id;
+    bool chunked;
+
+    if (ntotal > settings.item_size_max)
+        return 0;
+
+    /* Too big for any slab class: the item takes a whole chunk of the
+     * largest class and the rest of the value goes in item_chunks */
+    chunked = ntotal > settings.slab_chunk_size_max;
+    if (chunked) {
+        ntotal = settings.slab_chunk_size_max;
+    }
+
+    slabs_size_sample(ntotal);
+    id = slabs_clsid(ntotal);
+    if (id == 0)
+        return 0;
+
+    if ((it = do_item_alloc_mem(ntotal, id)) == NULL)
+        return NULL;
 
     assert(it->slabs_clsid == 0);
 
     it->slabs_clsid = id;
 
+    if (settings.slab_automove) {
+        if (hv != 0 && ghosts[id][hv % GHOST_SLOTS] == hv) {
+            ghosts[id][hv % GHOST_SLOTS] = 0;
+            itemstats[id].ghost_hits++;
+        }
+    }
+
     assert(it != heads[it->slabs_clsid]);
 
     it->next = it->prev = it->h_next = 0;
     it->refcount = 1;     /* the caller will have a reference */
     DEBUG_REFCNT(it, '*');
     it->it_flags = settings.use_cas ? ITEM_CAS : 0;
+    if (settings.gdsf) {
+        it->it_flags |= ITEM_GDSF;
+        ITEM_gdsf(it)->priority = 0;
+        ITEM_gdsf(it)->cost = 1;
+        ITEM_gdsf(it)->freq = 1;
+    }
+    if (exptime != 0) {
+        it->it_flags |= ITEM_TTL;
+        ITEM_ttl(it)->next = 0;
+        ITEM_ttl(it)->pprev = 0;
+#ifdef ENABLE_COMPACT_ITEMS
+        ITEM_ttl(it)->exptime = exptime;
+#endif
+    }
+#ifndef ENABLE_COMPACT_ITEMS
+    it->exptime = exptime;
+#endif
+    if (chunked) {
+        it->it_flags |= ITEM_CHUNKED;
+        *ITEM_chunks(it) = 0;
+    }
     it->nkey = nkey;
+    it->encoding = ITEM_RAW;
+    it->hv = hv;
     it->nbytes = nbytes;
-    memcpy(ITEM_key(it), key, nkey);
-    it->exptime = exptime;
-    memcpy(ITEM_suffix(it), suffix, (size_t)nsuffix);
     it->nsuffix = nsuffix;
+    if (nsuffix != 0)
+        *ITEM_flags(it) = flags;
+    memcpy(ITEM_key(it), key, nkey);
+
+    if (chunked &&
+        do_item_alloc_chunks(it, ntotal - (ITEM_data(it) - (char *)it)) != 0) {
+        it->refcount = 0;
+        item_free(it);
+        return NULL;
+    }
     return it;
 }
 
@@ -223,6 +621,21 @@ void item_free(item *it) {
     assert(it != tails[it->slabs_clsid]);
     assert(it->refcount == 0);
 
+    if (it->it_flags & ITEM_CHUNKED) {
+        item_chunk *ch = ITEM_first_chunk(it);
+        item_chunk *next;
+
+        /* The item itself is a full chunk of its class */
+        ntotal = settings.slab_chunk_size_max;
+        for (; ch != NULL; ch = next) {
+            next = CHUNK_next(ch);
+            clsid = ch->slabs_clsid;
+            ch->slabs_clsid = 0;
+            ch->it_flags = ITEM_SLABBED;
+            slabs_free(ch, ch->size, clsid);
+        }
+    }
+
     /* so slab size changer can tell later if item is already free or not */
     clsid = it->slabs_clsid;
     it->slabs_clsid = 0;
@@ -236,11 +649,157 @@ void item_free(item *it) {
  * the maximum for a cache entry.)
  */
 bool item_size_ok(const size_t nkey, const int flags, const int nbytes) {
-    char prefix[40];
     uint8_t nsuffix;
 
-    return slabs_clsid(item_make_header(nkey + 1, flags, nbytes,
-                                        prefix, &nsuffix)) != 0;
+    return item_make_header(nkey + 1, flags, nbytes,
+                            &nsuffix) <= settings.item_size_max;
+}
+
+/*
+ * Returns the slab class do_item_alloc() would take an item from, or 0 if
+ * the item is too big to store. Items that need chunks count as the
+ * largest class.
+ */
+unsigned int item_slabs_clsid(const size_t nkey, const int flags,
+                              const rel_time_t exptime, const int nbytes) {
+    uint8_t nsuffix;
+    size_t ntotal = item_ntotal(nkey, flags, exptime, nbytes, &nsuffix);
+
+    if (ntotal > settings.item_size_max)
+        return 0;
+    if (ntotal > settings.slab_chunk_size_max)
+        ntotal = settings.slab_chunk_size_max;
+    return slabs_clsid(ntotal);
+}
+
+/*
+ * Returns the length of the value as the client stored it, "\r\n"
+ * included. An ITEM_LZ4 item holds that length in its first four bytes,
+ * then the LZ4 block and "\r\n"; it is never chunked.
+ */
+int item_raw_nbytes(item *it) {
+    uint32_t raw;
+
+    if (it->encoding == ITEM_RAW)
+        return it->nbytes;
+    memcpy(&raw, ITEM_data(it), sizeof(raw));
+    return raw;
+}
+
+#ifdef ENABLE_LZ4
+/*
+ * Writes the value of an ITEM_LZ4 item to buf, which has room for
+ * item_raw_nbytes(it) bytes. Returns false if the stored block doesn't
+ * decompress to the length it claims.
+ */
+bool item_decompress(item *it, char *buf) {
+    const int raw = item_raw_nbytes(it) - 2;
+    const int stored = it->nbytes - sizeof(uint32_t) - 2;
+
+    assert(it->encoding == ITEM_LZ4 && !(it->it_flags & ITEM_CHUNKED));
+    if (LZ4_decompress_safe(ITEM_data(it) + sizeof(uint32_t), buf,
+                            stored, raw) != raw)
+        return false;
+    memcpy(buf + raw, "\r\n", 2);
+    return true;
+}
+#endif
+
+/*
+ * Returns a pointer to byte "offset" of an item's value, and in *len the
+ * number of bytes that can be read or written there in one go.
+ */
+char *item_data_at(item *it, const int offset, int *len) {
+    item_chunk *ch;
+
+    if ((it->it_flags & ITEM_CHUNKED) == 0) {
+        *len = it->nbytes - offset;
+        return ITEM_data(it) + offset;
+    }
+    ch = ITEM_first_chunk(it);
+    if (offset < ch->offset) {
+        *len = ch->offset - offset;
+        return ITEM_data(it) + offset;
+    }
+    while (offset >= ch->offset + ch->nbytes)
+        ch = CHUNK_next(ch);
+    *len = ch->offset + ch->nbytes - offset;
+    return ch->data + (offset - ch->offset);
+}
+
+/*
+ * Finds where in the value ptr points to: returns ptr, or the start of the
+ * next chunk if ptr is at the end of one, and sets *len to the number of
+ * bytes left in that piece. Returns NULL if ptr isn't in the value.
+ */
+char *item_data_next(item *it, char *ptr, int *len) {
+    item_chunk *ch;
+    int inline_len = it->nbytes;
+
+    if (it->it_flags & ITEM_CHUNKED)
+        inline_len = ITEM_first_chunk(it)->offset;
+    if (ptr >= ITEM_data(it) && ptr < ITEM_data(it) + inline_len) {
+        *len = ITEM_data(it) + inline_len - ptr;
+        return ptr;
+    }
+    if ((it->it_flags & ITEM_CHUNKED) == 0)
+        return NULL;
+
+    for (ch = ITEM_first_chunk(it); ch != NULL; ch = CHUNK_next(ch)) {
+        if (ptr >= ch->data && ptr < ch->data + ch->nbytes) {
+            *len = ch->data + ch->nbytes - ptr;
+            return ptr;
+        }
+        item_chunk *prev = CHUNK_prev(ch);
+        if (prev != NULL ? ptr == prev->data + prev->nbytes
+                         : ptr == ITEM_data(it) + inline_len) {
+            *len = ch->nbytes;
+            return ch->data;
+        }
+    }
+    return NULL;
+}
+
+/* Copies len bytes of an item's value, starting at offset, into buf. */
+void item_data_read(item *it, int offset, char *buf, int len) {
+    while (len > 0) {
+        int n;
+        char *p = item_data_at(it, offset, &n);
+        if (n > len)
+            n = len;
+        memcpy(buf, p, n);
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+/* Copies len bytes from buf into an item's value, starting at offset. */
+void item_data_write(item *it, int offset, const char *buf, int len) {
+    while (len > 0) {
+        int n;
+        char *p = item_data_at(it, offset, &n);
+        if (n > len)
+            n = len;
+        memcpy(p, buf, n);
+        buf += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+/* Copies len bytes of one item's value into another's. */
+void item_data_copy(item *dst, int doffset, item *src, int soffset, int len) {
+    while (len > 0) {
+        int n;
+        char *p = item_data_at(src, soffset, &n);
+        if (n > len)
+            n = len;
+        item_data_write(dst, doffset, p, n);
+        doffset += n;
+        soffset += n;
+        len -= n;
+    }
 }
 
 static void item_link_q(item *it) { /* item is the new head */
@@ -253,8 +812,8 @@ static void item_link_q(item *it) { /* item is the new head */
     assert(it != *head);
     assert((*head && *tail) || (*head == 0 && *tail == 0));
     it->prev = 0;
-    it->next = *head;
-    if (it->next) it->next->prev = it;
+    it->next = ITEM_REF(*head);
+    if (*head) (*head)->prev = ITEM_REF(it);
     *head = it;
     if (*tail == 0) *tail = it;
     sizes[it->slabs_clsid]++;
@@ -269,28 +828,49 @@ static void item_unlink_q(item *it) {
 
     if (*head == it) {
         assert(it->prev == 0);
-        *head = it->next;
+        *head = ITEM_next(it);
     }
     if (*tail == it) {
         assert(it->next == 0);
-        *tail = it->prev;
+        *tail = ITEM_prev(it);
     }
-    assert(it->next != it);
-    assert(it->prev != it);
+    assert(ITEM_next(it) != it);
+    assert(ITEM_prev(it) != it);
 
-    if (it->next) it->next->prev = it->prev;
-    if (it->prev) it->prev->next = it->next;
+    if (it->next) ITEM_next(it)->prev = it->prev;
+    if (it->prev) ITEM_prev(it)->next = it->next;
     sizes[it->slabs_clsid]--;
     return;
 }
 
+/*
+ * The open hash table is full and couldn't grow: evict an item to free a
+ * slot, from the item's own class first. Returns false if nothing could go.
+ */
+static bool do_item_evict_for_slot(const unsigned int id) {
+    unsigned int i;
+
+    if (do_item_evict(id))
+        return true;
+    for (i = POWER_SMALLEST; i < LARGEST_ID; i++) {
+        if (i != id && do_item_evict(i))
+            return true;
+    }
+    return false;
+}
+
 int do_item_link(item *it) {
+    unsigned int *bucket;
     MEMCACHED_ITEM_LINK(ITEM_key(it), it->nkey, it->nbytes);
     assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
-    assert(it->nbytes < (1024 * 1024));  /* 1MB max size */
+    assert(it->nbytes <= settings.item_size_max);
+    while (!assoc_insert(it)) {
+        if (!do_item_evict_for_slot(it->slabs_clsid))
+            return 0;
+    }
     it->it_flags |= ITEM_LINKED;
     it->time = current_time;
-    assoc_insert(it);
+    it->flush_gen = settings.flush_gen;
 
     STATS_LOCK();
     stats.curr_bytes += ITEM_ntotal(it);
@@ -298,15 +878,26 @@ int do_item_link(item *it) {
     stats.total_items += 1;
     STATS_UNLOCK();
 
+    if ((bucket = item_size_bucket(it)) != NULL)
+        (*bucket)++;
+
     /* Allocate a new CAS ID on link. */
     ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
 
+    if (it->it_flags & ITEM_GDSF) {
+        item_gdsf_prioritize(it);
+    }
+
     item_link_q(it);
+    if (it->it_flags & ITEM_TTL) {
+        item_ttl_link(it);
+    }
 
     return 1;
 }
 
 void do_item_unlink(item *it) {
+    unsigned int *bucket;
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
@@ -314,12 +905,57 @@ void do_item_unlink(item *it) {
         stats.curr_bytes -= ITEM_ntotal(it);
         stats.curr_items -= 1;
         STATS_UNLOCK();
-        assoc_delete(ITEM_key(it), it->nkey);
+        if ((bucket = item_size_bucket(it)) != NULL)
+            (*bucket)--;
+        assoc_delete(ITEM_key(it), it->nkey, it->hv);
         item_unlink_q(it);
+        if (it->it_flags & ITEM_TTL) {
+            item_ttl_unlink(it);
+        }
         if (it->refcount == 0) item_free(it);
     }
 }
 
+/*
+ * Moves a linked, unreferenced item into another chunk of its slab class,
+ * keeping its place in the hash table, the LRU and the expiry index, and
+ * frees the old chunk. Used to empty a slab page that is being moved.
+ */
+void do_item_relocate(item *it, item *new_it) {
+    const unsigned int id = it->slabs_clsid;
+
+    assert((it->it_flags & ITEM_LINKED) != 0);
+    assert((it->it_flags & ITEM_CHUNKED) == 0);
+    assert(it->refcount == 0);
+    memcpy(new_it, it, ITEM_ntotal(it));
+
+    assoc_delete(ITEM_key(it), it->nkey, it->hv);
+    new_it->h_next = 0;
+    /* Can't fail: the delete just freed a slot on the same probe path */
+    assoc_insert(new_it);
+
+    if (new_it->prev) {
+        ITEM_prev(new_it)->next = ITEM_REF(new_it);
+    } else {
+        heads[id] = new_it;
+    }
+    if (new_it->next) {
+        ITEM_next(new_it)->prev = ITEM_REF(new_it);
+    } else {
+        tails[id] = new_it;
+    }
+
+    if (new_it->it_flags & ITEM_TTL) {
+        item_ttl *ttl = ITEM_ttl(new_it);
+        *TTL_pprev(ttl) = ITEM_REF(new_it);
+        if (ttl->next) ITEM_ttl(TTL_next(ttl))->pprev = ITEM_REF(&ttl->next);
+    }
+
+    it->it_flags &= ~ITEM_LINKED;
+    it->next = it->prev = 0;
+    item_free(it);
+}
+
 void do_item_remove(item *it) {
     MEMCACHED_ITEM_REMOVE(ITEM_key(it), it->nkey, it->nbytes);
     assert((it->it_flags & ITEM_SLABBED) == 0);
@@ -334,6 +970,10 @@ void do_item_remove(item *it) {
 
 void do_item_update(item *it) {
     MEMCACHED_ITEM_UPDATE(ITEM_key(it), it->nkey, it->nbytes);
+    if (it->it_flags & ITEM_GDSF) {
+        ITEM_gdsf(it)->freq++;
+        item_gdsf_prioritize(it);
+    }
     if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
         assert((it->it_flags & ITEM_SLABBED) == 0);
 
@@ -372,19 +1012,23 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
     bufcurr = 0;
 
     while (it != NULL && (limit == 0 || shown < limit)) {
+        if (it->it_flags & ITEM_CRAWLER) {
+            it = ITEM_next(it);
+            continue;
+        }
         assert(it->nkey <= KEY_MAX_LENGTH);
         /* Copy the key since it may not be null-terminated in the struct */
         strncpy(key_temp, ITEM_key(it), it->nkey);
         key_temp[it->nkey] = 0x00; /* terminate */
         len = snprintf(temp, sizeof(temp), "ITEM %s [%d b; %lu s]\r\n",
-                       key_temp, it->nbytes - 2,
-                       (unsigned long)it->exptime + process_started);
+                       key_temp, item_raw_nbytes(it) - 2,
+                       (unsigned long)ITEM_exptime(it) + process_started);
         if (bufcurr + len + 6 > memlimit)  /* 6 is END\r\n\0 */
             break;
         memcpy(buffer + bufcurr, temp, len);
         bufcurr += len;
         shown++;
-        it = it->next;
+        it = ITEM_next(it);
     }
 
     memcpy(buffer + bufcurr, "END\r\n", 6);
@@ -395,7 +1039,7 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
 }
 
 void do_item_stats(ADD_STAT add_stats, void *c) {
-    int i;
+    int i, j;
     for (i = 0; i < LARGEST_ID; i++) {
         if (tails[i] != NULL) {
             const char *fmt = "items:%d:%s";
@@ -411,12 +1055,27 @@ void do_item_stats(ADD_STAT add_stats, void *c) {
                                 "%u", itemstats[i].evicted_nonzero);
             APPEND_NUM_FMT_STAT(fmt, i, "evicted_time",
                                 "%u", itemstats[i].evicted_time);
+            for (j = 0; j < TTL_HISTOGRAM; j++) {
+                char name[40];
+                if (itemstats[i].evicted_ttl_remaining[j] == 0)
+                    continue;
+                snprintf(name, sizeof(name), "evicted_ttl_remaining:%u",
+                         j == 0 ? 0 : 1U << j);
+                APPEND_NUM_FMT_STAT(fmt, i, name,
+                                    "%u", itemstats[i].evicted_ttl_remaining[j]);
+            }
             APPEND_NUM_FMT_STAT(fmt, i, "outofmemory",
                                 "%u", itemstats[i].outofmemory);
             APPEND_NUM_FMT_STAT(fmt, i, "tailrepairs",
                                 "%u", itemstats[i].tailrepairs);;
             APPEND_NUM_FMT_STAT(fmt, i, "reclaimed",
                                 "%u", itemstats[i].reclaimed);;
+            APPEND_NUM_FMT_STAT(fmt, i, "expired",
+                                "%u", itemstats[i].expired);
+            APPEND_NUM_FMT_STAT(fmt, i, "crawler_reclaimed",
+                                "%u", itemstats[i].crawler_reclaimed);
+            APPEND_NUM_FMT_STAT(fmt, i, "ghost_hits",
+                                "%u", itemstats[i].ghost_hits);
         }
     }
 
@@ -424,47 +1083,45 @@ void do_item_stats(ADD_STAT add_stats, void *c) {
     add_stats(NULL, 0, NULL, 0, c);
 }
 
+/*
+ * Snapshot of the per-class numbers the slab automover works from: total
+ * evictions, ghost list hits and the age of the oldest item in the LRU.
+ * Each array has POWER_LARGEST entries.
+ */
+void do_item_stats_automove(unsigned int *evicted, unsigned int *ghost_hits,
+                            rel_time_t *age, double *priority) {
+    int i;
+    for (i = 0; i < LARGEST_ID; i++) {
+        item *search = tails[i];
+        while (search != NULL && (search->it_flags & ITEM_CRAWLER) != 0)
+            search = ITEM_prev(search);
+        evicted[i] = itemstats[i].evicted;
+        ghost_hits[i] = itemstats[i].ghost_hits;
+        age[i] = search != NULL ? current_time - search->time : 0;
+        priority[i] = settings.gdsf ? item_gdsf_tail_priority(i) : 0;
+    }
+}
+
 /** dumps out a list of objects of each size, with granularity of 32 bytes */
 /*@null@*/
 void do_item_stats_sizes(ADD_STAT add_stats, void *c) {
+    int i;
 
     /* max 1MB object, divided into 32 bytes size buckets */
-    const int num_buckets = 32768;
-    unsigned int *histogram = calloc(num_buckets, sizeof(int));
-
-    if (histogram != NULL) {
-        int i;
-
-        /* build the histogram */
-        for (i = 0; i < LARGEST_ID; i++) {
-            item *iter = heads[i];
-            while (iter) {
-                int ntotal = ITEM_ntotal(iter);
-                int bucket = ntotal / 32;
-                if ((ntotal % 32) != 0) bucket++;
-                if (bucket < num_buckets) histogram[bucket]++;
-                iter = iter->next;
-            }
-        }
-
-        /* write the buffer */
-        for (i = 0; i < num_buckets; i++) {
-            if (histogram[i] != 0) {
-                char key[8];
-                int klen = 0;
-                klen = snprintf(key, sizeof(key), "%d", i * 32);
-                assert(klen < sizeof(key));
-                APPEND_STAT(key, "%u", histogram[i]);
-            }
+    for (i = 0; i < SIZE_HISTOGRAM_BUCKETS; i++) {
+        if (size_histogram[i] != 0) {
+            char key[8];
+            int klen = 0;
+            klen = snprintf(key, sizeof(key), "%d", i * 32);
+            assert(klen < sizeof(key));
+            APPEND_STAT(key, "%u", size_histogram[i]);
         }
-        free(histogram);
     }
     add_stats(NULL, 0, NULL, 0, c);
 }
 
-/** wrapper around assoc_find which does the lazy expiration logic */
-item *do_item_get(const char *key, const size_t nkey) {
-    item *it = assoc_find(key, nkey);
+/** the lazy expiration logic for an item assoc_find returned */
+static item *do_item_get_found(item *it, const char *key) {
     int was_found = 0;
 
     if (settings.verbose > 2) {
@@ -476,8 +1133,7 @@ item *do_item_get(const char *key, const size_t nkey) {
         }
     }
 
-    if (it != NULL && settings.oldest_live != 0 && settings.oldest_live <= current_time &&
-        it->time <= settings.oldest_live) {
+    if (it != NULL && item_is_flushed(it)) {
         do_item_unlink(it);           /* MTSAFE - cache_lock held */
         it = NULL;
     }
@@ -487,7 +1143,7 @@ item *do_item_get(const char *key, const size_t nkey) {
         was_found--;
     }
 
-    if (it != NULL && it->exptime != 0 && it->exptime <= current_time) {
+    if (it != NULL && ITEM_exptime(it) != 0 && ITEM_exptime(it) <= current_time) {
         do_item_unlink(it);           /* MTSAFE - cache_lock held */
         it = NULL;
     }
@@ -508,9 +1164,24 @@ item *do_item_get(const char *key, const size_t nkey) {
     return it;
 }
 
+/** wrapper around assoc_find which does the lazy expiration logic */
+item *do_item_get(const char *key, const size_t nkey, const uint32_t hv) {
+    return do_item_get_found(assoc_find(key, nkey, hv), key);
+}
+
+/** do_item_get for up to ITEM_GET_BATCH keys, see assoc_find_many */
+void do_item_get_many(const char **keys, const size_t *nkeys,
+                      const uint32_t *hvs, item **its, const int n) {
+    int i;
+
+    assoc_find_many(keys, nkeys, hvs, its, n);
+    for (i = 0; i < n; i++)
+        its[i] = do_item_get_found(its[i], keys[i]);
+}
+
 /** returns an item whether or not it's expired. */
-item *do_item_get_nocheck(const char *key, const size_t nkey) {
-    item *it = assoc_find(key, nkey);
+item *do_item_get_nocheck(const char *key, const size_t nkey, const uint32_t hv) {
+    item *it = assoc_find(key, nkey, hv);
     if (it) {
         it->refcount++;
         DEBUG_REFCNT(it, '+');
@@ -518,28 +1189,376 @@ item *do_item_get_nocheck(const char *key, const size_t nkey) {
     return it;
 }
 
-/* expires items that are more recent than the oldest_live setting. */
-void do_item_flush_expired(void) {
+/*
+ * Invalidates everything stored before "when" without touching a single
+ * item: do_item_get() and the eviction path treat flushed items as gone and
+ * the LRU crawler reclaims their memory. Items linked in the same second as
+ * an immediate flush are told apart by the flush generation they were
+ * linked in. It's 8 bits, so that only goes wrong for an item that sees
+ * 256 immediate flushes within the second it was stored in.
+ */
+void do_item_flush_expired(const rel_time_t when) {
+    if (when == current_time) {
+        settings.oldest_live = when;
+        settings.flush_gen++;
+        settings.flush_gen_live = true;
+    } else {
+        settings.oldest_live = when - 1;
+        settings.flush_gen_live = false;
+    }
+}
+
+/*
+ * Advances the expiry wheel up to the current time, unlinking the items
+ * that expired on the way. Unlinks or cascades at most TTL_EXPIRE_BATCH
+ * items, and returns false if that wasn't enough to catch up.
+ */
+static bool do_item_expire_batch(void) {
+    int budget = TTL_EXPIRE_BATCH;
+    int level, id;
+    item *it;
+
+    while (ttl_wheel_time <= current_time) {
+        /* When a level wraps around, pull the due slot of the next coarser
+         * level down. Items never cascade back into the slot they came
+         * from, so an interrupted cascade can simply be resumed. */
+        for (level = TTL_WHEEL_LEVELS - 1; level >= 0; level--) {
+            int shift = TTL_BUCKETS_POWER + level * TTL_WHEEL_POWER;
+            ttl_slot *slot;
+
+            if ((ttl_wheel_time & ((1U << shift) - 1)) != 0)
+                continue;
+            slot = &ttl_wheel[level][(ttl_wheel_time >> shift) % TTL_WHEEL_SLOTS];
+            while ((it = ITEM_PTR(slot->first)) != NULL) {
+                if (budget-- == 0)
+                    return false;
+                item_ttl_unlink(it);
+                item_ttl_link(it);
+            }
+        }
+
+        for (id = 0; id < LARGEST_ID; id++) {
+            ttl_slot *slot = &ttl_buckets[id][ttl_wheel_time % TTL_BUCKETS];
+            while ((it = ITEM_PTR(slot->first)) != NULL) {
+                if (budget-- == 0)
+                    return false;
+                itemstats[id].expired++;
+                STATS_LOCK();
+                stats.expired++;
+                STATS_UNLOCK();
+                do_item_unlink(it);
+            }
+        }
+        ttl_wheel_time++;
+    }
+    return true;
+}
+
+static pthread_cond_t expiry_cond = PTHREAD_COND_INITIALIZER;
+static volatile int do_run_expiry_thread = 1;
+static pthread_t expiry_tid;
+
+/*
+ * Frees the memory of expired items without waiting for a get or an
+ * allocation to stumble upon them. Wakes up every second and releases the
+ * cache lock between batches so workers aren't held up.
+ */
+static void *item_expiry_thread(void *arg) {
+    pthread_mutex_lock(&cache_lock);
+    while (do_run_expiry_thread) {
+        if (do_item_expire_batch()) {
+            struct timeval now;
+            struct timespec next;
+
+            gettimeofday(&now, NULL);
+            next.tv_sec = now.tv_sec + 1;
+            next.tv_nsec = now.tv_usec * 1000;
+            pthread_cond_timedwait(&expiry_cond, &cache_lock, &next);
+        } else {
+            pthread_mutex_unlock(&cache_lock);
+            pthread_mutex_lock(&cache_lock);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return NULL;
+}
+
+int start_item_expiry_thread(void) {
+    int ret;
+
+    ttl_buckets = slabs_alloc_static(sizeof(ttl_slot) * LARGEST_ID *
+                                     TTL_BUCKETS);
+    ttl_wheel = slabs_alloc_static(sizeof(ttl_slot) * TTL_WHEEL_LEVELS *
+                                   TTL_WHEEL_SLOTS);
+    if (ttl_buckets == NULL || ttl_wheel == NULL) {
+        fprintf(stderr, "Can't allocate the expiry index\n");
+        return -1;
+    }
+    if ((ret = pthread_create(&expiry_tid, NULL,
+                              item_expiry_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void stop_item_expiry_thread(void) {
+    pthread_mutex_lock(&cache_lock);
+    do_run_expiry_thread = 0;
+    pthread_cond_signal(&expiry_cond);
+    pthread_mutex_unlock(&cache_lock);
+
+    pthread_join(expiry_tid, NULL);
+}
+
+/*
+ * The LRU crawler walks each LRU from the tail up with a placeholder item,
+ * so it can let go of the cache lock between steps without losing its
+ * place, and unlinks items that expired or were invalidated by flush_all.
+ * The placeholder is a bare item header (no key or data) so the list code
+ * can treat it as one; it carries ITEM_CRAWLER and a refcount so nothing
+ * else tries to evict or dump it. Its time is the age of the tail it
+ * started from, and slabs_clsid the LRU it crawls.
+ */
+static item *crawlers = NULL;  /* one per LRU, from slabs_alloc_static */
+static int crawler_count = 0;
+static volatile int do_run_lru_crawler_thread = 0;
+static pthread_mutex_t lru_crawler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lru_crawler_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t item_crawler_tid;
+
+/* Puts a crawler in at the tail of its LRU. */
+static void crawler_link_q(item *it) {
+    item **tail = &tails[it->slabs_clsid];
+
+    assert(*tail != 0);
+    it->time = (*tail)->time;
+    it->prev = ITEM_REF(*tail);
+    it->next = 0;
+    (*tail)->next = ITEM_REF(it);
+    *tail = it;
+    assert(heads[it->slabs_clsid] != it);
+}
+
+/* Takes a crawler out of its LRU; unlike item_unlink_q, sizes stay put. */
+static void crawler_unlink_q(item *it) {
+    item **head = &heads[it->slabs_clsid];
+    item **tail = &tails[it->slabs_clsid];
+
+    if (*head == it) {
+        assert(it->prev == 0);
+        *head = ITEM_next(it);
+    }
+    if (*tail == it) {
+        assert(it->next == 0);
+        *tail = ITEM_prev(it);
+    }
+    if (it->next) ITEM_next(it)->prev = it->prev;
+    if (it->prev) ITEM_prev(it)->next = it->next;
+    it->next = it->prev = 0;
+}
+
+/*
+ * Moves a crawler one step towards the head of its LRU. Returns the item
+ * it stepped over, or NULL once it has reached the head.
+ */
+static item *crawler_crawl_q(item *it) {
+    item *search = ITEM_prev(it);
+
+    if (search == NULL)
+        return NULL;
+
+    crawler_unlink_q(it);
+    it->next = ITEM_REF(search);
+    it->prev = search->prev;
+    if (search->prev) {
+        ITEM_prev(search)->next = ITEM_REF(it);
+    } else {
+        heads[it->slabs_clsid] = it;
+    }
+    search->prev = ITEM_REF(it);
+    if (it->next == 0)
+        tails[it->slabs_clsid] = it;
+    return search;
+}
+
+/* Unlinks an item if it's expired or older than the last flush_all. */
+static void item_crawler_evaluate(item *search, const unsigned int id) {
+    if ((ITEM_exptime(search) != 0 && ITEM_exptime(search) <= current_time) ||
+        item_is_flushed(search)) {
+        itemstats[id].crawler_reclaimed++;
+        do_item_unlink(search);
+    }
+}
+
+static void *item_crawler_thread(void *arg) {
     int i;
-    item *iter, *next;
-    if (settings.oldest_live == 0)
-        return;
-    for (i = 0; i < LARGEST_ID; i++) {
-        /* The LRU is sorted in decreasing time order, and an item's timestamp
-         * is never newer than its last access time, so we only need to walk
-         * back until we hit an item older than the oldest_live time.
-         * The oldest_live checking will auto-expire the remaining items.
-         */
-        for (iter = heads[i]; iter != NULL; iter = next) {
-            if (iter->time >= settings.oldest_live) {
-                next = iter->next;
-                if ((iter->it_flags & ITEM_SLABBED) == 0) {
-                    do_item_unlink(iter);
+
+    pthread_mutex_lock(&lru_crawler_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Starting LRU crawler background thread\n");
+    while (do_run_lru_crawler_thread) {
+        /* A crawl may have been queued before we started waiting */
+        while (crawler_count == 0 && do_run_lru_crawler_thread)
+            pthread_cond_wait(&lru_crawler_cond, &lru_crawler_lock);
+
+        while (crawler_count && do_run_lru_crawler_thread) {
+            for (i = 0; i < LARGEST_ID && do_run_lru_crawler_thread; i++) {
+                int batch = settings.lru_crawler_batch;
+                item *search;
+
+                if (crawlers[i].it_flags != ITEM_CRAWLER)
+                    continue;
+
+                /* Hold the cache lock for a bounded number of steps only */
+                pthread_mutex_lock(&cache_lock);
+                while (batch-- > 0) {
+                    search = crawler_crawl_q(&crawlers[i]);
+                    if (search == NULL) {
+                        crawler_unlink_q(&crawlers[i]);
+                        crawlers[i].it_flags = 0;
+                        crawler_count--;
+                        if (settings.verbose > 2)
+                            fprintf(stderr, "Nothing left to crawl for %d\n", i);
+                        break;
+                    }
+                    item_crawler_evaluate(search, i);
                 }
-            } else {
-                /* We've hit the first old item. Continue to the next queue. */
-                break;
+                pthread_mutex_unlock(&cache_lock);
+
+                /* Lets "lru_crawler disable" in between batches */
+                pthread_mutex_unlock(&lru_crawler_lock);
+                if (settings.lru_crawler_sleep)
+                    usleep(settings.lru_crawler_sleep);
+                pthread_mutex_lock(&lru_crawler_lock);
+            }
+        }
+        if (settings.verbose > 2 && do_run_lru_crawler_thread)
+            fprintf(stderr, "LRU crawler thread sleeping\n");
+    }
+
+    /* Stopped halfway through a crawl: take the placeholders back out */
+    pthread_mutex_lock(&cache_lock);
+    for (i = 0; i < LARGEST_ID; i++) {
+        if (crawlers[i].it_flags == ITEM_CRAWLER) {
+            crawler_unlink_q(&crawlers[i]);
+            crawlers[i].it_flags = 0;
+        }
+    }
+    crawler_count = 0;
+    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&lru_crawler_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "LRU crawler thread stopping\n");
+
+    return NULL;
+}
+
+int start_item_crawler_thread(void) {
+    int ret;
+
+    if (settings.lru_crawler)
+        return -1;
+    pthread_mutex_lock(&lru_crawler_lock);
+    if (crawlers == NULL &&
+        (crawlers = slabs_alloc_static(sizeof(item) * LARGEST_ID)) == NULL) {
+        fprintf(stderr, "Can't allocate LRU crawler placeholders\n");
+        pthread_mutex_unlock(&lru_crawler_lock);
+        return -1;
+    }
+    do_run_lru_crawler_thread = 1;
+    settings.lru_crawler = true;
+    if ((ret = pthread_create(&item_crawler_tid, NULL,
+        item_crawler_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create LRU crawler thread: %s\n",
+            strerror(ret));
+        settings.lru_crawler = false;
+        pthread_mutex_unlock(&lru_crawler_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&lru_crawler_lock);
+
+    return 0;
+}
+
+int stop_item_crawler_thread(void) {
+    int ret;
+
+    if (!settings.lru_crawler)
+        return 0;
+    pthread_mutex_lock(&lru_crawler_lock);
+    do_run_lru_crawler_thread = 0;
+    pthread_cond_signal(&lru_crawler_cond);
+    pthread_mutex_unlock(&lru_crawler_lock);
+    if ((ret = pthread_join(item_crawler_tid, NULL)) != 0) {
+        fprintf(stderr, "Failed to stop LRU crawler thread: %s\n",
+            strerror(ret));
+        return -1;
+    }
+    settings.lru_crawler = false;
+    return 0;
+}
+
+/*
+ * Queues up crawls of the given classes: "all" or a comma separated list of
+ * class ids. Fails with CRAWLER_RUNNING instead of blocking the caller while
+ * a previous crawl is still going.
+ */
+enum crawler_result_type lru_crawler_crawl(char *slabs) {
+    char *b = NULL;
+    char *p;
+    uint32_t sid = 0;
+    int starts = 0;
+    uint8_t tocrawl[LARGEST_ID];
+
+    if (!settings.lru_crawler)
+        return CRAWLER_NOTSTARTED;
+    if (pthread_mutex_trylock(&lru_crawler_lock) != 0) {
+        return CRAWLER_RUNNING;
+    }
+    /* The crawler lets go of the lock between batches */
+    if (crawler_count != 0) {
+        pthread_mutex_unlock(&lru_crawler_lock);
+        return CRAWLER_RUNNING;
+    }
+
+    memset(tocrawl, 0, sizeof(tocrawl));
+    if (strcmp(slabs, "all") == 0) {
+        for (sid = 0; sid < LARGEST_ID; sid++) {
+            tocrawl[sid] = 1;
+        }
+    } else {
+        for (p = strtok_r(slabs, ",", &b);
+             p != NULL;
+             p = strtok_r(NULL, ",", &b)) {
+
+            if (!safe_strtoul(p, &sid) || sid < POWER_SMALLEST
+                    || sid >= LARGEST_ID) {
+                pthread_mutex_unlock(&lru_crawler_lock);
+                return CRAWLER_BADCLASS;
             }
+            tocrawl[sid] = 1;
+        }
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (sid = 0; sid < LARGEST_ID; sid++) {
+        if (tocrawl[sid] && tails[sid] != NULL &&
+            crawlers[sid].it_flags != ITEM_CRAWLER) {
+            memset(&crawlers[sid], 0, sizeof(item));
+            crawlers[sid].it_flags = ITEM_CRAWLER;
+            crawlers[sid].refcount = 1;
+            crawlers[sid].slabs_clsid = sid;
+            crawler_link_q(&crawlers[sid]);
+            crawler_count++;
+            starts++;
         }
     }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (starts) {
+        pthread_cond_signal(&lru_crawler_cond);
+    }
+    pthread_mutex_unlock(&lru_crawler_lock);
+    return CRAWLER_OK;
 }
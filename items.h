@@ -2,13 +2,25 @@
 uint64_t get_cas_id(void);
 
 /*@null@*/
-item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes);
+item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes, const uint32_t hv);
 void item_free(item *it);
 bool item_size_ok(const size_t nkey, const int flags, const int nbytes);
+unsigned int item_slabs_clsid(const size_t nkey, const int flags,
+                              const rel_time_t exptime, const int nbytes);
+int item_raw_nbytes(item *it);
+#ifdef ENABLE_LZ4
+bool item_decompress(item *it, char *buf);
+#endif
+char *item_data_at(item *it, const int offset, int *len);
+char *item_data_next(item *it, char *ptr, int *len);
+void item_data_read(item *it, int offset, char *buf, int len);
+void item_data_write(item *it, int offset, const char *buf, int len);
+void item_data_copy(item *dst, int doffset, item *src, int soffset, int len);
 
 int  do_item_link(item *it);     /** may fail if transgresses limits */
 void do_item_unlink(item *it);
 void do_item_remove(item *it);
+void do_item_relocate(item *it, item *new_it);
 void do_item_update(item *it);   /** update LRU time to current and reposition */
 int  do_item_replace(item *it, item *new_it);
 
@@ -17,9 +29,24 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
 void do_item_stats(ADD_STAT add_stats, void *c);
 /*@null@*/
 void do_item_stats_sizes(ADD_STAT add_stats, void *c);
-void do_item_flush_expired(void);
+void do_item_stats_automove(unsigned int *evicted, unsigned int *ghost_hits,
+                            rel_time_t *age, double *priority);
+void do_item_flush_expired(const rel_time_t when);
 
-item *do_item_get(const char *key, const size_t nkey);
-item *do_item_get_nocheck(const char *key, const size_t nkey);
+item *do_item_get(const char *key, const size_t nkey, const uint32_t hv);
+item *do_item_get_nocheck(const char *key, const size_t nkey, const uint32_t hv);
+void do_item_get_many(const char **keys, const size_t *nkeys,
+                      const uint32_t *hvs, item **its, const int n);
 void item_stats_reset(void);
+
+int start_item_expiry_thread(void);
+void stop_item_expiry_thread(void);
+
+enum crawler_result_type {
+    CRAWLER_OK=0, CRAWLER_RUNNING, CRAWLER_BADCLASS, CRAWLER_NOTSTARTED
+};
+
+int start_item_crawler_thread(void);
+int stop_item_crawler_thread(void);
+enum crawler_result_type lru_crawler_crawl(char *slabs);
 extern pthread_mutex_t cache_lock;
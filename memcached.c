@@ -46,6 +46,9 @@
 #include <limits.h>
 #include <sysexits.h>
 #include <stddef.h>
+#ifdef ENABLE_LZ4
+#include <lz4.h>
+#endif
 
 /* FreeBSD 4.x doesn't have IOV_MAX exposed. */
 #ifndef IOV_MAX
@@ -77,6 +80,7 @@ static void conn_set_state(conn *c, enum conn_states state);
 static void stats_init(void);
 static void server_stats(ADD_STAT add_stats, conn *c);
 static void process_stat_settings(ADD_STAT add_stats, void *c);
+static void process_stat_memory(ADD_STAT add_stats, void *c);
 
 
 /* defaults */
@@ -92,6 +96,7 @@ static void process_command(conn *c, char *command);
 static void write_and_free(conn *c, char *buf, int bytes);
 static int ensure_iov_space(conn *c);
 static int add_iov(conn *c, const void *buf, int len);
+static int add_item_data_iov(conn *c, item *it, int len);
 static int add_msghdr(conn *c);
 
 
@@ -149,7 +154,9 @@ static rel_time_t realtime(const time_t exptime) {
 
 static void stats_init(void) {
     stats.curr_items = stats.total_items = stats.curr_conns = stats.total_conns = stats.conn_structs = 0;
+    stats.conn_bytes = 0;
     stats.get_cmds = stats.set_cmds = stats.get_hits = stats.get_misses = stats.evictions = stats.reclaimed = 0;
+    stats.expired = 0;
     stats.curr_bytes = stats.listen_disabled_num = 0;
     stats.accepting_conns = true; /* assuming we start in this state. */
 
@@ -166,6 +173,7 @@ static void stats_reset(void) {
     stats.total_items = stats.total_conns = 0;
     stats.evictions = 0;
     stats.reclaimed = 0;
+    stats.expired = 0;
     stats.listen_disabled_num = 0;
     stats_prefix_clear();
     STATS_UNLOCK();
@@ -184,6 +192,8 @@ static void settings_init(void) {
     settings.maxconns = 1024;         /* to limit connections-related memory to about 5MB */
     settings.verbose = 0;
     settings.oldest_live = 0;
+    settings.flush_gen = 0;
+    settings.flush_gen_live = false;
     settings.evict_to_free = 1;       /* push old items out of cache when memory runs out */
     settings.socketpath = NULL;       /* by default, not using a unix socket */
     settings.factor = 1.25;
@@ -195,6 +205,30 @@ static void settings_init(void) {
     settings.backlog = 1024;
     settings.binding_protocol = negotiating_prot;
     settings.item_size_max = 1024 * 1024; /* The famous 1MB upper limit. */
+    settings.gdsf = false;
+    settings.ttl_evict_window = 60;
+    settings.lru_crawler = false;
+    settings.lru_crawler_sleep = 100;
+    settings.lru_crawler_batch = 100;
+    settings.slab_page_size = 1024 * 1024;
+    settings.slab_chunk_size_max = settings.slab_page_size / 2;
+    settings.slab_automove = false;
+    settings.slab_automove_window = 10;
+    settings.hash_table = HASH_TABLE_CHAINED;
+    settings.hash_algorithm = JENKINS_HASH;
+    settings.large_pages = false;
+    settings.hash_large_pages = false;
+    settings.slab_pages = LARGE_PAGES_OFF;
+    settings.hash_pages = LARGE_PAGES_OFF;
+    settings.prefault_threads = 0;
+    settings.slab_release = false;
+    settings.slab_release_floor = 0;
+    settings.total_memory = false;
+    settings.slab_autotune = false;
+    settings.slab_autotune_window = 60;
+    settings.slab_sizes = NULL;
+    settings.allocator = ALLOCATOR_SLAB;
+    settings.compress_min = 0;
 }
 
 /*
@@ -202,6 +236,27 @@ static void settings_init(void) {
  *
  * Returns 0 on success, -1 on out-of-memory.
  */
+/*
+ * Brings what the connection counts for in stats.conn_bytes up to date
+ * with the size of its buffers. Called whenever one of them is allocated
+ * or resized.
+ */
+static void conn_mem_update(conn *c) {
+    size_t bytes = sizeof(conn) + c->rsize + c->wsize +
+        c->isize * sizeof(item *) + c->suffixsize * sizeof(char *) +
+        c->unpacksize * sizeof(char *) +
+        c->iovsize * sizeof(struct iovec) +
+        c->msgsize * sizeof(struct msghdr) + c->hdrsize * UDP_HEADER_SIZE;
+
+    if (bytes != c->mem_bytes) {
+        STATS_LOCK();
+        stats.conn_bytes += bytes;
+        stats.conn_bytes -= c->mem_bytes;
+        STATS_UNLOCK();
+        c->mem_bytes = bytes;
+    }
+}
+
 static int add_msghdr(conn *c)
 {
     struct msghdr *msg;
@@ -214,6 +269,7 @@ static int add_msghdr(conn *c)
             return -1;
         c->msglist = msg;
         c->msgsize *= 2;
+        conn_mem_update(c);
     }
 
     msg = c->msglist + c->msgused;
@@ -363,6 +419,7 @@ conn *conn_new(const int sfd, enum conn_states init_state,
         STATS_LOCK();
         stats.conn_structs++;
         STATS_UNLOCK();
+        conn_mem_update(c);
     }
 
     c->transport = transport;
@@ -441,6 +498,13 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     return c;
 }
 
+/* Frees the values decompressed for a response, once it's sent or dropped. */
+static void conn_release_unpacked(conn *c) {
+    while (c->unpackused > 0) {
+        free(c->unpacklist[--c->unpackused]);
+    }
+}
+
 static void conn_cleanup(conn *c) {
     assert(c != NULL);
 
@@ -461,6 +525,8 @@ static void conn_cleanup(conn *c) {
         }
     }
 
+    conn_release_unpacked(c);
+
     if (c->write_and_free) {
         free(c->write_and_free);
         c->write_and_free = 0;
@@ -491,8 +557,15 @@ void conn_free(conn *c) {
             free(c->ilist);
         if (c->suffixlist)
             free(c->suffixlist);
+        if (c->unpacklist)
+            free(c->unpacklist);
         if (c->iov)
             free(c->iov);
+        if (c->mem_bytes) {
+            STATS_LOCK();
+            stats.conn_bytes -= c->mem_bytes;
+            STATS_UNLOCK();
+        }
         free(c);
     }
 }
@@ -579,6 +652,8 @@ static void conn_shrink(conn *c) {
         }
     /* TODO check return value */
     }
+
+    conn_mem_update(c);
 }
 
 /**
@@ -639,6 +714,7 @@ static int ensure_iov_space(conn *c) {
             return -1;
         c->iov = new_iov;
         c->iovsize *= 2;
+        conn_mem_update(c);
 
         /* Point all the msghdr structures at the new list. */
         for (i = 0, iovnum = 0; i < c->msgused; i++) {
@@ -707,6 +783,77 @@ static int add_iov(conn *c, const void *buf, int len) {
     return 0;
 }
 
+#ifdef ENABLE_LZ4
+static uint64_t usec_now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Decompresses the value of an ITEM_LZ4 item into a buffer kept until the
+ * response has been sent, and adds its first len bytes to the response.
+ */
+static int add_unpacked_iov(conn *c, item *it, int len) {
+    uint64_t start;
+    char *buf;
+
+    if (c->unpackused == c->unpacksize) {
+        int size = c->unpacksize == 0 ? UNPACK_LIST_INITIAL
+                                      : c->unpacksize * 2;
+        char **new_list = realloc(c->unpacklist, sizeof(char *) * size);
+        if (new_list == NULL)
+            return -1;
+        c->unpacklist = new_list;
+        c->unpacksize = size;
+        conn_mem_update(c);
+    }
+
+    if ((buf = malloc(item_raw_nbytes(it))) == NULL)
+        return -1;
+    start = usec_now();
+    if (!item_decompress(it, buf)) {
+        free(buf);
+        return -1;
+    }
+    pthread_mutex_lock(&c->thread->stats.mutex);
+    c->thread->stats.slab_stats[it->slabs_clsid].decompress_count++;
+    c->thread->stats.slab_stats[it->slabs_clsid].decompress_usec +=
+        usec_now() - start;
+    pthread_mutex_unlock(&c->thread->stats.mutex);
+
+    c->unpacklist[c->unpackused++] = buf;
+    return add_iov(c, buf, len);
+}
+#endif
+
+/*
+ * Adds the first len bytes of an item's value, one iovec per piece if it
+ * is chunked. Compressed values are decompressed first.
+ *
+ * Returns 0 on success, -1 on out-of-memory.
+ */
+static int add_item_data_iov(conn *c, item *it, int len) {
+    int offset = 0;
+
+#ifdef ENABLE_LZ4
+    if (it->encoding == ITEM_LZ4)
+        return add_unpacked_iov(c, it, len);
+#endif
+
+    while (offset < len) {
+        int n;
+        char *ptr = item_data_at(it, offset, &n);
+        if (n > len - offset)
+            n = len - offset;
+        if (add_iov(c, ptr, n) != 0)
+            return -1;
+        offset += n;
+    }
+    return 0;
+}
+
 
 /*
  * Constructs a set of UDP headers and attaches them to the outgoing messages.
@@ -727,6 +874,7 @@ static int build_udp_headers(conn *c) {
             return -1;
         c->hdrbuf = (unsigned char *)new_hdrbuf;
         c->hdrsize = c->msgused * 2;
+        conn_mem_update(c);
     }
 
     hdr = c->hdrbuf;
@@ -781,6 +929,101 @@ static void out_string(conn *c, const char *str) {
     return;
 }
 
+#ifdef ENABLE_LZ4
+/*
+ * True if a value of len bytes (without the \r\n) is only digits, with at
+ * most 20 of them after any leading zeros: a number incr and decr could
+ * take.
+ */
+static bool value_is_number(const char *data, const int len) {
+    int i, digits = 0;
+
+    for (i = 0; i < len; i++) {
+        if (!isdigit((unsigned char)data[i]))
+            return false;
+        if (digits > 0 || data[i] != '0')
+            digits++;
+    }
+    return len > 0 && digits <= 20;
+}
+
+/*
+ * With -o compress, replaces the value just read into c->item by an LZ4
+ * compressed copy if the copy goes in a smaller slab class (see
+ * item_raw_nbytes() for its layout). Appends and prepends are left alone,
+ * they're merged with the old value under the cache lock, and so are
+ * numbers, so incr and decr never see a compressed value.
+ */
+static void compress_item(conn *c) {
+    item *it = c->item, *new_it = NULL;
+    LIBEVENT_THREAD *t = c->thread;
+    const int len = it->nbytes - 2;
+    const bool chunked = (it->it_flags & ITEM_CHUNKED) != 0;
+    const uint32_t raw = it->nbytes;
+    unsigned int id, new_id = 0;
+    uint64_t start, usec;
+    const char *src;
+    int bound, clen;
+
+    if (len < settings.compress_min ||
+        c->cmd == NREAD_APPEND || c->cmd == NREAD_PREPEND)
+        return;
+    if (!chunked && value_is_number(ITEM_data(it), len))
+        return;
+
+    /* Chunked values are gathered in the scratch space after the output */
+    bound = LZ4_compressBound(len);
+    if (t->lz4_size < bound + (chunked ? len : 0)) {
+        char *buf = realloc(t->lz4_buf, bound + (chunked ? len : 0));
+        if (buf == NULL)
+            return;
+        t->lz4_buf = buf;
+        t->lz4_size = bound + (chunked ? len : 0);
+    }
+    if (chunked) {
+        item_data_read(it, 0, t->lz4_buf + bound, len);
+        src = t->lz4_buf + bound;
+    } else {
+        src = ITEM_data(it);
+    }
+
+    start = usec_now();
+    clen = LZ4_compress_default(src, t->lz4_buf, len, bound);
+    usec = usec_now() - start;
+
+    id = item_slabs_clsid(it->nkey, ITEM_get_flags(it), ITEM_exptime(it),
+                          it->nbytes);
+    if (clen > 0) {
+        new_id = item_slabs_clsid(it->nkey, ITEM_get_flags(it), ITEM_exptime(it),
+                                  sizeof(raw) + clen + 2);
+    }
+    if (new_id != 0 && new_id < id) {
+        new_it = item_alloc(ITEM_key(it), it->nkey, ITEM_get_flags(it),
+                            ITEM_exptime(it), sizeof(raw) + clen + 2);
+    }
+    if (new_it != NULL) {
+        memcpy(ITEM_data(new_it), &raw, sizeof(raw));
+        memcpy(ITEM_data(new_it) + sizeof(raw), t->lz4_buf, clen);
+        memcpy(ITEM_data(new_it) + sizeof(raw) + clen, "\r\n", 2);
+        new_it->encoding = ITEM_LZ4;
+        ITEM_set_cas(new_it, ITEM_get_cas(it));
+        ITEM_set_cost(new_it, ITEM_get_cost(it));
+        item_remove(it);
+        c->item = new_it;
+    }
+
+    pthread_mutex_lock(&t->stats.mutex);
+    t->stats.slab_stats[id].compress_tries++;
+    t->stats.slab_stats[id].compress_usec += usec;
+    if (new_it != NULL) {
+        t->stats.slab_stats[id].compress_kept++;
+        t->stats.slab_stats[id].compress_bytes_in += len;
+        t->stats.slab_stats[id].compress_bytes_out += sizeof(raw) + clen;
+    }
+    pthread_mutex_unlock(&t->stats.mutex);
+}
+#endif
+
 /*
  * we get here after reading the value in set/add/replace commands. The command
  * has been stored in c->cmd, and the item is ready in c->item.
@@ -796,9 +1039,18 @@ static void complete_nread_ascii(conn *c) {
     c->thread->stats.slab_stats[it->slabs_clsid].set_cmds++;
     pthread_mutex_unlock(&c->thread->stats.mutex);
 
-    if (strncmp(ITEM_data(it) + it->nbytes - 2, "\r\n", 2) != 0) {
+    char crlf[2];
+    item_data_read(it, it->nbytes - 2, crlf, 2);
+
+    if (strncmp(crlf, "\r\n", 2) != 0) {
         out_string(c, "CLIENT_ERROR bad data chunk");
     } else {
+#ifdef ENABLE_LZ4
+      if (settings.compress_min > 0) {
+          compress_item(c);
+          it = c->item;
+      }
+#endif
       ret = store_item(it, comm, c);
 
 #ifdef ENABLE_DTRACE
@@ -1098,9 +1350,14 @@ static void complete_update_bin(conn *c) {
 
     /* We don't actually receive the trailing two characters in the bin
      * protocol, so we're going to just set them here */
-    *(ITEM_data(it) + it->nbytes - 2) = '\r';
-    *(ITEM_data(it) + it->nbytes - 1) = '\n';
+    item_data_write(it, it->nbytes - 2, "\r\n", 2);
 
+#ifdef ENABLE_LZ4
+    if (settings.compress_min > 0) {
+        compress_item(c);
+        it = c->item;
+    }
+#endif
     ret = store_item(it, c->cmd, c);
 
 #ifdef ENABLE_DTRACE
@@ -1175,13 +1432,18 @@ static void process_bin_get(conn *c) {
     if (it) {
         /* the length has two unnecessary bytes ("\r\n") */
         uint16_t keylen = 0;
-        uint32_t bodylen = sizeof(rsp->message.body) + (it->nbytes - 2);
+        const int nbytes = item_raw_nbytes(it);
+        uint32_t bodylen = sizeof(rsp->message.body) + (nbytes - 2);
 
         pthread_mutex_lock(&c->thread->stats.mutex);
         c->thread->stats.get_cmds++;
         c->thread->stats.slab_stats[it->slabs_clsid].get_hits++;
+        c->thread->stats.get_hit_bytes += nbytes - 2;
+        c->thread->stats.get_hit_cost += ITEM_get_cost(it);
         pthread_mutex_unlock(&c->thread->stats.mutex);
 
+        item_update(it);
+
         MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
                               it->nbytes, ITEM_get_cas(it));
 
@@ -1193,7 +1455,7 @@ static void process_bin_get(conn *c) {
         rsp->message.header.response.cas = htonll(ITEM_get_cas(it));
 
         // add the flags
-        rsp->message.body.flags = htonl(strtoul(ITEM_suffix(it), NULL, 10));
+        rsp->message.body.flags = htonl(ITEM_get_flags(it));
         add_iov(c, &rsp->message.body, sizeof(rsp->message.body));
 
         if (c->cmd == PROTOCOL_BINARY_CMD_GETK) {
@@ -1201,7 +1463,7 @@ static void process_bin_get(conn *c) {
         }
 
         /* Add the data minus the CRLF */
-        add_iov(c, ITEM_data(it), it->nbytes - 2);
+        add_item_data_iov(c, it, nbytes - 2);
         conn_set_state(c, conn_mwrite);
         /* Remember this command so we can garbage collect it later */
         c->item = it;
@@ -1361,6 +1623,8 @@ static void process_bin_stat(conn *c) {
         stats_reset();
     } else if (strncmp(subcommand, "settings", 8) == 0) {
         process_stat_settings(&append_stats, c);
+    } else if (strncmp(subcommand, "memory", 6) == 0) {
+        process_stat_memory(&append_stats, c);
     } else if (strncmp(subcommand, "detail", 6) == 0) {
         char *subcmd_pos = subcommand + 6;
         if (strncmp(subcmd_pos, " dump", 5) == 0) {
@@ -1440,6 +1704,7 @@ static void bin_read_key(conn *c, enum bin_substates next_substate, int extra) {
             /* rcurr should point to the same offset in the packet */
             c->rcurr = c->rbuf + offset - sizeof(protocol_binary_request_header);
             c->rsize = nsize;
+            conn_mem_update(c);
         }
         if (c->rbuf != c->rcurr) {
             memmove(c->rbuf, c->rcurr, c->rbytes);
@@ -1544,6 +1809,14 @@ static void process_bin_sasl_auth(conn *c) {
         return;
     }
 
+    /* The SASL library wants the data in one piece */
+    if (it->it_flags & ITEM_CHUNKED) {
+        item_remove(it);
+        write_bin_error(c, PROTOCOL_BINARY_RESPONSE_EINVAL, vlen);
+        c->write_and_go = conn_swallow;
+        return;
+    }
+
     c->item = it;
     c->ritem = ITEM_data(it);
     c->rlbytes = vlen;
@@ -1742,8 +2015,10 @@ static void dispatch_bin_command(conn *c) {
         case PROTOCOL_BINARY_CMD_SET: /* FALLTHROUGH */
         case PROTOCOL_BINARY_CMD_ADD: /* FALLTHROUGH */
         case PROTOCOL_BINARY_CMD_REPLACE:
-            if (extlen == 8 && keylen != 0 && bodylen >= (keylen + 8)) {
-                bin_read_key(c, bin_reading_set_header, 8);
+            /* 12 bytes of extras carry a trailing 32-bit cost hint */
+            if ((extlen == 8 || extlen == 12) && keylen != 0 &&
+                bodylen >= (keylen + extlen)) {
+                bin_read_key(c, bin_reading_set_header, extlen);
             } else {
                 protocol_error = 1;
             }
@@ -1888,6 +2163,12 @@ static void process_bin_update(conn *c) {
 
     ITEM_set_cas(it, c->binary_header.request.cas);
 
+    if (c->binary_header.request.extlen == 12) {
+        uint32_t cost;
+        memcpy(&cost, req->bytes + sizeof(req->bytes), sizeof(cost));
+        ITEM_set_cost(it, ntohl(cost));
+    }
+
     switch (c->cmd) {
         case PROTOCOL_BINARY_CMD_ADD:
             c->cmd = NREAD_ADD;
@@ -1977,11 +2258,10 @@ static void process_bin_flush(conn *c) {
     set_current_time();
 
     if (exptime > 0) {
-        settings.oldest_live = realtime(exptime) - 1;
+        item_flush_expired(realtime(exptime));
     } else {
-        settings.oldest_live = current_time - 1;
+        item_flush_expired(current_time);
     }
-    item_flush_expired();
 
     pthread_mutex_lock(&c->thread->stats.mutex);
     c->thread->stats.flush_cmds++;
@@ -2102,7 +2382,7 @@ static void complete_nread(conn *c) {
  */
 enum store_item_type do_store_item(item *it, int comm, conn *c) {
     char *key = ITEM_key(it);
-    item *old_it = do_item_get(key, it->nkey);
+    item *old_it = do_item_get(key, it->nkey, it->hv);
     enum store_item_type stored = NOT_STORED;
 
     item *new_it = NULL;
@@ -2132,8 +2412,8 @@ enum store_item_type do_store_item(item *it, int comm, conn *c) {
             c->thread->stats.slab_stats[old_it->slabs_clsid].cas_hits++;
             pthread_mutex_unlock(&c->thread->stats.mutex);
 
-            item_replace(old_it, it);
-            stored = STORED;
+            if (item_replace(old_it, it))
+                stored = STORED;
         } else {
             pthread_mutex_lock(&c->thread->stats.mutex);
             c->thread->stats.slab_stats[old_it->slabs_clsid].cas_badval++;
@@ -2163,45 +2443,70 @@ enum store_item_type do_store_item(item *it, int comm, conn *c) {
             }
 
             if (stored == NOT_STORED) {
-                /* we have it and old_it here - alloc memory to hold both */
-                /* flags was already lost - so recover them from ITEM_suffix(it) */
+                const int old_nbytes = item_raw_nbytes(old_it);
+                char *old_value = NULL;
+
+#ifdef ENABLE_LZ4
+                /* A compressed value is merged as the client stored it */
+                if (old_it->encoding == ITEM_LZ4 &&
+                    ((old_value = malloc(old_nbytes)) == NULL ||
+                     !item_decompress(old_it, old_value))) {
+                    free(old_value);
+                    do_item_remove(old_it);
+                    return NOT_STORED;
+                }
+#endif
 
-                flags = (int) strtol(ITEM_suffix(old_it), (char **) NULL, 10);
+                /* we have it and old_it here - alloc memory to hold both */
+                /* the new data comes without flags, so keep the old ones */
+                flags = (int) ITEM_get_flags(old_it);
 
-                new_it = do_item_alloc(key, it->nkey, flags, old_it->exptime, it->nbytes + old_it->nbytes - 2 /* CRLF */);
+                new_it = do_item_alloc(key, it->nkey, flags, ITEM_exptime(old_it), it->nbytes + old_nbytes - 2 /* CRLF */, it->hv);
 
                 if (new_it == NULL) {
                     /* SERVER_ERROR out of memory */
+                    free(old_value);
                     if (old_it != NULL)
                         do_item_remove(old_it);
 
                     return NOT_STORED;
                 }
+                ITEM_set_cost(new_it, ITEM_get_cost(old_it));
 
                 /* copy data from it and old_it to new_it */
 
                 if (comm == NREAD_APPEND) {
-                    memcpy(ITEM_data(new_it), ITEM_data(old_it), old_it->nbytes);
-                    memcpy(ITEM_data(new_it) + old_it->nbytes - 2 /* CRLF */, ITEM_data(it), it->nbytes);
+                    if (old_value != NULL)
+                        item_data_write(new_it, 0, old_value, old_nbytes);
+                    else
+                        item_data_copy(new_it, 0, old_it, 0, old_nbytes);
+                    item_data_copy(new_it, old_nbytes - 2 /* CRLF */, it, 0, it->nbytes);
                 } else {
                     /* NREAD_PREPEND */
-                    memcpy(ITEM_data(new_it), ITEM_data(it), it->nbytes);
-                    memcpy(ITEM_data(new_it) + it->nbytes - 2 /* CRLF */, ITEM_data(old_it), old_it->nbytes);
+                    item_data_copy(new_it, 0, it, 0, it->nbytes);
+                    if (old_value != NULL)
+                        item_data_write(new_it, it->nbytes - 2 /* CRLF */, old_value, old_nbytes);
+                    else
+                        item_data_copy(new_it, it->nbytes - 2 /* CRLF */, old_it, 0, old_nbytes);
                 }
+                free(old_value);
 
                 it = new_it;
             }
         }
 
         if (stored == NOT_STORED) {
-            if (old_it != NULL)
-                item_replace(old_it, it);
-            else
-                do_item_link(it);
-
-            c->cas = ITEM_get_cas(it);
-
-            stored = STORED;
+            if (old_it != NULL) {
+                if (item_replace(old_it, it))
+                    stored = STORED;
+            } else if (do_item_link(it)) {
+                /* Storing a key we don't hold refills a miss. */
+                pthread_mutex_lock(&c->thread->stats.mutex);
+                c->thread->stats.get_miss_bytes += item_raw_nbytes(it) - 2;
+                c->thread->stats.get_miss_cost += ITEM_get_cost(it);
+                pthread_mutex_unlock(&c->thread->stats.mutex);
+                stored = STORED;
+            }
         }
     }
 
@@ -2226,7 +2531,7 @@ typedef struct token_s {
 #define SUBCOMMAND_TOKEN 1
 #define KEY_TOKEN 1
 
-#define MAX_TOKENS 8
+#define MAX_TOKENS 9
 
 /*
  * Tokenize the command string by replacing whitespace with '\0' and update
@@ -2353,6 +2658,12 @@ inline static void process_stats_detail(conn *c, const char *command) {
     }
 }
 
+static double hit_ratio(const uint64_t hits, const uint64_t misses) {
+    if (hits + misses == 0)
+        return 0.0;
+    return (double)hits / (double)(hits + misses);
+}
+
 /* return server specific stats only */
 static void server_stats(ADD_STAT add_stats, conn *c) {
     pid_t pid = getpid();
@@ -2404,6 +2715,14 @@ static void server_stats(ADD_STAT add_stats, conn *c) {
     APPEND_STAT("cas_badval", "%llu", (unsigned long long)slab_stats.cas_badval);
     APPEND_STAT("auth_cmds", "%llu", (unsigned long long)thread_stats.auth_cmds);
     APPEND_STAT("auth_errors", "%llu", (unsigned long long)thread_stats.auth_errors);
+    APPEND_STAT("get_hit_bytes", "%llu", (unsigned long long)thread_stats.get_hit_bytes);
+    APPEND_STAT("get_miss_bytes", "%llu", (unsigned long long)thread_stats.get_miss_bytes);
+    APPEND_STAT("get_hit_cost", "%llu", (unsigned long long)thread_stats.get_hit_cost);
+    APPEND_STAT("get_miss_cost", "%llu", (unsigned long long)thread_stats.get_miss_cost);
+    APPEND_STAT("byte_hit_ratio", "%.4f",
+                hit_ratio(thread_stats.get_hit_bytes, thread_stats.get_miss_bytes));
+    APPEND_STAT("cost_hit_ratio", "%.4f",
+                hit_ratio(thread_stats.get_hit_cost, thread_stats.get_miss_cost));
     APPEND_STAT("bytes_read", "%llu", (unsigned long long)thread_stats.bytes_read);
     APPEND_STAT("bytes_written", "%llu", (unsigned long long)thread_stats.bytes_written);
     APPEND_STAT("limit_maxbytes", "%llu", (unsigned long long)settings.maxbytes);
@@ -2414,6 +2733,76 @@ static void server_stats(ADD_STAT add_stats, conn *c) {
     STATS_UNLOCK();
 }
 
+/*
+ * Where the memory goes. -m only limits slab pages; everything else here is
+ * overhead on top of it, unless -o total_memory takes it out of -m.
+ */
+struct memory_usage {
+    size_t slab_pages;      /* pages handed to slab classes */
+    size_t slab_metadata;   /* the slab allocator's page and free lists */
+    size_t slab_limit;      /* what slab pages may currently take */
+    size_t hash_table;      /* both tables while it's growing */
+    size_t connections;     /* connections and their buffers */
+    size_t suffix_caches;   /* per thread "get" reply buffers */
+    size_t threads;         /* thread descriptors and queues */
+    size_t prefix_stats;    /* "stats detail" prefixes */
+    size_t total;
+};
+
+static void memory_usage_get(struct memory_usage *mu) {
+    slabs_memory(&mu->slab_pages, &mu->slab_metadata, &mu->slab_limit);
+    mu->hash_table = assoc_memory();
+    threads_memory(&mu->threads, &mu->suffix_caches);
+
+    STATS_LOCK();
+    mu->connections = stats.conn_bytes + freetotal * sizeof(conn *);
+    mu->prefix_stats = stats_prefix_memory();
+    STATS_UNLOCK();
+
+    mu->total = mu->slab_pages + mu->slab_metadata + mu->hash_table +
+        mu->connections + mu->suffix_caches + mu->threads + mu->prefix_stats;
+}
+
+static void process_stat_memory(ADD_STAT add_stats, void *c) {
+    struct memory_usage mu;
+
+    memory_usage_get(&mu);
+    APPEND_STAT("slab_pages", "%llu", (unsigned long long)mu.slab_pages);
+    APPEND_STAT("slab_metadata", "%llu", (unsigned long long)mu.slab_metadata);
+    APPEND_STAT("slab_limit", "%llu", (unsigned long long)mu.slab_limit);
+    APPEND_STAT("hash_table", "%llu", (unsigned long long)mu.hash_table);
+    APPEND_STAT("connections", "%llu", (unsigned long long)mu.connections);
+    APPEND_STAT("suffix_caches", "%llu", (unsigned long long)mu.suffix_caches);
+    APPEND_STAT("threads", "%llu", (unsigned long long)mu.threads);
+    APPEND_STAT("prefix_stats", "%llu", (unsigned long long)mu.prefix_stats);
+    APPEND_STAT("total", "%llu", (unsigned long long)mu.total);
+    APPEND_STAT("limit_maxbytes", "%llu", (unsigned long long)settings.maxbytes);
+}
+
+/*
+ * With -o total_memory, -m bounds everything "stats memory" counts, so
+ * whatever the rest takes comes off what slab pages may use, and the cache
+ * gives up pages (see slabs_adjust_mem_limit()) as connections and the hash
+ * table grow. Slab pages always get at least a quarter of -m. Called once
+ * a second, and after cache_memlimit.
+ */
+static void memory_budget_check(void) {
+    struct memory_usage mu;
+    size_t overhead, limit;
+
+    memory_usage_get(&mu);
+    overhead = mu.total - mu.slab_pages;
+    if (overhead < settings.maxbytes - settings.maxbytes / 4)
+        limit = settings.maxbytes - overhead;
+    else
+        limit = settings.maxbytes / 4;
+    /* Whole pages, so that small changes don't move it back and forth */
+    limit -= limit % settings.slab_page_size;
+
+    if (limit != mu.slab_limit)
+        slabs_adjust_mem_limit(limit);
+}
+
 static void process_stat_settings(ADD_STAT add_stats, void *c) {
     assert(add_stats);
     APPEND_STAT("maxbytes", "%u", (unsigned int)settings.maxbytes);
@@ -2440,6 +2829,41 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
                 prot_text(settings.binding_protocol));
     APPEND_STAT("auth_enabled_sasl", "%s", settings.sasl ? "yes" : "no");
     APPEND_STAT("item_size_max", "%d", settings.item_size_max);
+    APPEND_STAT("slab_page_size", "%d", settings.slab_page_size);
+    APPEND_STAT("slab_chunk_max", "%d", settings.slab_chunk_size_max);
+    APPEND_STAT("gdsf", "%s", settings.gdsf ? "yes" : "no");
+    APPEND_STAT("ttl_evict_window", "%d", settings.ttl_evict_window);
+    APPEND_STAT("lru_crawler", "%s", settings.lru_crawler ? "yes" : "no");
+    APPEND_STAT("lru_crawler_sleep", "%d", settings.lru_crawler_sleep);
+    APPEND_STAT("lru_crawler_batch", "%d", settings.lru_crawler_batch);
+    APPEND_STAT("slab_automove", "%s", settings.slab_automove ? "yes" : "no");
+    APPEND_STAT("slab_automove_window", "%d", settings.slab_automove_window);
+    APPEND_STAT("hash_table", "%s",
+                settings.hash_table == HASH_TABLE_OPEN ? "open" : "chained");
+    APPEND_STAT("hash_algorithm", "%s", hash_name(settings.hash_algorithm));
+    APPEND_STAT("large_pages", "%s", large_pages_name(settings.slab_pages));
+    APPEND_STAT("hash_large_pages", "%s", large_pages_name(settings.hash_pages));
+    APPEND_STAT("prefault", "%d", settings.prefault_threads);
+    APPEND_STAT("slab_release", "%s", settings.slab_release ? "yes" : "no");
+    APPEND_STAT("slab_release_floor", "%d", settings.slab_release_floor);
+    APPEND_STAT("total_memory", "%s", settings.total_memory ? "yes" : "no");
+    APPEND_STAT("slab_autotune", "%s", settings.slab_autotune ? "yes" : "no");
+    APPEND_STAT("slab_autotune_window", "%d", settings.slab_autotune_window);
+    {
+        /* Can be longer than APPEND_STAT() takes */
+        char sizes[MAX_NUMBER_OF_SLAB_CLASSES * 11] = "none";
+        int i, len = 0;
+
+        for (i = 0; settings.slab_sizes != NULL &&
+                 settings.slab_sizes[i] != 0; i++) {
+            len += sprintf(sizes + len, "%s%u", i ? "-" : "",
+                           settings.slab_sizes[i]);
+        }
+        add_stats("slab_sizes", strlen("slab_sizes"), sizes, strlen(sizes), c);
+    }
+    APPEND_STAT("allocator", "%s",
+                settings.allocator == ALLOCATOR_LOG ? "log" : "slab");
+    APPEND_STAT("compress_min", "%d", settings.compress_min);
 }
 
 static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
@@ -2468,6 +2892,8 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
         return ;
     } else if (strcmp(subcommand, "settings") == 0) {
         process_stat_settings(&append_stats, c);
+    } else if (strcmp(subcommand, "memory") == 0) {
+        process_stat_memory(&append_stats, c);
     } else if (strcmp(subcommand, "cachedump") == 0) {
         char *buf;
         unsigned int bytes, id, limit = 0;
@@ -2518,6 +2944,26 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
     }
 }
 
+/*
+ * Writes the end of an item's "VALUE" line, " <flags> <bytes>[ <cas>]\r\n",
+ * to suffix (SUFFIX_SIZE bytes) and returns its length.
+ */
+static int make_ascii_get_suffix(char *suffix, item *it, bool return_cas) {
+    char *p = suffix;
+
+    *p++ = ' ';
+    p = itoa_u32(ITEM_get_flags(it), p);
+    *p++ = ' ';
+    p = itoa_u32(item_raw_nbytes(it) - 2, p);
+    if (return_cas) {
+        *p++ = ' ';
+        p = itoa_u64(ITEM_get_cas(it), p);
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+    return p - suffix;
+}
+
 /* ntokens is overwritten here... shrug.. */
 static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens, bool return_cas) {
     char *key;
@@ -2525,21 +2971,33 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
     int i = 0;
     item *it;
     token_t *key_token = &tokens[KEY_TOKEN];
+    token_t batch_tokens[ITEM_GET_BATCH + 1];
+    const char *keys[ITEM_GET_BATCH];
+    size_t nkeys[ITEM_GET_BATCH];
+    item *its[ITEM_GET_BATCH];
+    int nbatch, j;
     char *suffix;
+    int suffix_len;
     assert(c != NULL);
 
     do {
-        while(key_token->length != 0) {
-
-            key = key_token->value;
-            nkey = key_token->length;
-
-            if(nkey > KEY_MAX_LENGTH) {
+        /* Look up every key of this stretch of the line together */
+        for (nbatch = 0; key_token[nbatch].length != 0; nbatch++) {
+            if (key_token[nbatch].length > KEY_MAX_LENGTH) {
                 out_string(c, "CLIENT_ERROR bad command line format");
                 return;
             }
+            keys[nbatch] = key_token[nbatch].value;
+            nkeys[nbatch] = key_token[nbatch].length;
+        }
+        item_get_many(keys, nkeys, its, nbatch);
+
+        for (j = 0; j < nbatch; j++, key_token++) {
+
+            key = key_token->value;
+            nkey = key_token->length;
+            it = its[j];
 
-            it = item_get(key, nkey);
             if (settings.detail_enabled) {
                 stats_prefix_record_get(key, nkey, NULL != it);
             }
@@ -2549,69 +3007,51 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                     if (new_list) {
                         c->isize *= 2;
                         c->ilist = new_list;
+                        conn_mem_update(c);
                     } else {
-                        item_remove(it);
                         break;
                     }
                 }
 
                 /*
-                 * Construct the response. Each hit adds three elements to the
+                 * Construct the response. Each hit adds four elements to the
                  * outgoing data list:
                  *   "VALUE "
                  *   key
-                 *   " " + flags + " " + data length + "\r\n" + data (with \r\n)
+                 *   " " + flags + " " + data length [+ " " + cas] + "\r\n"
+                 *   data (with \r\n)
+                 * Items don't carry the third one, so it's written into a
+                 * buffer from the thread's suffix cache.
                  */
-
-                if (return_cas)
-                {
-                  MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
-                                        it->nbytes, ITEM_get_cas(it));
-                  /* Goofy mid-flight realloc. */
-                  if (i >= c->suffixsize) {
+                MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
+                                      it->nbytes, ITEM_get_cas(it));
+                /* Goofy mid-flight realloc. */
+                if (i >= c->suffixsize) {
                     char **new_suffix_list = realloc(c->suffixlist,
                                            sizeof(char *) * c->suffixsize * 2);
                     if (new_suffix_list) {
                         c->suffixsize *= 2;
                         c->suffixlist  = new_suffix_list;
+                        conn_mem_update(c);
                     } else {
-                        item_remove(it);
                         break;
                     }
-                  }
-
-                  suffix = cache_alloc(c->thread->suffix_cache);
-                  if (suffix == NULL) {
-                    out_string(c, "SERVER_ERROR out of memory making CAS suffix");
-                    item_remove(it);
-                    return;
-                  }
-                  *(c->suffixlist + i) = suffix;
-                  int suffix_len = snprintf(suffix, SUFFIX_SIZE,
-                                            " %llu\r\n",
-                                            (unsigned long long)ITEM_get_cas(it));
-                  if (add_iov(c, "VALUE ", 6) != 0 ||
-                      add_iov(c, ITEM_key(it), it->nkey) != 0 ||
-                      add_iov(c, ITEM_suffix(it), it->nsuffix - 2) != 0 ||
-                      add_iov(c, suffix, suffix_len) != 0 ||
-                      add_iov(c, ITEM_data(it), it->nbytes) != 0)
-                      {
-                          item_remove(it);
-                          break;
-                      }
                 }
-                else
-                {
-                  MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
-                                        it->nbytes, ITEM_get_cas(it));
-                  if (add_iov(c, "VALUE ", 6) != 0 ||
-                      add_iov(c, ITEM_key(it), it->nkey) != 0 ||
-                      add_iov(c, ITEM_suffix(it), it->nsuffix + it->nbytes) != 0)
-                      {
-                          item_remove(it);
-                          break;
-                      }
+
+                suffix = cache_alloc(c->thread->suffix_cache);
+                if (suffix == NULL) {
+                    break;
                 }
+                suffix_len = make_ascii_get_suffix(suffix, it, return_cas);
+                if (add_iov(c, "VALUE ", 6) != 0 ||
+                    add_iov(c, ITEM_key(it), it->nkey) != 0 ||
+                    add_iov(c, suffix, suffix_len) != 0 ||
+                    add_item_data_iov(c, it, item_raw_nbytes(it)) != 0)
+                    {
+                        cache_free(c->thread->suffix_cache, suffix);
+                        break;
+                    }
+                *(c->suffixlist + i) = suffix;
 
 
                 if (settings.verbose > 1)
@@ -2621,6 +3061,8 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 pthread_mutex_lock(&c->thread->stats.mutex);
                 c->thread->stats.slab_stats[it->slabs_clsid].get_hits++;
                 c->thread->stats.get_cmds++;
+                c->thread->stats.get_hit_bytes += item_raw_nbytes(it) - 2;
+                c->thread->stats.get_hit_cost += ITEM_get_cost(it);
                 pthread_mutex_unlock(&c->thread->stats.mutex);
                 item_update(it);
                 *(c->ilist + i) = it;
@@ -2633,8 +3075,15 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 pthread_mutex_unlock(&c->thread->stats.mutex);
                 MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
             }
+        }
 
-            key_token++;
+        if (j < nbatch) {
+            /* Out of memory; drop the items that won't be sent */
+            for (; j < nbatch; j++) {
+                if (its[j])
+                    item_remove(its[j]);
+            }
+            break;
         }
 
         /*
@@ -2642,18 +3091,17 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
          * of tokens.
          */
         if(key_token->value != NULL) {
-            ntokens = tokenize_command(key_token->value, tokens, MAX_TOKENS);
-            key_token = tokens;
+            ntokens = tokenize_command(key_token->value, batch_tokens,
+                                       ITEM_GET_BATCH + 1);
+            key_token = batch_tokens;
         }
 
     } while(key_token->value != NULL);
 
     c->icurr = c->ilist;
     c->ileft = i;
-    if (return_cas) {
-        c->suffixcurr = c->suffixlist;
-        c->suffixleft = i;
-    }
+    c->suffixcurr = c->suffixlist;
+    c->suffixleft = i;
 
     if (settings.verbose > 1)
         fprintf(stderr, ">%d END\n", c->sfd);
@@ -2683,6 +3131,8 @@ static void process_update_command(conn *c, token_t *tokens, const size_t ntoken
     time_t exptime;
     int vlen;
     uint64_t req_cas_id=0;
+    uint32_t cost = 1;
+    const size_t cost_token = handle_cas ? 6 : 5;
     item *it;
 
     assert(c != NULL);
@@ -2715,6 +3165,14 @@ static void process_update_command(conn *c, token_t *tokens, const size_t ntoken
         }
     }
 
+    /* an optional cost hint may precede noreply */
+    if (ntokens - (c->noreply ? 1 : 0) > cost_token + 1) {
+        if (!safe_strtoul(tokens[cost_token].value, &cost)) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+    }
+
     vlen += 2;
     if (vlen < 0 || vlen - 2 < 0) {
         out_string(c, "CLIENT_ERROR bad command line format");
@@ -2749,6 +3207,7 @@ static void process_update_command(conn *c, token_t *tokens, const size_t ntoken
         return;
     }
     ITEM_set_cas(it, req_cas_id);
+    ITEM_set_cost(it, cost);
 
     c->item = it;
     c->ritem = ITEM_data(it);
@@ -2826,6 +3285,11 @@ enum delta_result_type do_add_delta(conn *c, item *it, const bool incr,
     uint64_t value;
     int res;
 
+    /* Far too long to be a number, or not one as numbers aren't compressed */
+    if ((it->it_flags & ITEM_CHUNKED) || it->encoding != ITEM_RAW) {
+        return NON_NUMERIC;
+    }
+
     ptr = ITEM_data(it);
 
     if (!safe_strtoull(ptr, &value)) {
@@ -2856,13 +3320,18 @@ enum delta_result_type do_add_delta(conn *c, item *it, const bool incr,
     res = strlen(buf);
     if (res + 2 > it->nbytes) { /* need to realloc */
         item *new_it;
-        new_it = do_item_alloc(ITEM_key(it), it->nkey, atoi(ITEM_suffix(it) + 1), it->exptime, res + 2 );
+        new_it = do_item_alloc(ITEM_key(it), it->nkey, ITEM_get_flags(it), ITEM_exptime(it), res + 2, it->hv);
         if (new_it == 0) {
             return EOM;
         }
+        ITEM_set_cost(new_it, ITEM_get_cost(it));
         memcpy(ITEM_data(new_it), buf, res);
         memcpy(ITEM_data(new_it) + res, "\r\n", 2);
-        item_replace(it, new_it);
+        if (!item_replace(it, new_it)) {
+            /* The hash table is full and nothing could be evicted */
+            do_item_remove(new_it);
+            return EOM;
+        }
         do_item_remove(new_it);       /* release our reference */
     } else { /* replace in-place */
         /* When changing the value without replacing the item, we
@@ -2941,6 +3410,147 @@ static void process_verbosity_command(conn *c, token_t *tokens, const size_t nto
     return;
 }
 
+static void process_memlimit_command(conn *c, token_t *tokens, const size_t ntokens) {
+    uint32_t memlimit;
+
+    assert(c != NULL);
+
+    set_noreply_maybe(c, tokens, ntokens);
+
+    if (!safe_strtoul(tokens[1].value, &memlimit)) {
+        out_string(c, "CLIENT_ERROR bad command line format");
+        return;
+    }
+    if (memlimit < 8) {
+        out_string(c, "MEMLIMIT_TOO_SMALL cannot set the limit below 8 megabytes");
+        return;
+    }
+    if (!slabs_adjust_mem_limit((size_t)memlimit * 1024 * 1024)) {
+        out_string(c, "MEMLIMIT_ADJUST_FAILED cannot raise the limit of "
+                   "preallocated memory");
+        return;
+    }
+    settings.maxbytes = (size_t)memlimit * 1024 * 1024;
+    if (settings.total_memory)
+        memory_budget_check();
+    out_string(c, "OK");
+}
+
+static void process_slabs_command(conn *c, token_t *tokens, const size_t ntokens) {
+    int32_t src, dst;
+
+    if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "automove") == 0) {
+        if (strcmp(tokens[2].value, "0") == 0) {
+            settings.slab_automove = false;
+        } else if (strcmp(tokens[2].value, "1") == 0) {
+            settings.slab_automove = true;
+        } else {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+        out_string(c, "OK");
+        return;
+    }
+
+    if (ntokens == 3 && strcmp(tokens[COMMAND_TOKEN + 1].value, "autotune") == 0) {
+        switch (slabs_ladder_adopt(true)) {
+        case LADDER_OK:
+            out_string(c, "OK");
+            break;
+        case LADDER_NOSAMPLES:
+            out_string(c, "NOSAMPLES not enough items stored yet");
+            break;
+        case LADDER_NOROOM:
+            out_string(c, "NOROOM no free class ids for the new sizes");
+            break;
+        case LADDER_SAME:
+            out_string(c, "SAME no better chunk sizes found");
+            break;
+        }
+        return;
+    }
+
+    if (ntokens != 5 || strcmp(tokens[COMMAND_TOKEN + 1].value, "reassign") != 0) {
+        out_string(c, "ERROR");
+        return;
+    }
+
+    if (!safe_strtol(tokens[2].value, &src)
+        || !safe_strtol(tokens[3].value, &dst)) {
+        out_string(c, "CLIENT_ERROR bad command line format");
+        return;
+    }
+
+    switch (slabs_reassign(src, dst)) {
+    case REASSIGN_OK:
+        out_string(c, "OK");
+        break;
+    case REASSIGN_RUNNING:
+        out_string(c, "BUSY currently processing reassign request");
+        break;
+    case REASSIGN_BADCLASS:
+        out_string(c, "BADCLASS invalid src or dst class id");
+        break;
+    case REASSIGN_NOSPARE:
+        out_string(c, "NOSPARE source class has no spare pages");
+        break;
+    case REASSIGN_SRC_DST_SAME:
+        out_string(c, "SAME src and dst class are identical");
+        break;
+    }
+}
+
+static void process_lru_crawler_command(conn *c, token_t *tokens, const size_t ntokens) {
+    const char *subcommand = tokens[COMMAND_TOKEN + 1].value;
+    uint32_t value;
+
+    if (ntokens == 4 && strcmp(subcommand, "crawl") == 0) {
+        switch (lru_crawler_crawl(tokens[2].value)) {
+        case CRAWLER_OK:
+            out_string(c, "OK");
+            break;
+        case CRAWLER_RUNNING:
+            out_string(c, "BUSY currently processing crawler request");
+            break;
+        case CRAWLER_BADCLASS:
+            out_string(c, "BADCLASS invalid class id");
+            break;
+        case CRAWLER_NOTSTARTED:
+            out_string(c, "NOTSTARTED lru crawler is disabled");
+            break;
+        }
+    } else if (ntokens == 4 && strcmp(subcommand, "sleep") == 0) {
+        if (!safe_strtoul(tokens[2].value, &value) || value > 1000000) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+        settings.lru_crawler_sleep = value;
+        out_string(c, "OK");
+    } else if (ntokens == 4 && strcmp(subcommand, "batch") == 0) {
+        if (!safe_strtoul(tokens[2].value, &value) || value == 0 ||
+            value > INT_MAX) {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+        settings.lru_crawler_batch = value;
+        out_string(c, "OK");
+    } else if (ntokens == 3 && strcmp(subcommand, "enable") == 0) {
+        if (settings.lru_crawler || start_item_crawler_thread() == 0) {
+            out_string(c, "OK");
+        } else {
+            out_string(c, "ERROR failed to start lru crawler thread");
+        }
+    } else if (ntokens == 3 && strcmp(subcommand, "disable") == 0) {
+        if (stop_item_crawler_thread() == 0) {
+            out_string(c, "OK");
+        } else {
+            out_string(c, "ERROR failed to stop lru crawler thread");
+        }
+    } else {
+        out_string(c, "ERROR");
+    }
+}
+
 static void process_command(conn *c, char *command) {
 
     token_t tokens[MAX_TOKENS];
@@ -2974,7 +3584,7 @@ static void process_command(conn *c, char *command) {
 
         process_get_command(c, tokens, ntokens, false);
 
-    } else if ((ntokens == 6 || ntokens == 7) &&
+    } else if ((ntokens >= 6 && ntokens <= 8) &&
                ((strcmp(tokens[COMMAND_TOKEN].value, "add") == 0 && (comm = NREAD_ADD)) ||
                 (strcmp(tokens[COMMAND_TOKEN].value, "set") == 0 && (comm = NREAD_SET)) ||
                 (strcmp(tokens[COMMAND_TOKEN].value, "replace") == 0 && (comm = NREAD_REPLACE)) ||
@@ -2983,7 +3593,7 @@ static void process_command(conn *c, char *command) {
 
         process_update_command(c, tokens, ntokens, comm, false);
 
-    } else if ((ntokens == 7 || ntokens == 8) && (strcmp(tokens[COMMAND_TOKEN].value, "cas") == 0 && (comm = NREAD_CAS))) {
+    } else if ((ntokens >= 7 && ntokens <= 9) && (strcmp(tokens[COMMAND_TOKEN].value, "cas") == 0 && (comm = NREAD_CAS))) {
 
         process_update_command(c, tokens, ntokens, comm, true);
 
@@ -3018,8 +3628,7 @@ static void process_command(conn *c, char *command) {
         pthread_mutex_unlock(&c->thread->stats.mutex);
 
         if(ntokens == (c->noreply ? 3 : 2)) {
-            settings.oldest_live = current_time - 1;
-            item_flush_expired();
+            item_flush_expired(current_time);
             out_string(c, "OK");
             return;
         }
@@ -3037,10 +3646,9 @@ static void process_command(conn *c, char *command) {
           no delay is given at all.
         */
         if (exptime > 0)
-            settings.oldest_live = realtime(exptime) - 1;
+            item_flush_expired(realtime(exptime));
         else /* exptime == 0 */
-            settings.oldest_live = current_time - 1;
-        item_flush_expired();
+            item_flush_expired(current_time);
         out_string(c, "OK");
         return;
 
@@ -3054,6 +3662,12 @@ static void process_command(conn *c, char *command) {
 
     } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN].value, "verbosity") == 0)) {
         process_verbosity_command(c, tokens, ntokens);
+    } else if (ntokens >= 2 && (strcmp(tokens[COMMAND_TOKEN].value, "slabs") == 0)) {
+        process_slabs_command(c, tokens, ntokens);
+    } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN].value, "cache_memlimit") == 0)) {
+        process_memlimit_command(c, tokens, ntokens);
+    } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN].value, "lru_crawler") == 0)) {
+        process_lru_crawler_command(c, tokens, ntokens);
     } else {
         out_string(c, "ERROR");
     }
@@ -3271,6 +3885,7 @@ static enum try_read_result try_read_network(conn *c) {
             }
             c->rcurr = c->rbuf = new_rbuf;
             c->rsize *= 2;
+            conn_mem_update(c);
         }
 
         int avail = c->rsize - c->rbytes;
@@ -3421,6 +4036,7 @@ static void drive_machine(conn *c) {
     struct sockaddr_storage addr;
     int nreqs = settings.reqs_per_event;
     int res;
+    int toread;
 
     assert(c != NULL);
 
@@ -3528,9 +4144,21 @@ static void drive_machine(conn *c) {
                 complete_nread(c);
                 break;
             }
+            /* a chunked item's value is read one chunk at a time */
+            toread = c->rlbytes;
+            if (c->item != NULL &&
+                (((item *)c->item)->it_flags & ITEM_CHUNKED) != 0) {
+                int len;
+                char *ptr = item_data_next(c->item, c->ritem, &len);
+                if (ptr != NULL) {
+                    c->ritem = ptr;
+                    if (len < toread)
+                        toread = len;
+                }
+            }
             /* first check if we have leftovers in the conn_read buffer */
             if (c->rbytes > 0) {
-                int tocopy = c->rbytes > c->rlbytes ? c->rlbytes : c->rbytes;
+                int tocopy = c->rbytes > toread ? toread : c->rbytes;
                 if (c->ritem != c->rcurr) {
                     memmove(c->ritem, c->rcurr, tocopy);
                 }
@@ -3538,13 +4166,14 @@ static void drive_machine(conn *c) {
                 c->rlbytes -= tocopy;
                 c->rcurr += tocopy;
                 c->rbytes -= tocopy;
-                if (c->rlbytes == 0) {
+                toread -= tocopy;
+                if (c->rlbytes == 0 || toread == 0) {
                     break;
                 }
             }
 
             /*  now try reading from the socket */
-            res = read(c->sfd, c->ritem, c->rlbytes);
+            res = read(c->sfd, c->ritem, toread);
             if (res > 0) {
                 pthread_mutex_lock(&c->thread->stats.mutex);
                 c->thread->stats.bytes_read += res;
@@ -3667,6 +4296,7 @@ static void drive_machine(conn *c) {
                         c->suffixcurr++;
                         c->suffixleft--;
                     }
+                    conn_release_unpacked(c);
                     /* XXX:  I don't know why this wasn't the general case */
                     if(c->protocol == binary_prot) {
                         conn_set_state(c, c->write_and_go);
@@ -4038,6 +4668,9 @@ static void clock_handler(const int fd, const short which, void *arg) {
     evtimer_add(&clockevent, &t);
 
     set_current_time();
+
+    if (settings.total_memory)
+        memory_budget_check();
 }
 
 static void usage(void) {
@@ -4071,7 +4704,9 @@ static void usage(void) {
            "              the memory page size could reduce the number of TLB misses\n"
            "              and improve the performance. In order to get large pages\n"
            "              from the OS, memcached will allocate the total item-cache\n"
-           "              in one large chunk.\n");
+           "              in one large chunk. On Linux that chunk is mapped with\n"
+           "              explicit huge pages if enough are reserved, and with\n"
+           "              transparent huge pages otherwise.\n");
     printf("-D <char>     Use <char> as the delimiter between key prefixes and IDs.\n"
            "              This is used for per-prefix stats reporting. The default is\n"
            "              \":\" (colon). If this option is specified, stats collection\n"
@@ -4084,11 +4719,60 @@ static void usage(void) {
     printf("-C            Disable use of CAS\n");
     printf("-b            Set the backlog queue limit (default: 1024)\n");
     printf("-B            Binding protocol - one of ascii, binary, or auto (default)\n");
-    printf("-I            Override the size of each slab page. Adjusts max item size\n"
-           "              (default: 1mb, min: 1k, max: 128m)\n");
+    printf("-I            Override the maximum item size. Items bigger than half a\n"
+           "              slab page are stored in chunks (default: 1mb, min: 1k,\n"
+           "              max: 128m); see slab_page_size below\n");
 #ifdef ENABLE_SASL
     printf("-S            Turn on Sasl authentication\n");
 #endif
+    printf("-o            Comma separated list of extended or experimental options\n"
+           "              - gdsf: evict by GreedyDual-Size-Frequency priority,\n"
+           "                using the cost hints given by clients at store time\n"
+           "                (default: plain LRU)\n"
+           "              - ttl_evict_window: evict items expiring within this\n"
+           "                many seconds before live data, 0 to disable\n"
+           "                (default: 60, max: 255)\n"
+           "              - lru_crawler: enable the LRU crawler background thread\n"
+           "              - lru_crawler_sleep: microseconds to sleep between\n"
+           "                crawler batches (default: 100)\n"
+           "              - lru_crawler_batch: items crawled per cache lock\n"
+           "                acquisition (default: 100)\n"
+           "              - slab_automove: move slab pages to the classes\n"
+           "                that would gain the most hits from them, or with\n"
+           "                gdsf from the class with the lowest priority items\n"
+           "              - slab_automove_window: seconds between automove\n"
+           "                decisions (default: 10)\n"
+           "              - slab_page_size: size of the pages memory is handed\n"
+           "                to slab classes in, with an optional k or m suffix\n"
+           "                (default: 1m, min: 1k, max: 128m)\n"
+           "              - hash_table: how keys are indexed: chained (default)\n"
+           "                or open (open addressing with hash tags)\n"
+           "              - hash_algorithm: what keys are hashed with: jenkins\n"
+           "                (default), murmur3 or crc32c (needs SSE4.2)\n"
+           "              - hash_large_pages: put the hash table in huge pages\n"
+           "                as well (see -L)\n"
+           "              - prefault[=<threads>]: allocate all item memory at\n"
+           "                startup and fault it in (and lock it, if allowed)\n"
+           "                with this many threads (default: as many as -t)\n"
+           "              - slab_release: give slab pages that no longer hold\n"
+           "                any items back to the OS\n"
+           "              - slab_release_floor: megabytes of slab pages to keep\n"
+           "                when releasing (default: 0)\n"
+           "              - total_memory: make -m a limit on all memory shown in\n"
+           "                \"stats memory\", not just items\n"
+           "              - slab_autotune: switch to the chunk sizes \"stats\n"
+           "                ladder\" proposes when they waste a lot less\n"
+           "              - slab_autotune_window: seconds between autotune\n"
+           "                decisions (default: 60)\n"
+           "              - slab_sizes: chunk sizes to use instead of -n and\n"
+           "                -f, smallest first, separated by dashes\n"
+           "              - allocator: how item memory is handed out: slab\n"
+           "                (default) or log (appended to segments that a\n"
+           "                cleaner compacts)\n"
+           "              - compress[=<bytes>]: store values at least this\n"
+           "                long (default: 256) LZ4 compressed when that puts\n"
+           "                them in a smaller slab class (needs a build with\n"
+           "                --enable-lz4)\n");
     return;
 }
 
@@ -4209,7 +4893,8 @@ static int sigignore(int sig) {
 
 /*
  * On systems that supports multiple page sizes we may reduce the
- * number of TLB-misses by using the biggest available page size
+ * number of TLB-misses by using the biggest available page size.
+ * Elsewhere slabs_init() maps the item memory in huge pages itself.
  */
 static int enable_large_pages(void) {
 #if defined(HAVE_GETPAGESIZES) && defined(HAVE_MEMCNTL)
@@ -4236,6 +4921,7 @@ static int enable_large_pages(void) {
                     strerror(errno));
             fprintf(stderr, "Will use default page size\n");
         } else {
+            settings.slab_pages = LARGE_PAGES_MEMCNTL;
             ret = 0;
         }
     } else {
@@ -4246,22 +4932,73 @@ static int enable_large_pages(void) {
 
     return ret;
 #else
+    settings.large_pages = true;
     return 0;
 #endif
 }
 
+/*
+ * Parses a size in bytes, optionally followed by k or m for kilobytes or
+ * megabytes.
+ */
+static int parse_size(const char *str) {
+    char *end;
+    long size = strtol(str, &end, 10);
+
+    if (*end == 'k' || *end == 'K')
+        size *= 1024;
+    else if (*end == 'm' || *end == 'M')
+        size *= 1024 * 1024;
+    return size > INT_MAX ? -1 : (int)size;
+}
+
+/*
+ * Parses the chunk sizes of -o slab_sizes: increasing numbers separated by
+ * dashes. Fills in sizes, ending it with a 0; returns false after saying
+ * what is wrong if they won't do.
+ */
+static bool parse_slab_sizes(char *str, unsigned int *sizes) {
+    char *b = NULL, *p;
+    uint32_t size, last = 0;
+    int n = 0;
+
+    for (p = strtok_r(str, "-", &b); p != NULL; p = strtok_r(NULL, "-", &b)) {
+        if (!safe_strtoul(p, &size) || size <= last) {
+            fprintf(stderr, "slab_sizes must be increasing numbers separated"
+                    " by dashes\n");
+            return false;
+        }
+        if (size < sizeof(item) || size % CHUNK_ALIGN_BYTES != 0) {
+            fprintf(stderr, "slab_sizes must be multiples of %d bytes, and at"
+                    " least %d\n", CHUNK_ALIGN_BYTES, (int)sizeof(item));
+            return false;
+        }
+        /* The largest chunk size is added as the last class */
+        if (n == POWER_LARGEST - POWER_SMALLEST - 1) {
+            fprintf(stderr, "slab_sizes can't have more than %d sizes\n", n);
+            return false;
+        }
+        sizes[n++] = last = size;
+    }
+    if (n == 0) {
+        fprintf(stderr, "slab_sizes needs at least one size\n");
+        return false;
+    }
+    sizes[n] = 0;
+    return true;
+}
+
 int main (int argc, char **argv) {
     int c;
     bool lock_memory = false;
     bool do_daemonize = false;
     bool preallocate = false;
+    static unsigned int slab_sizes[MAX_NUMBER_OF_SLAB_CLASSES];
     int maxcore = 0;
     char *username = NULL;
     char *pid_file = NULL;
     struct passwd *pw;
     struct rlimit rlim;
-    char unit = '\0';
-    int size_max = 0;
     /* listening sockets */
     static int *l_socket = NULL;
 
@@ -4270,6 +5007,55 @@ int main (int argc, char **argv) {
     bool protocol_specified = false;
     bool tcp_specified = false;
     bool udp_specified = false;
+    bool start_lru_crawler = false;
+
+    char *subopts;
+    char *subopts_value;
+    enum {
+        GDSF = 0,
+        TTL_EVICT_WINDOW,
+        LRU_CRAWLER,
+        LRU_CRAWLER_SLEEP,
+        LRU_CRAWLER_BATCH,
+        SLAB_AUTOMOVE,
+        SLAB_AUTOMOVE_WINDOW,
+        SLAB_PAGE_SIZE,
+        HASH_TABLE,
+        HASH_ALGORITHM,
+        HASH_LARGE_PAGES,
+        PREFAULT,
+        SLAB_RELEASE,
+        SLAB_RELEASE_FLOOR,
+        TOTAL_MEMORY,
+        SLAB_AUTOTUNE,
+        SLAB_AUTOTUNE_WINDOW,
+        SLAB_SIZES,
+        ALLOCATOR,
+        COMPRESS
+    };
+    char *const subopts_tokens[] = {
+        [GDSF] = "gdsf",
+        [TTL_EVICT_WINDOW] = "ttl_evict_window",
+        [LRU_CRAWLER] = "lru_crawler",
+        [LRU_CRAWLER_SLEEP] = "lru_crawler_sleep",
+        [LRU_CRAWLER_BATCH] = "lru_crawler_batch",
+        [SLAB_AUTOMOVE] = "slab_automove",
+        [SLAB_AUTOMOVE_WINDOW] = "slab_automove_window",
+        [SLAB_PAGE_SIZE] = "slab_page_size",
+        [HASH_TABLE] = "hash_table",
+        [HASH_ALGORITHM] = "hash_algorithm",
+        [HASH_LARGE_PAGES] = "hash_large_pages",
+        [PREFAULT] = "prefault",
+        [SLAB_RELEASE] = "slab_release",
+        [SLAB_RELEASE_FLOOR] = "slab_release_floor",
+        [TOTAL_MEMORY] = "total_memory",
+        [SLAB_AUTOTUNE] = "slab_autotune",
+        [SLAB_AUTOTUNE_WINDOW] = "slab_autotune_window",
+        [SLAB_SIZES] = "slab_sizes",
+        [ALLOCATOR] = "allocator",
+        [COMPRESS] = "compress",
+        NULL
+    };
 
     /* handle SIGINT */
     signal(SIGINT, sig_handler);
@@ -4308,6 +5094,7 @@ int main (int argc, char **argv) {
           "B:"  /* Binding protocol */
           "I:"  /* Max item size */
           "S"   /* Sasl ON */
+          "o:"  /* Extended generic options */
         ))) {
         switch (c) {
         case 'a':
@@ -4434,19 +5221,7 @@ int main (int argc, char **argv) {
             }
             break;
         case 'I':
-            unit = optarg[strlen(optarg)-1];
-            if (unit == 'k' || unit == 'm' ||
-                unit == 'K' || unit == 'M') {
-                optarg[strlen(optarg)-1] = '\0';
-                size_max = atoi(optarg);
-                if (unit == 'k' || unit == 'K')
-                    size_max *= 1024;
-                if (unit == 'm' || unit == 'M')
-                    size_max *= 1024 * 1024;
-                settings.item_size_max = size_max;
-            } else {
-                settings.item_size_max = atoi(optarg);
-            }
+            settings.item_size_max = parse_size(optarg);
             if (settings.item_size_max < 1024) {
                 fprintf(stderr, "Item max size cannot be less than 1024 bytes.\n");
                 return 1;
@@ -4455,13 +5230,6 @@ int main (int argc, char **argv) {
                 fprintf(stderr, "Cannot set item size limit higher than 128 mb.\n");
                 return 1;
             }
-            if (settings.item_size_max > 1024 * 1024) {
-                fprintf(stderr, "WARNING: Setting item max size above 1MB is not"
-                    " recommended!\n"
-                    " Raising this limit increases the minimum memory requirements\n"
-                    " and will decrease your memory efficiency.\n"
-                );
-            }
             break;
         case 'S': /* set Sasl authentication to true. Default is false */
 #ifndef ENABLE_SASL
@@ -4470,6 +5238,211 @@ int main (int argc, char **argv) {
 #endif
             settings.sasl = true;
             break;
+        case 'o': /* It's sub-opts time! */
+            subopts = optarg;
+
+            while (*subopts != '\0') {
+                switch (getsubopt(&subopts, subopts_tokens, &subopts_value)) {
+                case GDSF:
+                    settings.gdsf = true;
+                    break;
+                case TTL_EVICT_WINDOW:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing ttl_evict_window argument\n");
+                        return 1;
+                    }
+                    if (!safe_strtol(subopts_value,
+                                     (int32_t *)&settings.ttl_evict_window) ||
+                        settings.ttl_evict_window < 0 ||
+                        settings.ttl_evict_window > 255) {
+                        fprintf(stderr, "ttl_evict_window takes a number of "
+                                "seconds from 0 to 255\n");
+                        return 1;
+                    }
+                    break;
+                case LRU_CRAWLER:
+                    start_lru_crawler = true;
+                    break;
+                case LRU_CRAWLER_SLEEP:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing lru_crawler_sleep argument\n");
+                        return 1;
+                    }
+                    settings.lru_crawler_sleep = atoi(subopts_value);
+                    if (settings.lru_crawler_sleep > 1000000 ||
+                        settings.lru_crawler_sleep < 0) {
+                        fprintf(stderr, "LRU crawler sleep must be between 0 and 1 second\n");
+                        return 1;
+                    }
+                    break;
+                case LRU_CRAWLER_BATCH:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing lru_crawler_batch argument\n");
+                        return 1;
+                    }
+                    settings.lru_crawler_batch = atoi(subopts_value);
+                    if (settings.lru_crawler_batch <= 0) {
+                        fprintf(stderr, "LRU crawler batch must be positive\n");
+                        return 1;
+                    }
+                    break;
+                case SLAB_AUTOMOVE:
+                    settings.slab_automove = true;
+                    break;
+                case SLAB_AUTOMOVE_WINDOW:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing slab_automove_window argument\n");
+                        return 1;
+                    }
+                    settings.slab_automove_window = atoi(subopts_value);
+                    if (settings.slab_automove_window <= 0) {
+                        fprintf(stderr, "slab_automove_window must be positive\n");
+                        return 1;
+                    }
+                    break;
+                case SLAB_PAGE_SIZE:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing slab_page_size argument\n");
+                        return 1;
+                    }
+                    settings.slab_page_size = parse_size(subopts_value);
+                    if (settings.slab_page_size < 1024) {
+                        fprintf(stderr, "Slab page size cannot be less than 1024 bytes.\n");
+                        return 1;
+                    }
+                    if (settings.slab_page_size > 1024 * 1024 * 128) {
+                        fprintf(stderr, "Cannot set slab page size higher than 128 mb.\n");
+                        return 1;
+                    }
+                    break;
+                case HASH_TABLE:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing hash_table argument\n");
+                        return 1;
+                    }
+                    if (strcmp(subopts_value, "chained") == 0) {
+                        settings.hash_table = HASH_TABLE_CHAINED;
+                    } else if (strcmp(subopts_value, "open") == 0) {
+                        settings.hash_table = HASH_TABLE_OPEN;
+                    } else {
+                        fprintf(stderr, "hash_table must be chained or open\n");
+                        return 1;
+                    }
+                    break;
+                case HASH_ALGORITHM:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing hash_algorithm argument\n");
+                        return 1;
+                    }
+                    if (strcmp(subopts_value, "jenkins") == 0) {
+                        settings.hash_algorithm = JENKINS_HASH;
+                    } else if (strcmp(subopts_value, "murmur3") == 0) {
+                        settings.hash_algorithm = MURMUR3_HASH;
+                    } else if (strcmp(subopts_value, "crc32c") == 0) {
+                        settings.hash_algorithm = CRC32C_HASH;
+                    } else {
+                        fprintf(stderr, "hash_algorithm must be jenkins, "
+                                "murmur3 or crc32c\n");
+                        return 1;
+                    }
+                    break;
+                case HASH_LARGE_PAGES:
+                    settings.hash_large_pages = true;
+                    break;
+                case PREFAULT:
+                    if (subopts_value == NULL) {
+                        /* -t may come later; filled in below */
+                        settings.prefault_threads = -1;
+                    } else if (!safe_strtol(subopts_value,
+                                 (int32_t *)&settings.prefault_threads) ||
+                               settings.prefault_threads < 1) {
+                        fprintf(stderr, "prefault takes a number of threads\n");
+                        return 1;
+                    }
+                    preallocate = true;
+                    break;
+                case SLAB_RELEASE:
+                    /* Pages are counted by their place in one chunk */
+                    settings.slab_release = true;
+                    preallocate = true;
+                    break;
+                case SLAB_RELEASE_FLOOR:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing slab_release_floor argument\n");
+                        return 1;
+                    }
+                    if (!safe_strtol(subopts_value,
+                                     (int32_t *)&settings.slab_release_floor) ||
+                        settings.slab_release_floor < 0) {
+                        fprintf(stderr, "slab_release_floor takes a number of "
+                                "megabytes\n");
+                        return 1;
+                    }
+                    break;
+                case TOTAL_MEMORY:
+                    settings.total_memory = true;
+                    break;
+                case SLAB_AUTOTUNE:
+                    settings.slab_autotune = true;
+                    break;
+                case SLAB_AUTOTUNE_WINDOW:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing slab_autotune_window argument\n");
+                        return 1;
+                    }
+                    settings.slab_autotune_window = atoi(subopts_value);
+                    if (settings.slab_autotune_window <= 0) {
+                        fprintf(stderr, "slab_autotune_window must be positive\n");
+                        return 1;
+                    }
+                    break;
+                case SLAB_SIZES:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing slab_sizes argument\n");
+                        return 1;
+                    }
+                    if (!parse_slab_sizes(subopts_value, slab_sizes))
+                        return 1;
+                    settings.slab_sizes = slab_sizes;
+                    break;
+                case ALLOCATOR:
+                    if (subopts_value == NULL) {
+                        fprintf(stderr, "Missing allocator argument\n");
+                        return 1;
+                    }
+                    if (strcmp(subopts_value, "slab") == 0) {
+                        settings.allocator = ALLOCATOR_SLAB;
+                    } else if (strcmp(subopts_value, "log") == 0) {
+                        /* Segments are found by their place in one chunk */
+                        settings.allocator = ALLOCATOR_LOG;
+                        preallocate = true;
+                    } else {
+                        fprintf(stderr, "allocator must be slab or log\n");
+                        return 1;
+                    }
+                    break;
+                case COMPRESS:
+#ifdef ENABLE_LZ4
+                    if (subopts_value == NULL) {
+                        settings.compress_min = 256;
+                    } else if (!safe_strtol(subopts_value,
+                                            &settings.compress_min) ||
+                               settings.compress_min < 1) {
+                        fprintf(stderr, "compress takes a number of bytes\n");
+                        return 1;
+                    }
+                    break;
+#else
+                    fprintf(stderr, "compress needs a build with "
+                            "--enable-lz4\n");
+                    return 1;
+#endif
+                default:
+                    fprintf(stderr, "Illegal suboption \"%s\"\n", subopts_value);
+                    return 1;
+                }
+            }
+            break;
         default:
             fprintf(stderr, "Illegal argument \"%c\"\n", c);
             return 1;
@@ -4590,10 +5563,57 @@ int main (int argc, char **argv) {
 
     /* initialize other stuff */
     stats_init();
-    assoc_init();
+    if (!hash_init(settings.hash_algorithm)) {
+        fprintf(stderr, "The %s hash isn't supported on this machine\n",
+                hash_name(settings.hash_algorithm));
+        exit(EXIT_FAILURE);
+    }
+    assoc_init(0);
     conn_init();
+    /* Items bigger than half a page are stored in chunks, so the page size
+     * and the item size limit can be set independently */
+    settings.slab_chunk_size_max = settings.slab_page_size / 2;
+    if (settings.slab_chunk_size_max > settings.item_size_max) {
+        settings.slab_chunk_size_max = settings.item_size_max;
+    }
+    /* Keep every chunk of the largest class aligned too */
+    settings.slab_chunk_size_max -= settings.slab_chunk_size_max % CHUNK_ALIGN_BYTES;
+    if (settings.slab_sizes != NULL) {
+        int i;
+        for (i = 0; settings.slab_sizes[i + 1] != 0; i++)
+            continue;
+        if (settings.slab_sizes[i] >= settings.slab_chunk_size_max) {
+            fprintf(stderr, "slab_sizes must be smaller than the largest chunk"
+                    " (%d bytes)\n", settings.slab_chunk_size_max);
+            exit(EXIT_FAILURE);
+        }
+    }
+    /* The log has a single class, so there are no pages to move, release
+     * or resize */
+    if (settings.allocator == ALLOCATOR_LOG &&
+        (settings.slab_release || settings.slab_automove ||
+         settings.slab_autotune || settings.slab_sizes != NULL)) {
+        fprintf(stderr, "allocator=log can't be used with slab_release, "
+                "slab_automove, slab_autotune or slab_sizes\n");
+        exit(EXIT_FAILURE);
+    }
+    /* The log has one class, so compressing never moves an item down */
+    if (settings.compress_min > 0 && settings.allocator == ALLOCATOR_LOG) {
+        fprintf(stderr, "compress can't be used with allocator=log\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (settings.prefault_threads < 0)
+        settings.prefault_threads = settings.num_threads;
     slabs_init(settings.maxbytes, settings.factor, preallocate);
 
+    /* Huge pages depend on what the OS has to spare; say what we got */
+    if (settings.large_pages || settings.hash_large_pages) {
+        fprintf(stderr, "Large pages: slab memory %s, hash table %s\n",
+                large_pages_name(settings.slab_pages),
+                large_pages_name(settings.hash_pages));
+    }
+
     /*
      * ignore SIGPIPE signals; we can use errno == EPIPE if we
      * need that information
@@ -4611,6 +5631,19 @@ int main (int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (start_item_expiry_thread() == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (start_slab_maintenance_thread() == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (start_lru_crawler && start_item_crawler_thread() != 0) {
+        fprintf(stderr, "Failed to enable LRU crawler thread\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (do_daemonize)
         save_pid(getpid(), pid_file);
     /* initialise clock event */
@@ -4680,6 +5713,9 @@ int main (int argc, char **argv) {
     /* enter the event loop */
     event_base_loop(main_base, 0);
 
+    stop_item_crawler_thread();
+    stop_slab_maintenance_thread();
+    stop_item_expiry_thread();
     stop_assoc_maintenance_thread();
 
     /* remove the PID file if we're a daemon */
@@ -29,21 +29,27 @@
 /** Size of an incr buf. */
 #define INCR_MAX_STORAGE_LEN 24
 
+/** Most keys item_get_many() looks up at once. */
+#define ITEM_GET_BATCH 16
+
 #define DATA_BUFFER_SIZE 2048
 #define UDP_READ_BUFFER_SIZE 65536
 #define UDP_MAX_PAYLOAD_SIZE 1400
 #define UDP_HEADER_SIZE 8
 #define MAX_SENDBUF_SIZE (256 * 1024 * 1024)
-/* I'm told the max length of a 64-bit num converted to string is 20 bytes.
- * Plus a few for spaces, \r\n, \0 */
-#define SUFFIX_SIZE 24
+/* Room for the end of a "VALUE" line: " <flags> <bytes> <cas>\r\n". A
+ * 32-bit number takes up to 10 characters and a 64-bit one up to 20. */
+#define SUFFIX_SIZE 48
 
 /** Initial size of list of items being returned by "get". */
 #define ITEM_LIST_INITIAL 200
 
-/** Initial size of list of CAS suffixes appended to "gets" lines. */
+/** Initial size of list of suffixes appended to "get" and "gets" lines. */
 #define SUFFIX_LIST_INITIAL 20
 
+/** Initial size of list of values decompressed for a response. */
+#define UNPACK_LIST_INITIAL 10
+
 /** Initial size of the sendmsg() scatter/gather array. */
 #define IOV_LIST_INITIAL 400
 
@@ -82,19 +88,93 @@
 #define ITEM_set_cas(i,v) { if ((i)->it_flags & ITEM_CAS) { \
                           *(uint64_t*)&((i)->end[0]) = v; } }
 
-#define ITEM_key(item) (((char*)&((item)->end[0])) \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+/* Size of the optional per-item metadata stored in front of the key */
+#define ITEM_meta_len(item) \
+         ((((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_GDSF) ? sizeof(item_gdsf) : 0) \
+         + (((item)->it_flags & ITEM_TTL) ? sizeof(item_ttl) : 0) \
+         + (((item)->it_flags & ITEM_CHUNKED) ? \
+            sizeof(ITEM_LINK(struct _stritem_chunk)) : 0))
+
+/* GDSF bookkeeping lives right after the CAS value (if any) */
+#define ITEM_gdsf(item) ((item_gdsf *)((char*)&((item)->end[0]) \
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0)))
+#define ITEM_get_cost(i) ((uint32_t)(((i)->it_flags & ITEM_GDSF) ? \
+                                     ITEM_gdsf(i)->cost : 1))
+#define ITEM_set_cost(i,v) { if ((i)->it_flags & ITEM_GDSF) { \
+                           ITEM_gdsf(i)->cost = v; } }
+
+/* Expiry index links follow the CAS value and GDSF state (if any) */
+#define ITEM_ttl(item) ((item_ttl *)((char*)&((item)->end[0]) \
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_GDSF) ? sizeof(item_gdsf) : 0)))
+
+/* The link to the first chunk of a chunked item's value follows the
+ * expiry links */
+#define ITEM_chunks(item) ((ITEM_LINK(struct _stritem_chunk) *) \
+         ((char*)&((item)->end[0]) \
+         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0) \
+         + (((item)->it_flags & ITEM_GDSF) ? sizeof(item_gdsf) : 0) \
+         + (((item)->it_flags & ITEM_TTL) ? sizeof(item_ttl) : 0)))
+
+/* With compact items the exptime is only stored for items that have one */
+#ifdef ENABLE_COMPACT_ITEMS
+#define ITEM_exptime(item) ((rel_time_t)(((item)->it_flags & ITEM_TTL) ? \
+                                         ITEM_ttl(item)->exptime : 0))
+#else
+#define ITEM_exptime(item) ((item)->exptime)
+#endif
+
+/* Client flags are kept in binary after the metadata, unless they're 0 */
+#define ITEM_flags(item) ((uint32_t *)((char*)&((item)->end[0]) \
+         + ITEM_meta_len(item)))
+#define ITEM_get_flags(item) ((uint32_t)((item)->nsuffix ? \
+                                         *ITEM_flags(item) : 0))
 
-#define ITEM_suffix(item) ((char*) &((item)->end[0]) + (item)->nkey + 1 \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+#define ITEM_key(item) (((char*)&((item)->end[0])) + ITEM_meta_len(item) \
+         + (item)->nsuffix)
 
 #define ITEM_data(item) ((char*) &((item)->end[0]) + (item)->nkey + 1 \
-         + (item)->nsuffix \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+         + (item)->nsuffix + ITEM_meta_len(item))
 
 #define ITEM_ntotal(item) (sizeof(struct _stritem) + (item)->nkey + 1 \
-         + (item)->nsuffix + (item)->nbytes \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
+         + (item)->nsuffix + (item)->nbytes + ITEM_meta_len(item))
+
+#ifdef ENABLE_COMPACT_ITEMS
+/*
+ * With compact items every item and value chunk lives in one arena (see
+ * slabs_init()), and the LRU, hash chain, expiry index and chunk links are
+ * 32-bit offsets into it, counted in CHUNK_ALIGN_BYTES units. Together
+ * with the exptime moving to the expiry links (items without one don't
+ * need it) and nbytes, nsuffix and encoding sharing a word, that keeps
+ * the header at 32 bytes instead of 48, and caps the arena at 32GB.
+ * Offset 0 is never an item, so it stands for NULL.
+ */
+typedef uint32_t item_ref;
+extern char *item_arena;
+#define ITEM_LINK(type) item_ref
+#define ITEM_REF(p) ((p) ? (item_ref)(((char *)(p) - item_arena) \
+                                      / CHUNK_ALIGN_BYTES) : 0)
+#define ITEM_PTR(ref) ((ref) ? (void *)(item_arena \
+                       + (size_t)(ref) * CHUNK_ALIGN_BYTES) : NULL)
+#define ITEM_ARENA_MAX ((size_t)UINT32_MAX * CHUNK_ALIGN_BYTES)
+#else
+#define ITEM_LINK(type) type *
+#define ITEM_REF(p) (p)
+#define ITEM_PTR(ref) (ref)
+#endif
+
+/* Follow the links of an item or a value chunk */
+#define ITEM_next(item) ((struct _stritem *)ITEM_PTR((item)->next))
+#define ITEM_prev(item) ((struct _stritem *)ITEM_PTR((item)->prev))
+#define ITEM_h_next(item) ((struct _stritem *)ITEM_PTR((item)->h_next))
+#define CHUNK_next(ch) ((struct _stritem_chunk *)ITEM_PTR((ch)->next))
+#define CHUNK_prev(ch) ((struct _stritem_chunk *)ITEM_PTR((ch)->prev))
+#define CHUNK_head(ch) ((struct _stritem *)ITEM_PTR((ch)->head))
+#define ITEM_first_chunk(item) \
+         ((struct _stritem_chunk *)ITEM_PTR(*ITEM_chunks(item)))
+#define TTL_next(ttl) ((struct _stritem *)ITEM_PTR((ttl)->next))
+#define TTL_pprev(ttl) ((ITEM_LINK(struct _stritem) *)ITEM_PTR((ttl)->pprev))
 
 #define STAT_KEY_LEN 128
 #define STAT_VAL_LEN 128
@@ -190,6 +270,30 @@ enum delta_result_type {
     OK, NON_NUMERIC, EOM
 };
 
+/** Which index assoc.c keeps items in; see -o hash_table */
+enum hash_table_type {
+    HASH_TABLE_CHAINED, HASH_TABLE_OPEN
+};
+
+/** What kind of pages a big allocation got; see large_pages_alloc() */
+enum large_pages_type {
+    LARGE_PAGES_OFF,        /* not asked for */
+    LARGE_PAGES_HUGETLB,    /* explicit huge pages */
+    LARGE_PAGES_THP,        /* transparent huge pages */
+    LARGE_PAGES_MEMCNTL,    /* Solaris large pages for the heap */
+    LARGE_PAGES_NONE        /* asked for, but only got normal pages */
+};
+
+/** How item memory is handed out; see -o allocator */
+enum allocator_type {
+    ALLOCATOR_SLAB, ALLOCATOR_LOG
+};
+
+/** Which function keys are hashed with; see -o hash_algorithm */
+enum hash_func_type {
+    JENKINS_HASH, MURMUR3_HASH, CRC32C_HASH
+};
+
 /** Time relative to server start. Smaller than time_t on 64-bit systems. */
 typedef unsigned int rel_time_t;
 
@@ -202,6 +306,13 @@ struct slab_stats {
     uint64_t  cas_badval;
     uint64_t  incr_hits;
     uint64_t  decr_hits;
+    uint64_t  compress_tries;     /* values of this class compressed */
+    uint64_t  compress_kept;      /* ... that moved to a smaller class */
+    uint64_t  compress_bytes_in;  /* value bytes of the ones kept */
+    uint64_t  compress_bytes_out; /* ... and what they were stored in */
+    uint64_t  compress_usec;      /* time spent compressing */
+    uint64_t  decompress_count;   /* compressed values of this class read */
+    uint64_t  decompress_usec;    /* time spent decompressing */
 };
 
 /**
@@ -221,6 +332,10 @@ struct thread_stats {
     uint64_t          conn_yields; /* # of yields for connections (-R option)*/
     uint64_t          auth_cmds;
     uint64_t          auth_errors;
+    uint64_t          get_hit_bytes;  /* value bytes served from the cache */
+    uint64_t          get_hit_cost;   /* sum of cost hints of the hits */
+    uint64_t          get_miss_bytes; /* value bytes refilled after a miss */
+    uint64_t          get_miss_cost;  /* sum of cost hints of the refills */
     struct slab_stats slab_stats[MAX_NUMBER_OF_SLAB_CLASSES];
 };
 
@@ -235,12 +350,14 @@ struct stats {
     unsigned int  curr_conns;
     unsigned int  total_conns;
     unsigned int  conn_structs;
+    uint64_t      conn_bytes;       /* connections and their buffers */
     uint64_t      get_cmds;
     uint64_t      set_cmds;
     uint64_t      get_hits;
     uint64_t      get_misses;
     uint64_t      evictions;
     uint64_t      reclaimed;
+    uint64_t      expired;          /* unlinked by the expiry thread */
     time_t        started;          /* when the process was started */
     bool          accepting_conns;  /* whether we are currently accepting */
     uint64_t      listen_disabled_num;
@@ -260,6 +377,8 @@ struct settings {
     char *inter;
     int verbose;
     rel_time_t oldest_live; /* ignore existing items older than this */
+    uint8_t flush_gen;      /* bumped by each immediate flush_all */
+    bool flush_gen_live;    /* oldest_live's items of flush_gen survive */
     int evict_to_free;
     char *socketpath;   /* path to unix socket if using local socket */
     int access;  /* access mask (a la chmod) for unix domain socket */
@@ -275,6 +394,30 @@ struct settings {
     int backlog;
     int item_size_max;        /* Maximum item size, and upper end for slabs */
     bool sasl;              /* SASL on/off */
+    bool gdsf;              /* evict by GreedyDual-Size-Frequency priority */
+    int ttl_evict_window;   /* prefer evicting items expiring this soon */
+    bool lru_crawler;       /* whether the LRU crawler thread is running */
+    int lru_crawler_sleep;  /* microseconds to sleep between crawler batches */
+    int lru_crawler_batch;  /* items to crawl per cache lock acquisition */
+    int slab_page_size;     /* size of a slab page */
+    int slab_chunk_size_max; /* largest slab chunk; bigger items are chunked */
+    bool slab_automove;     /* move slab pages between classes on its own */
+    int slab_automove_window; /* seconds between automove decisions */
+    enum hash_table_type hash_table; /* chained or open addressing index */
+    enum hash_func_type hash_algorithm; /* what keys are hashed with */
+    bool large_pages;       /* put slab memory in huge pages (-L) */
+    bool hash_large_pages;  /* put the hash table in huge pages too */
+    enum large_pages_type slab_pages; /* what slab memory got */
+    enum large_pages_type hash_pages; /* what the hash table got */
+    int prefault_threads;   /* threads faulting in slab memory at startup */
+    bool slab_release;      /* give empty slab pages back to the OS */
+    int slab_release_floor; /* megabytes of slab pages never given back */
+    bool total_memory;      /* -m limits all memory, not just slab pages */
+    bool slab_autotune;     /* switch to chunk sizes fitting the items seen */
+    unsigned int *slab_sizes; /* chunk sizes from -o slab_sizes, 0 ended */
+    int slab_autotune_window; /* seconds between autotune decisions */
+    enum allocator_type allocator; /* slab classes or a log of segments */
+    int compress_min;       /* LZ4 values at least this long, 0 for none */
 };
 
 extern struct stats stats;
@@ -286,29 +429,102 @@ extern struct settings settings;
 
 /* temp */
 #define ITEM_SLABBED 4
+#define ITEM_GDSF 8
+#define ITEM_TTL 16
+#define ITEM_CRAWLER 32
+#define ITEM_CHUNKED 64
+#define ITEM_CHUNK 128
+
+/* How the value of an item is stored, see item_raw_nbytes() */
+#define ITEM_RAW 0
+#define ITEM_LZ4 1
+
+/**
+ * GreedyDual-Size-Frequency state, present when it_flags & ITEM_GDSF.
+ */
+typedef struct {
+    double          priority;   /* H = L + freq * cost / size */
+    uint32_t        cost;       /* cost hint supplied at store time */
+    uint32_t        freq;       /* number of accesses since stored */
+} item_gdsf;
+
+/**
+ * Expiry index links, present when it_flags & ITEM_TTL (the item has an
+ * exptime). See item_ttl_link() in items.c. pprev points at the link that
+ * points at the item, which is always 8 byte aligned so compact items can
+ * refer to it by offset too.
+ */
+typedef struct {
+    ITEM_LINK(struct _stritem) next;
+    ITEM_LINK(ITEM_LINK(struct _stritem)) pprev; /* slot head or previous item's next */
+#ifdef ENABLE_COMPACT_ITEMS
+    rel_time_t      exptime;    /* expire time, kept out of the header */
+#endif
+} item_ttl;
 
 /**
  * Structure for storing items within memcached.
  */
 typedef struct _stritem {
-    struct _stritem *next;
-    struct _stritem *prev;
-    struct _stritem *h_next;    /* hash chain next */
-    rel_time_t      time;       /* least recent access */
-    rel_time_t      exptime;    /* expire time */
-    int             nbytes;     /* size of data */
+    ITEM_LINK(struct _stritem) next;
+    ITEM_LINK(struct _stritem) prev;
+    ITEM_LINK(struct _stritem) h_next;  /* hash chain next */
     unsigned short  refcount;
-    uint8_t         nsuffix;    /* length of flags-and-length string */
+#ifndef ENABLE_COMPACT_ITEMS
+    uint8_t         nsuffix;    /* bytes of client flags (0 or 4) */
+#endif
     uint8_t         it_flags;   /* ITEM_* above */
     uint8_t         slabs_clsid;/* which slab class we're in */
     uint8_t         nkey;       /* key length, w/terminating null and padding */
+#ifndef ENABLE_COMPACT_ITEMS
+    uint8_t         encoding;   /* ITEM_RAW or ITEM_LZ4 */
+#endif
+    uint8_t         flush_gen;  /* settings.flush_gen when linked */
+    rel_time_t      time;       /* least recent access */
+#ifdef ENABLE_COMPACT_ITEMS
+    /* item_size_max is at most 128MB, so the size fits in 28 bits */
+    unsigned int    nbytes:28;  /* size of data */
+    unsigned int    nsuffix:3;  /* bytes of client flags (0 or 4) */
+    unsigned int    encoding:1; /* ITEM_RAW or ITEM_LZ4 */
+#else
+    rel_time_t      exptime;    /* expire time; use ITEM_exptime() */
+    int             nbytes;     /* size of data */
+#endif
+    uint32_t        hv;         /* hash of the key */
     void * end[];
     /* if it_flags & ITEM_CAS we have 8 bytes CAS */
+    /* if it_flags & ITEM_GDSF we have an item_gdsf */
+    /* if it_flags & ITEM_TTL we have an item_ttl */
+    /* if it_flags & ITEM_CHUNKED we have a pointer to the first item_chunk */
+    /* then the client flags, if they aren't 0 */
     /* then null-terminated key */
-    /* then " flags length\r\n" (no terminating null) */
     /* then data with terminating \r\n (no terminating null; it's binary!) */
 } item;
 
+/**
+ * Part of the value of an item bigger than the largest slab class. The
+ * item itself takes a chunk of the largest class and holds the start of
+ * the value; the rest is in a list of these. They are laid out like the
+ * item header so the slab code can tell what state a chunk is in from
+ * it_flags and slabs_clsid.
+ */
+typedef struct _stritem_chunk {
+    ITEM_LINK(struct _stritem_chunk) next;  /* next piece of the value */
+    ITEM_LINK(struct _stritem_chunk) prev;  /* previous piece, or NULL */
+    ITEM_LINK(struct _stritem) head;        /* item the value belongs to */
+    unsigned short  refcount;     /* unused */
+#ifndef ENABLE_COMPACT_ITEMS
+    uint8_t         nsuffix;      /* unused */
+#endif
+    uint8_t         it_flags;     /* ITEM_CHUNK */
+    uint8_t         slabs_clsid;  /* which slab class we're in */
+    uint8_t         nkey;         /* unused */
+    int             offset;       /* where data[] starts in the value */
+    int             size;         /* bytes taken from the slab class */
+    int             nbytes;       /* bytes of the value held in data[] */
+    char            data[];
+} item_chunk;
+
 typedef struct {
     pthread_t thread_id;        /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
@@ -318,6 +534,8 @@ typedef struct {
     struct thread_stats stats;  /* Stats generated by this thread */
     struct conn_queue *new_conn_queue; /* queue of new connections to handle */
     cache_t *suffix_cache;      /* suffix cache */
+    char *lz4_buf;              /* scratch space for compressing values */
+    int lz4_size;
 } LIBEVENT_THREAD;
 
 typedef struct {
@@ -388,6 +606,10 @@ struct conn {
     char   **suffixcurr;
     int    suffixleft;
 
+    char   **unpacklist; /* values decompressed for the response being sent */
+    int    unpacksize;
+    int    unpackused;
+
     enum protocol protocol;   /* which protocol this connection speaks */
     enum network_transport transport; /* what transport is used by this connection */
 
@@ -397,6 +619,7 @@ struct conn {
     socklen_t request_addr_size;
     unsigned char *hdrbuf; /* udp packet headers */
     int    hdrsize;   /* number of headers' worth of space is allocated */
+    size_t mem_bytes; /* what this connection adds to stats.conn_bytes */
 
     bool   noreply;   /* True if the reply should not be sent. */
     /* current stats command */
@@ -440,6 +663,18 @@ extern int daemonize(int nochdir, int noclose);
 #include "hash.h"
 #include "util.h"
 
+/*
+ * Allocate size bytes of zeroed memory in huge pages if the OS can: first
+ * explicit ones (MAP_HUGETLB), which need pages reserved through
+ * /proc/sys/vm/nr_hugepages, then transparent ones (MADV_HUGEPAGE). Falls
+ * back to calloc. *how says which was used, and large_pages_free() needs
+ * it back along with the size. See util.c.
+ */
+void *large_pages_alloc(const size_t size, enum large_pages_type *how);
+void large_pages_free(void *ptr, const size_t size,
+                      const enum large_pages_type how);
+const char *large_pages_name(const enum large_pages_type how);
+
 /*
  * Functions such as the libevent-related calls that need to do cross-thread
  * communication in multithreaded mode (rather than actually doing the work
@@ -460,13 +695,17 @@ bool  conn_add_to_freelist(conn *c);
 int   is_listen_thread(void);
 item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes);
 char *item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
-void  item_flush_expired(void);
+void  item_flush_expired(const rel_time_t when);
 item *item_get(const char *key, const size_t nkey);
+void  item_get_many(const char **keys, const size_t *nkeys, item **its,
+                    const int n);
 int   item_link(item *it);
 void  item_remove(item *it);
 int   item_replace(item *it, item *new_it);
 void  item_stats(ADD_STAT add_stats, void *c);
 void  item_stats_sizes(ADD_STAT add_stats, void *c);
+void  item_stats_automove(unsigned int *evicted, unsigned int *ghost_hits,
+                          rel_time_t *age, double *priority);
 void  item_unlink(item *it);
 void  item_update(item *it);
 
@@ -475,6 +714,7 @@ void STATS_UNLOCK(void);
 void threadlocal_stats_reset(void);
 void threadlocal_stats_aggregate(struct thread_stats *stats);
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out);
+void threads_memory(size_t *thread_bytes, size_t *suffix_bytes);
 
 /* Stat processing functions */
 void append_stat(const char *name, ADD_STAT add_stats, conn *c,
@@ -495,3 +735,10 @@ extern void drop_privileges(void);
 
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
+
+/* If supported, start loading memory into the CPU cache before it's used. */
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 1))
+#define prefetch(addr)  __builtin_prefetch(addr)
+#else
+#define prefetch(addr)
+#endif
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * MurmurHash3 (x86, 32-bit result) by Austin Appleby, who placed it in the
+ * public domain: <https://github.com/aappleby/smhasher>
+ *
+ * Blocks are read in host byte order, so big-endian machines get different
+ * hashes. They're never stored or sent anywhere, so that doesn't matter.
+ */
+#include "memcached.h"
+
+#include <string.h>
+
+#define ROTL32(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+uint32_t murmur3_hash(const void *key, size_t length, const uint32_t initval) {
+    const uint8_t *data = key;
+    const size_t nblocks = length / 4;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h1 = initval;
+    uint32_t k1;
+    size_t i;
+
+    for (i = 0; i < nblocks; i++) {
+        memcpy(&k1, data + i * 4, 4);
+        k1 *= c1;
+        k1 = ROTL32(k1, 15);
+        k1 *= c2;
+
+        h1 ^= k1;
+        h1 = ROTL32(h1, 13);
+        h1 = h1 * 5 + 0xe6546b64;
+    }
+
+    data += nblocks * 4;
+    k1 = 0;
+    switch (length & 3) {
+    case 3:
+        k1 ^= data[2] << 16;
+        /* fall through */
+    case 2:
+        k1 ^= data[1] << 8;
+        /* fall through */
+    case 1:
+        k1 ^= data[0];
+        k1 *= c1;
+        k1 = ROTL32(k1, 15);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= (uint32_t)length;
+    return fmix32(h1);
+}
@@ -16,6 +16,8 @@ int main(int argc, char **argv) {
     display("Settings", sizeof(struct settings));
     display("Item (no cas)", sizeof(item));
     display("Item (cas)", sizeof(item) + sizeof(uint64_t));
+    display("Item link", sizeof(((item *)0)->next));
+    display("Item chunk", sizeof(item_chunk));
     display("Libevent thread",
             sizeof(LIBEVENT_THREAD) - sizeof(struct thread_stats));
     display("Connection", sizeof(conn));
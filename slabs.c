@@ -20,6 +20,9 @@
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 
 /* powers-of-N allocation structures */
 
@@ -52,16 +55,173 @@ static void *mem_base = NULL;
 static void *mem_current = NULL;
 static size_t mem_avail = 0;
 
+/*
+ * Pages of the preallocated chunk that were given back to the OS wait in
+ * released_pages until a class needs a new page, and read back as zeroes
+ * when it does. With -o slab_release every page comes out of that chunk, so
+ * a chunk's page is its offset from page_base over the page size. page_live
+ * counts the chunks handed out of each page; once it drops to zero the page
+ * can be given back.
+ */
+static char *page_base = NULL;
+static uint32_t *page_live = NULL;
+static void **released_pages = NULL;
+static unsigned int released_count = 0;
+static uint64_t slabs_released = 0;
+static size_t page_count = 0;   /* room in released_pages and page_live */
+
+/* Limit the preallocated chunk was sized for; cache_memlimit can't go over */
+static size_t mem_limit_max = 0;
+/* Set while freeing pages to fit a lowered limit. The first page of each
+ * class doesn't count against the limit, so being over it isn't enough. */
+static bool mem_shrinking = false;
+
+/*
+ * Class ids new items are sized into. Classes outside the range are left
+ * over from an earlier set of chunk sizes ("slabs autotune"): they keep the
+ * items they have, get no new ones, and give their pages up as the cache
+ * needs them. power_largest is the highest id in use by either.
+ */
+static int clsid_smallest = POWER_SMALLEST;
+static int clsid_largest;
+#define CLASS_RETIRED(id) ((id) < clsid_smallest || (id) > clsid_largest)
+
+/*
+ * Sizes of the items stored, to propose chunk sizes that fit them. Buckets
+ * are 8 bytes wide up to 256 bytes and 1/32 of a doubling above that. Each
+ * keeps the number of items in it and their total size, so rounding them
+ * all up to a chunk size wastes a known number of bytes. Everything is
+ * halved once in a while so the sizes seen lately count the most. Protected
+ * by the cache lock.
+ */
+#define SIZE_HIST_LINEAR 32
+#define SIZE_HIST_SUB 32
+#define SIZE_HIST_BUCKETS (SIZE_HIST_LINEAR + 18 * SIZE_HIST_SUB) /* to 64MB */
+#define SIZE_HIST_DECAY (1 << 20)
+
+struct size_hist {
+    uint64_t count[SIZE_HIST_BUCKETS];
+    uint64_t bytes[SIZE_HIST_BUCKETS];
+    uint64_t samples;
+};
+
+static struct size_hist size_hist;
+static uint64_t ladders_adopted = 0;
+/* New pages classes asked for and didn't get, since the last drain */
+static unsigned int pages_wanted = 0;
+/* Set while retired classes may still hold pages */
+static bool draining = false;
+
+/* Items to see before the proposed chunk sizes mean anything */
+#define LADDER_MIN_SAMPLES 1000
+
+/*
+ * With -o allocator=log items aren't sorted into classes. They are
+ * appended to the head segment (a slab page) at their own size, and a
+ * segment goes back to the free page list once everything in it has been
+ * freed. log_fill is how far each segment has been written, log_live how
+ * many of those bytes are still in use; a freed entry keeps its length in
+ * nbytes so the cleaner can step over it. Normal allocations leave
+ * LOG_RESERVE segments of the limit to the cleaner, so it always has
+ * somewhere to copy items to.
+ */
+static char *log_head = NULL;
+static size_t log_capacity = 0; /* segments the preallocated chunk holds */
+static uint32_t *log_fill = NULL;
+static uint32_t *log_live = NULL;
+/* Segment other than the head with the least in use, or LOG_NONE if that
+ * isn't known; only the head gets new items, so it stays so until freed */
+static size_t log_emptiest;
+#define LOG_NONE ((size_t)-1)
+static struct {
+    uint64_t cleaned;
+    uint64_t relocated;
+    uint64_t evicted;
+} log_stats;
+
+#define LOG_ALIGN(size) \
+    (((size) + CHUNK_ALIGN_BYTES - 1) & ~(size_t)(CHUNK_ALIGN_BYTES - 1))
+#define LOG_RESERVE 1
+/* Don't copy a segment out unless at least 1/LOG_CLEAN_DEAD of it is free */
+#define LOG_CLEAN_DEAD 8
+
+#define PAGE_INDEX(ptr) \
+    ((size_t)((char *)(ptr) - page_base) / (size_t)settings.slab_page_size)
+/* page_live value of a page on its way out */
+#define PAGE_RELEASING UINT32_MAX
+
+#ifdef ENABLE_COMPACT_ITEMS
+#ifdef USE_SYSTEM_MALLOC
+#error "Compact items need the slab allocator's arena"
+#endif
+
+/* Everything an item_ref can point to lives in here */
+char *item_arena = NULL;
+
+/*
+ * Room at the start of the arena for slabs_alloc_static(): mostly the
+ * expiry index heads (8 bytes each, 256 per slab class).
+ */
+#define ARENA_STATIC_BYTES (512 * 1024)
+static size_t arena_static_used = CHUNK_ALIGN_BYTES; /* offset 0 is NULL */
+#endif
+
 /**
  * Access to the slab allocator is protected by this lock
  */
 static pthread_mutex_t slabs_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * State of the page mover. A page being moved is referenced by the source
+ * class' "killing" field; its free chunks are kept off the free list until
+ * the move is done, and items in it are relocated within the class or
+ * evicted.
+ */
+struct slab_rebalance {
+    void *slab_start;
+    void *slab_end;
+    void *slab_pos;
+    int s_clsid;
+    int d_clsid;
+    int busy_items;
+    uint8_t done;
+};
+
+static struct slab_rebalance slab_rebal;
+/* 0: idle, 1: move requested, 2: moving */
+static volatile int slab_rebalance_signal;
+
+/* Page mover totals, for "stats slabs" */
+static struct {
+    uint64_t slabs_moved;
+    uint64_t rescues;
+    uint64_t evictions;
+    uint64_t busy_passes;
+    uint64_t automoves;
+    uint64_t shrunk;
+    uint64_t drained;
+} slab_rebal_stats;
+
+/* Number of chunks examined per cache lock acquisition while moving */
+#define DEFAULT_SLAB_BULK_CHECK 1
+static int slab_bulk_check = DEFAULT_SLAB_BULK_CHECK;
+
 /*
  * Forward Declarations
  */
 static int do_slabs_newslab(const unsigned int id);
 static void *memory_allocate(size_t size);
+static void *do_slabs_alloc(const size_t size, unsigned int id, const int flags);
+
+static void slabs_prefault(char *start, const size_t len, int nthreads);
+static void slabs_pages_init(void);
+static bool page_release(char *page);
+static void slab_shrink_start(void);
+static void slab_shrink_check(void);
+static void slabs_ladder_stats(ADD_STAT add_stats, void *c);
+static void slabs_log_init(void);
+static void *do_log_alloc(const size_t size, const int flags);
+static void do_log_free(void *ptr, const size_t size);
 
 #ifndef DONT_PREALLOC_SLABS
 /* Preallocate as many slab pages as possible (called from slabs_init)
@@ -75,26 +235,32 @@ static void slabs_preallocate (const unsigned int maxslabs);
 
 /*
  * Figures out which slab class (chunk size) is required to store an item of
- * a given size.
+ * a given size: the smallest current class big enough, found by a binary
+ * search since chunk sizes go up with the class id.
  *
  * Given object size, return id to use when allocating/freeing memory for object
  * 0 means error: can't store such a large object
  */
 
 unsigned int slabs_clsid(const size_t size) {
-    int res = POWER_SMALLEST;
-
-    if (size == 0)
-        return 0;
-    while (size > slabclass[res].size)
-        if (res++ == power_largest)     /* won't fit in the biggest slab */
-            return 0;
-    return res;
+    int lo = clsid_smallest, hi = clsid_largest;
+
+    if (size == 0 || size > slabclass[hi].size)
+        return 0;   /* won't fit in the biggest slab */
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (slabclass[mid].size < size)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 /**
  * Determines the chunk sizes and initializes the slab class descriptors
- * accordingly.
+ * accordingly. They come from -o slab_sizes if it was given, and grow by the
+ * factor otherwise; the last class is always the largest chunk size.
  */
 void slabs_init(const size_t limit, const double factor, const bool prealloc) {
     int i = POWER_SMALLEST - 1;
@@ -102,9 +268,13 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
 
     mem_limit = limit;
 
+#ifndef ENABLE_COMPACT_ITEMS
     if (prealloc) {
-        /* Allocate everything in a big chunk with malloc */
-        mem_base = malloc(mem_limit);
+        /* Allocate everything in a big chunk, in huge pages with -L */
+        if (settings.large_pages)
+            mem_base = large_pages_alloc(mem_limit, &settings.slab_pages);
+        else
+            mem_base = calloc(mem_limit, 1);
         if (mem_base != NULL) {
             mem_current = mem_base;
             mem_avail = mem_limit;
@@ -113,16 +283,29 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
                     " one large chunk.\nWill allocate in smaller chunks\n");
         }
     }
+#endif
 
     memset(slabclass, 0, sizeof(slabclass));
 
-    while (++i < POWER_LARGEST && size <= settings.item_size_max / factor) {
+    /* The log has one class; it doesn't round sizes up, and only needs to
+     * know which items have to be chunked */
+    if (settings.allocator == ALLOCATOR_LOG)
+        i = POWER_SMALLEST;
+    else while (++i < POWER_LARGEST) {
+        if (settings.slab_sizes != NULL) {
+            if (settings.slab_sizes[i - POWER_SMALLEST] == 0)
+                break;
+            size = settings.slab_sizes[i - POWER_SMALLEST];
+        } else if (size > settings.slab_chunk_size_max / factor) {
+            break;
+        }
+
         /* Make sure items are always n-byte aligned */
         if (size % CHUNK_ALIGN_BYTES)
             size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
 
         slabclass[i].size = size;
-        slabclass[i].perslab = settings.item_size_max / slabclass[i].size;
+        slabclass[i].perslab = settings.slab_page_size / slabclass[i].size;
         size *= factor;
         if (settings.verbose > 1) {
             fprintf(stderr, "slab class %3d: chunk size %9u perslab %7u\n",
@@ -131,13 +314,49 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
     }
 
     power_largest = i;
-    slabclass[power_largest].size = settings.item_size_max;
-    slabclass[power_largest].perslab = 1;
+    clsid_largest = i;
+    slabclass[power_largest].size = settings.slab_chunk_size_max;
+    slabclass[power_largest].perslab =
+        settings.slab_page_size / settings.slab_chunk_size_max;
     if (settings.verbose > 1) {
         fprintf(stderr, "slab class %3d: chunk size %9u perslab %7u\n",
                 i, slabclass[i].size, slabclass[i].perslab);
     }
 
+#ifdef ENABLE_COMPACT_ITEMS
+    /* Items link to each other by their offset in one arena, so it is
+     * always preallocated. It has room for the first page of every class
+     * on top of the limit, since those are handed out regardless. */
+    {
+        size_t arena_size = ARENA_STATIC_BYTES + mem_limit +
+            (size_t)settings.slab_page_size * power_largest;
+        if (arena_size > ITEM_ARENA_MAX) {
+            fprintf(stderr, "Compact items can't address more than %lu MB"
+                    " of memory\n", (unsigned long)(ITEM_ARENA_MAX >> 20));
+            exit(EXIT_FAILURE);
+        }
+        if (settings.large_pages)
+            item_arena = large_pages_alloc(arena_size, &settings.slab_pages);
+        else
+            item_arena = calloc(arena_size, 1);
+        if (item_arena == NULL) {
+            fprintf(stderr, "Failed to allocate the item arena.\n");
+            exit(EXIT_FAILURE);
+        }
+        mem_base = item_arena;
+        mem_current = item_arena + ARENA_STATIC_BYTES;
+        mem_avail = arena_size - ARENA_STATIC_BYTES;
+    }
+#endif
+
+    if (mem_base != NULL || settings.slab_release)
+        slabs_pages_init();
+    if (settings.allocator == ALLOCATOR_LOG)
+        slabs_log_init();
+
+    if (settings.prefault_threads > 0 && mem_base != NULL)
+        slabs_prefault(mem_current, mem_avail, settings.prefault_threads);
+
     /* for the test suite:  faking of how much we've already malloc'd */
     {
         char *t_initial_malloc = getenv("T_MEMD_INITIAL_MALLOC");
@@ -151,7 +370,8 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
     {
         char *pre_alloc = getenv("T_MEMD_SLABS_ALLOC");
 
-        if (pre_alloc == NULL || atoi(pre_alloc) != 0) {
+        if ((pre_alloc == NULL || atoi(pre_alloc) != 0) &&
+            settings.allocator == ALLOCATOR_SLAB) {
             slabs_preallocate(power_largest);
         }
     }
@@ -178,6 +398,139 @@ static void slabs_preallocate (const unsigned int maxslabs) {
 }
 #endif
 
+/*
+ * With -o prefault the preallocated memory is faulted in by several threads
+ * at startup, rather than a page at a time by the sets that first use it.
+ * Each thread writes to every page of its share, which faults in more
+ * threads at once than mlock() does, and then locks it in memory if it's
+ * allowed to.
+ */
+typedef struct {
+    char *start;
+    size_t len;
+    bool locked;
+} prefault_range;
+
+static void *prefault_thread(void *arg) {
+    prefault_range *r = arg;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t off;
+
+    for (off = 0; off < r->len; off += page)
+        r->start[off] = 0;
+    r->locked = mlock(r->start, r->len) == 0;
+    return NULL;
+}
+
+static void slabs_prefault(char *start, const size_t len, int nthreads) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t share = (len / nthreads + page - 1) / page * page;
+    prefault_range *ranges = calloc(nthreads, sizeof(prefault_range));
+    pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+    struct timeval begin, end;
+    int locked = 0;
+    int i;
+
+    if (ranges == NULL || tids == NULL) {
+        fprintf(stderr, "Can't prefault slab memory: out of memory\n");
+        free(ranges);
+        free(tids);
+        return;
+    }
+    gettimeofday(&begin, NULL);
+    for (i = 0; i < nthreads; i++) {
+        ranges[i].start = start + share * i;
+        ranges[i].len = share * i >= len ? 0 :
+            (share * (i + 1) > len ? len - share * i : share);
+        if (pthread_create(&tids[i], NULL, prefault_thread, &ranges[i]) != 0) {
+            /* Do this share here */
+            prefault_thread(&ranges[i]);
+            tids[i] = pthread_self();
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        if (!pthread_equal(tids[i], pthread_self()))
+            pthread_join(tids[i], NULL);
+        if (ranges[i].locked)
+            locked++;
+    }
+    gettimeofday(&end, NULL);
+
+    fprintf(stderr, "Prefaulted %lu MB of slab memory with %d threads in "
+            "%.3f seconds (%s)\n", (unsigned long)(len >> 20), nthreads,
+            (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) / 1e6,
+            locked == nthreads ? "locked" :
+            locked == 0 ? "not locked" : "partly locked");
+    free(ranges);
+    free(tids);
+}
+
+/*
+ * Sets up the list of released pages of the preallocated chunk, and the
+ * page counters for -o slab_release. Pages start on an OS page boundary so
+ * that all of a page can be given back.
+ */
+static void slabs_pages_init(void) {
+    const size_t os_page = sysconf(_SC_PAGESIZE);
+    size_t skip, npages;
+
+    if (mem_base == NULL) {
+        fprintf(stderr, "Warning: slab pages can only be released from "
+                "preallocated memory; not releasing any\n");
+        settings.slab_release = false;
+        return;
+    }
+
+    skip = (os_page - (uintptr_t)mem_current % os_page) % os_page;
+    if (skip > mem_avail)
+        skip = mem_avail;
+    mem_current = (char *)mem_current + skip;
+    mem_avail -= skip;
+
+    npages = mem_avail / settings.slab_page_size + 1;
+    released_pages = calloc(npages, sizeof(void *));
+    if (settings.slab_release)
+        page_live = calloc(npages, sizeof(uint32_t));
+    if (released_pages == NULL || (settings.slab_release && page_live == NULL)) {
+        fprintf(stderr, "Warning: out of memory for slab page counters; "
+                "not releasing any pages\n");
+        free(page_live);
+        free(released_pages);
+        page_live = NULL;
+        released_pages = NULL;
+        settings.slab_release = false;
+        return;
+    }
+    page_base = mem_current;
+    page_count = npages;
+    mem_limit_max = mem_limit;
+}
+
+/*
+ * Hands a page that is no longer in use back to the OS, leaving it zeroed.
+ * Only whole OS pages can go; anything around them is cleared. Returns
+ * false if the OS wouldn't take it, in which case it is only cleared.
+ */
+static bool page_release(char *page) {
+    const uintptr_t os_page = sysconf(_SC_PAGESIZE);
+    const size_t len = settings.slab_page_size;
+    char *end = page + len;
+    char *first = (char *)(((uintptr_t)page + os_page - 1) & ~(os_page - 1));
+    char *last = (char *)((uintptr_t)end & ~(os_page - 1));
+
+    if (first >= last) {
+        memset(page, 0, len);
+        return true;
+    }
+    memset(page, 0, first - page);
+    memset(last, 0, end - last);
+    if (madvise(first, last - first, MADV_DONTNEED) != 0) {
+        memset(first, 0, last - first);
+        return false;
+    }
+    return true;
+}
+
 static int grow_slab_list (const unsigned int id) {
     slabclass_t *p = &slabclass[id];
     if (p->slabs == p->list_size) {
@@ -192,18 +545,26 @@ static int grow_slab_list (const unsigned int id) {
 
 static int do_slabs_newslab(const unsigned int id) {
     slabclass_t *p = &slabclass[id];
-    int len = p->size * p->perslab;
+    /* Every page is the same size so it can be handed to any class */
+    int len = settings.slab_page_size;
     char *ptr;
 
     if ((mem_limit && mem_malloced + len > mem_limit && p->slabs > 0) ||
         (grow_slab_list(id) == 0) ||
-        ((ptr = memory_allocate((size_t)len)) == 0)) {
+        ((ptr = released_count > 0 ? released_pages[--released_count] :
+                memory_allocate((size_t)len)) == 0)) {
 
         MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
+        pages_wanted++;
+        /* Don't wait for the maintenance thread to free one up */
+        if (draining)
+            slab_shrink_start();
         return 0;
     }
 
-    memset(ptr, 0, (size_t)len);
+    /* memory_allocate() hands out zeroed memory; as fresh pages from the
+     * OS it's zero already, and clearing it again would fault it all in.
+     * Released pages are zero again too. */
     p->end_page_ptr = ptr;
     p->end_page_free = p->perslab;
 
@@ -215,7 +576,7 @@ static int do_slabs_newslab(const unsigned int id) {
 }
 
 /*@null@*/
-static void *do_slabs_alloc(const size_t size, unsigned int id) {
+static void *do_slabs_alloc(const size_t size, unsigned int id, const int flags) {
     slabclass_t *p;
     void *ret = NULL;
 
@@ -238,10 +599,21 @@ static void *do_slabs_alloc(const size_t size, unsigned int id) {
     return ret;
 #endif
 
+    if (settings.allocator == ALLOCATOR_LOG) {
+        if ((ret = do_log_alloc(size, flags)) != NULL) {
+            p->requested += size;
+            MEMCACHED_SLABS_ALLOCATE(size, id, LOG_ALIGN(size), ret);
+        } else {
+            MEMCACHED_SLABS_ALLOCATE_FAILED(size, id);
+        }
+        return ret;
+    }
+
     /* fail unless we have space at the end of a recently allocated page,
        we have something on our freelist, or we could allocate a new page */
     if (! (p->end_page_ptr != 0 || p->sl_curr != 0 ||
-           do_slabs_newslab(id) != 0)) {
+           ((flags & SLABS_ALLOC_NO_NEWPAGE) == 0 &&
+            do_slabs_newslab(id) != 0))) {
         /* We don't have more memory available */
         ret = NULL;
     } else if (p->sl_curr != 0) {
@@ -259,6 +631,8 @@ static void *do_slabs_alloc(const size_t size, unsigned int id) {
     }
 
     if (ret) {
+        if (page_live != NULL)
+            page_live[PAGE_INDEX(ret)]++;
         p->requested += size;
         MEMCACHED_SLABS_ALLOCATE(size, id, p->size, ret);
     } else {
@@ -285,6 +659,22 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     return;
 #endif
 
+    if (settings.allocator == ALLOCATOR_LOG) {
+        do_log_free(ptr, size);
+        p->requested -= size;
+        return;
+    }
+
+    if (page_live != NULL)
+        page_live[PAGE_INDEX(ptr)]--;
+
+    /* Chunks of a page being moved stay off the free list */
+    if (p->killing && ptr >= slab_rebal.slab_start && ptr < slab_rebal.slab_end) {
+        ((item *)ptr)->it_flags |= ITEM_SLABBED;
+        p->requested -= size;
+        return;
+    }
+
     if (p->sl_curr == p->sl_total) { /* need more space on the free list */
         int new_size = (p->sl_total != 0) ? p->sl_total * 2 : 16;  /* 16 is arbitrary */
         void **new_slots = realloc(p->slots, new_size * sizeof(void *));
@@ -298,6 +688,194 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     return;
 }
 
+/* Segments the log may have, within the limit and the preallocated chunk */
+static size_t log_segments_max(void) {
+    const size_t limit = mem_limit / settings.slab_page_size;
+
+    return mem_limit && limit < log_capacity ? limit : log_capacity;
+}
+
+/* Sets up the segment counters for -o allocator=log */
+static void slabs_log_init(void) {
+    if (page_base == NULL) {
+        fprintf(stderr, "allocator=log needs all memory allocated at startup;"
+                " failed to allocate it\n");
+        exit(EXIT_FAILURE);
+    }
+    log_fill = calloc(page_count, sizeof(uint32_t));
+    log_live = calloc(page_count, sizeof(uint32_t));
+    if (log_fill == NULL || log_live == NULL) {
+        fprintf(stderr, "Failed to allocate the log segment counters\n");
+        exit(EXIT_FAILURE);
+    }
+    log_capacity = mem_avail / settings.slab_page_size;
+    log_emptiest = LOG_NONE;
+    if (log_segments_max() < LOG_RESERVE + 2) {
+        fprintf(stderr, "allocator=log needs room for at least %d slab "
+                "pages\n", LOG_RESERVE + 2);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Notes that segment i, not the head, has less in use than it had */
+static void log_note_live(const size_t i) {
+    if (log_emptiest != LOG_NONE && log_live[i] < log_live[log_emptiest])
+        log_emptiest = i;
+}
+
+/* Puts a segment nothing lives in any more back on the free page list */
+static void log_free_segment(char *seg) {
+    const size_t i = PAGE_INDEX(seg);
+
+    assert(log_live[i] == 0 && seg != log_head);
+    if (log_emptiest == i)
+        log_emptiest = LOG_NONE;
+    log_fill[i] = 0;
+    released_pages[released_count++] = seg;
+    mem_malloced -= settings.slab_page_size;
+}
+
+/*
+ * Appends size bytes to the head segment, starting a new head when it's
+ * full. A head left with nothing live in it is freed right away.
+ */
+static void *do_log_alloc(const size_t size, const int flags) {
+    const size_t seg_size = settings.slab_page_size;
+    const size_t len = LOG_ALIGN(size);
+    const size_t reserve = (flags & SLABS_ALLOC_CLEANER) ? 0 : LOG_RESERVE;
+    char *ret;
+    size_t i;
+
+    if (len > seg_size)
+        return NULL;
+
+    if (log_head == NULL || log_fill[PAGE_INDEX(log_head)] + len > seg_size) {
+        char *old = log_head;
+
+        if (flags & SLABS_ALLOC_NO_NEWPAGE)
+            return NULL;
+        if (mem_malloced / seg_size + reserve + 1 > log_segments_max())
+            return NULL;
+        ret = released_count > 0 ? released_pages[--released_count] :
+            memory_allocate(seg_size);
+        if (ret == NULL)
+            return NULL;
+        mem_malloced += seg_size;
+        log_head = ret;
+        if (old != NULL && log_live[PAGE_INDEX(old)] == 0)
+            log_free_segment(old);
+        else if (old != NULL)
+            log_note_live(PAGE_INDEX(old));
+    }
+
+    i = PAGE_INDEX(log_head);
+    ret = log_head + log_fill[i];
+    log_fill[i] += len;
+    log_live[i] += len;
+    /* A reused segment still has old items in it; a chunk fresh off a free
+     * list or a new page has no class yet */
+    ((item *)ret)->slabs_clsid = 0;
+    return ret;
+}
+
+static void do_log_free(void *ptr, const size_t size) {
+    const size_t len = LOG_ALIGN(size);
+    const size_t i = PAGE_INDEX(ptr);
+    char *seg = page_base + i * settings.slab_page_size;
+
+    assert(log_live[i] >= len);
+    ((item *)ptr)->nbytes = len;
+    log_live[i] -= len;
+    if (seg == log_head)
+        return;
+    if (log_live[i] == 0)
+        log_free_segment(seg);
+    else
+        log_note_live(i);
+}
+
+uint32_t slabs_log_live(const void *ptr) {
+    /* Only changes under the cache lock, which callers hold */
+    return log_live[PAGE_INDEX(ptr)];
+}
+
+/* Length of the log entry at it: an item, a value chunk, or a freed one */
+static size_t log_entry_len(item *it) {
+    if (it->it_flags & ITEM_SLABBED)
+        return it->nbytes;
+    if (it->it_flags & ITEM_CHUNK)
+        return LOG_ALIGN(((item_chunk *)it)->size);
+    if (it->it_flags & ITEM_CHUNKED)
+        return LOG_ALIGN(settings.slab_chunk_size_max);
+    return LOG_ALIGN(ITEM_ntotal(it));
+}
+
+/*
+ * Copies the live items out of the segment with the least in use, so it can
+ * be freed. Only cleans a segment with at least need bytes of dead space,
+ * and, unless any is set, with at least 1/LOG_CLEAN_DEAD of it dead; copying
+ * a nearly full one gains little for a lot of work. Items in pieces and
+ * items there's no room for are evicted instead, and items someone is using
+ * are left; the segment is freed when they are. Everything that frees log
+ * memory holds the cache lock, which the caller holds, so the counters
+ * don't change under us except through what we do here. Returns true if the
+ * segment was freed.
+ */
+bool slabs_log_clean(const size_t need, const bool any) {
+    const size_t seg_size = settings.slab_page_size;
+    size_t i, victim, fill, off, len;
+    char *seg;
+
+    pthread_mutex_lock(&slabs_lock);
+    if (log_emptiest == LOG_NONE) {
+        for (i = 0; i < page_count; i++) {
+            if (log_fill[i] == 0 || page_base + i * seg_size == log_head)
+                continue;
+            if (log_emptiest == LOG_NONE || log_live[i] < log_live[log_emptiest])
+                log_emptiest = i;
+        }
+    }
+    victim = log_emptiest;
+    pthread_mutex_unlock(&slabs_lock);
+    if (victim == LOG_NONE || seg_size - log_live[victim] < need ||
+        (!any && seg_size - log_live[victim] < seg_size / LOG_CLEAN_DEAD))
+        return false;
+
+    seg = page_base + victim * seg_size;
+    fill = log_fill[victim];
+    for (off = 0; off < fill && log_live[victim] != 0; off += len) {
+        item *it = (item *)(seg + off);
+        item *head = it;
+
+        len = log_entry_len(it);
+        if (it->it_flags & ITEM_SLABBED)
+            continue;
+        if (it->it_flags & ITEM_CHUNK)
+            head = CHUNK_head((item_chunk *)it);
+        if ((head->it_flags & ITEM_LINKED) == 0 || head->refcount != 0)
+            continue;
+
+        if (head == it && (it->it_flags & ITEM_CHUNKED) == 0) {
+            item *new_it = slabs_alloc(ITEM_ntotal(it), it->slabs_clsid,
+                                       SLABS_ALLOC_CLEANER);
+            if (new_it != NULL) {
+                do_item_relocate(it, new_it);
+                log_stats.relocated++;
+                continue;
+            }
+        }
+        do_item_unlink(head);
+        log_stats.evicted++;
+    }
+
+    if (log_live[victim] != 0)
+        return false;
+    pthread_mutex_lock(&slabs_lock);
+    log_stats.cleaned++;
+    pthread_mutex_unlock(&slabs_lock);
+    return true;
+}
+
 static int nz_strcmp(int nzlength, const char *nz, const char *z) {
     int zlength=strlen(z);
     return (zlength == nzlength) && (strncmp(nz, z, zlength) == 0) ? 0 : -1;
@@ -317,6 +895,8 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
                         (unsigned long long)stats.evictions);
             APPEND_STAT("reclaimed", "%llu",
                         (unsigned long long)stats.reclaimed);
+            APPEND_STAT("expired", "%llu",
+                        (unsigned long long)stats.expired);
             STATS_UNLOCK();
         } else if (nz_strcmp(nkey, stat_type, "items") == 0) {
             item_stats(add_stats, c);
@@ -324,6 +904,8 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
             slabs_stats(add_stats, c);
         } else if (nz_strcmp(nkey, stat_type, "sizes") == 0) {
             item_stats_sizes(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "ladder") == 0) {
+            slabs_ladder_stats(add_stats, c);
         } else {
             ret = false;
         }
@@ -337,6 +919,7 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
 /*@null@*/
 static void do_slabs_stats(ADD_STAT add_stats, void *c) {
     int i, total;
+    uint64_t requested = 0, page_slack = 0;
     /* Get the per-thread stats which contain some interesting aggregates */
     struct thread_stats thread_stats;
     threadlocal_stats_aggregate(&thread_stats);
@@ -344,10 +927,16 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
     total = 0;
     for(i = POWER_SMALLEST; i <= power_largest; i++) {
         slabclass_t *p = &slabclass[i];
-        if (p->slabs != 0) {
+        const struct slab_stats *s = &thread_stats.slab_stats[i];
+        /* Values may all have been compressed into smaller classes */
+        if (p->slabs != 0 || s->compress_tries != 0) {
             uint32_t perslab, slabs;
             slabs = p->slabs;
             perslab = p->perslab;
+            requested += p->requested;
+            /* Space at the end of each page too small for another chunk */
+            page_slack += (uint64_t)slabs *
+                (settings.slab_page_size - perslab * p->size);
 
             char key_str[STAT_KEY_LEN];
             char val_str[STAT_VAL_LEN];
@@ -377,6 +966,22 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
                     (unsigned long long)thread_stats.slab_stats[i].cas_hits);
             APPEND_NUM_STAT(i, "cas_badval", "%llu",
                     (unsigned long long)thread_stats.slab_stats[i].cas_badval);
+            if (settings.compress_min > 0) {
+                APPEND_NUM_STAT(i, "compress_tries", "%llu",
+                                (unsigned long long)s->compress_tries);
+                APPEND_NUM_STAT(i, "compress_kept", "%llu",
+                                (unsigned long long)s->compress_kept);
+                APPEND_NUM_STAT(i, "compress_bytes_in", "%llu",
+                                (unsigned long long)s->compress_bytes_in);
+                APPEND_NUM_STAT(i, "compress_bytes_out", "%llu",
+                                (unsigned long long)s->compress_bytes_out);
+                APPEND_NUM_STAT(i, "compress_usec", "%llu",
+                                (unsigned long long)s->compress_usec);
+                APPEND_NUM_STAT(i, "decompress_count", "%llu",
+                                (unsigned long long)s->decompress_count);
+                APPEND_NUM_STAT(i, "decompress_usec", "%llu",
+                                (unsigned long long)s->decompress_usec);
+            }
 
             total++;
         }
@@ -385,7 +990,65 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
     /* add overall slab stats and append terminator */
 
     APPEND_STAT("active_slabs", "%d", total);
+    APPEND_STAT("slab_classes", "%d", clsid_largest - clsid_smallest + 1);
     APPEND_STAT("total_malloced", "%llu", (unsigned long long)mem_malloced);
+    APPEND_STAT("total_mem_requested", "%llu", (unsigned long long)requested);
+    APPEND_STAT("total_page_slack", "%llu", (unsigned long long)page_slack);
+    APPEND_STAT("slab_reassign_running", "%u",
+                slab_rebalance_signal != 0 ? 1 : 0);
+    if (slab_rebalance_signal == 2) {
+        APPEND_STAT("slab_reassign_src", "%d", slab_rebal.s_clsid);
+        APPEND_STAT("slab_reassign_dst", "%d", slab_rebal.d_clsid);
+        APPEND_STAT("slab_reassign_progress", "%lu",
+                    (unsigned long)((char *)slab_rebal.slab_pos -
+                                    (char *)slab_rebal.slab_start));
+        APPEND_STAT("slab_reassign_busy_items", "%d", slab_rebal.busy_items);
+    }
+    APPEND_STAT("slabs_moved", "%llu",
+                (unsigned long long)slab_rebal_stats.slabs_moved);
+    APPEND_STAT("slab_reassign_rescues", "%llu",
+                (unsigned long long)slab_rebal_stats.rescues);
+    APPEND_STAT("slab_reassign_evictions", "%llu",
+                (unsigned long long)slab_rebal_stats.evictions);
+    APPEND_STAT("slab_reassign_busy_passes", "%llu",
+                (unsigned long long)slab_rebal_stats.busy_passes);
+    APPEND_STAT("slabs_automoved", "%llu",
+                (unsigned long long)slab_rebal_stats.automoves);
+    APPEND_STAT("slabs_shrunk", "%llu",
+                (unsigned long long)slab_rebal_stats.shrunk);
+    APPEND_STAT("slabs_drained", "%llu",
+                (unsigned long long)slab_rebal_stats.drained);
+    APPEND_STAT("shrink_remaining", "%llu",
+                (unsigned long long)(mem_shrinking && mem_malloced > mem_limit ?
+                                     mem_malloced - mem_limit : 0));
+    if (page_live != NULL) {
+        unsigned int resident = 0;
+        for (i = POWER_SMALLEST; i <= power_largest; i++)
+            resident += slabclass[i].slabs;
+        APPEND_STAT("resident_pages", "%u", resident);
+        APPEND_STAT("released_pages", "%u", released_count);
+        APPEND_STAT("slabs_released", "%llu",
+                    (unsigned long long)slabs_released);
+    }
+    if (settings.allocator == ALLOCATOR_LOG) {
+        unsigned int segments = 0;
+        uint64_t live = 0;
+        size_t n;
+        for (n = 0; n < page_count; n++) {
+            if (log_fill[n] != 0) {
+                segments++;
+                live += log_live[n];
+            }
+        }
+        APPEND_STAT("log_segments", "%u", segments);
+        APPEND_STAT("log_live_bytes", "%llu", (unsigned long long)live);
+        APPEND_STAT("log_segments_cleaned", "%llu",
+                    (unsigned long long)log_stats.cleaned);
+        APPEND_STAT("log_items_relocated", "%llu",
+                    (unsigned long long)log_stats.relocated);
+        APPEND_STAT("log_items_evicted", "%llu",
+                    (unsigned long long)log_stats.evicted);
+    }
     add_stats(NULL, 0, NULL, 0, c);
 }
 
@@ -394,7 +1057,7 @@ static void *memory_allocate(size_t size) {
 
     if (mem_base == NULL) {
         /* We are not using a preallocated large memory chunk */
-        ret = malloc(size);
+        ret = calloc(size, 1);
     } else {
         ret = mem_current;
 
@@ -418,11 +1081,35 @@ static void *memory_allocate(size_t size) {
     return ret;
 }
 
-void *slabs_alloc(size_t size, unsigned int id) {
+/*
+ * Memory for the odd structure that isn't a slab chunk but gets linked in
+ * with items (the LRU crawler's placeholders, the expiry index heads). With
+ * compact items it has to be in the item arena. It is never freed.
+ */
+void *slabs_alloc_static(size_t size) {
+#ifdef ENABLE_COMPACT_ITEMS
+    void *ret = NULL;
+
+    if (size % CHUNK_ALIGN_BYTES)
+        size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+    pthread_mutex_lock(&slabs_lock);
+    if (arena_static_used + size <= ARENA_STATIC_BYTES) {
+        ret = item_arena + arena_static_used;
+        arena_static_used += size;
+        memset(ret, 0, size);
+    }
+    pthread_mutex_unlock(&slabs_lock);
+    return ret;
+#else
+    return calloc(1, size);
+#endif
+}
+
+void *slabs_alloc(size_t size, unsigned int id, const int flags) {
     void *ret;
 
     pthread_mutex_lock(&slabs_lock);
-    ret = do_slabs_alloc(size, id);
+    ret = do_slabs_alloc(size, id, flags);
     pthread_mutex_unlock(&slabs_lock);
     return ret;
 }
@@ -438,3 +1125,1032 @@ void slabs_stats(ADD_STAT add_stats, void *c) {
     do_slabs_stats(add_stats, c);
     pthread_mutex_unlock(&slabs_lock);
 }
+
+void slabs_memory(size_t *pages, size_t *metadata, size_t *limit) {
+    size_t lists = 0;
+    int i;
+
+    pthread_mutex_lock(&slabs_lock);
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        lists += (size_t)(slabclass[i].list_size + slabclass[i].sl_total) *
+            sizeof(void *);
+    }
+    /* The released page list and the page counters */
+    if (released_pages != NULL)
+        lists += page_count * sizeof(void *);
+    if (page_live != NULL)
+        lists += page_count * sizeof(uint32_t);
+    if (log_fill != NULL)
+        lists += 2 * page_count * sizeof(uint32_t);
+    *pages = mem_malloced;
+    *metadata = lists;
+    *limit = mem_limit;
+    pthread_mutex_unlock(&slabs_lock);
+}
+
+static pthread_cond_t slab_rebalance_cond = PTHREAD_COND_INITIALIZER;
+static volatile int do_run_slab_rebalance_thread = 1;
+static volatile int do_run_slab_thread = 1;
+static pthread_mutex_t slabs_rebalance_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t rebalance_tid;
+static pthread_t maintenance_tid;
+
+/* Hands the chunks of a (zeroed) page to the free list of a class. */
+static void split_slab_page_into_freelist(char *ptr, const unsigned int id) {
+    slabclass_t *p = &slabclass[id];
+    int x;
+
+    /* Each do_slabs_free() below takes one off */
+    if (page_live != NULL)
+        page_live[PAGE_INDEX(ptr)] = p->perslab;
+
+    for (x = 0; x < p->perslab; x++) {
+        do_slabs_free(ptr, 0, id);
+        ptr += p->size;
+    }
+}
+
+/*
+ * Picks the page to move and takes its free chunks off the source class'
+ * free list, so nothing new gets stored in it.
+ */
+static int slab_rebalance_start(void) {
+    slabclass_t *s_cls;
+    unsigned int i, kept;
+
+    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&slabs_lock);
+
+    if (slab_rebal.s_clsid < POWER_SMALLEST ||
+        slab_rebal.s_clsid > power_largest ||
+        (slab_rebal.d_clsid != SLAB_SHRINK &&
+         (slab_rebal.d_clsid < POWER_SMALLEST ||
+          slab_rebal.d_clsid > power_largest ||
+          CLASS_RETIRED(slab_rebal.d_clsid))) ||
+        slab_rebal.s_clsid == slab_rebal.d_clsid ||
+        slabclass[slab_rebal.s_clsid].slabs <
+            (CLASS_RETIRED(slab_rebal.s_clsid) ? 1 : 2)) {
+        pthread_mutex_unlock(&slabs_lock);
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+
+    s_cls = &slabclass[slab_rebal.s_clsid];
+    s_cls->killing = 1;
+
+    slab_rebal.slab_start = s_cls->slab_list[s_cls->killing - 1];
+    slab_rebal.slab_end = (char *)slab_rebal.slab_start +
+        (s_cls->size * s_cls->perslab);
+    slab_rebal.slab_pos = slab_rebal.slab_start;
+    slab_rebal.busy_items = 0;
+    slab_rebal.done = 0;
+
+    for (i = 0, kept = 0; i < s_cls->sl_curr; i++) {
+        void *ptr = s_cls->slots[i];
+        if (ptr < slab_rebal.slab_start || ptr >= slab_rebal.slab_end)
+            s_cls->slots[kept++] = ptr;
+    }
+    s_cls->sl_curr = kept;
+    if (s_cls->end_page_ptr >= slab_rebal.slab_start &&
+        s_cls->end_page_ptr < slab_rebal.slab_end) {
+        s_cls->end_page_ptr = 0;
+        s_cls->end_page_free = 0;
+    }
+
+    slab_rebalance_signal = 2;
+
+    if (settings.verbose > 1) {
+        fprintf(stderr, "Started a slab rebalance\n");
+    }
+
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&cache_lock);
+
+    return 0;
+}
+
+/*
+ * Clears out the next few chunks of the page being moved. Unreferenced
+ * items are copied to a free chunk elsewhere in their class if there is
+ * one and evicted otherwise; referenced ones are retried on the next pass.
+ * Returns the number of busy items seen.
+ */
+static int slab_rebalance_move(void) {
+    slabclass_t *s_cls;
+    int x;
+    int was_busy = 0;
+
+    pthread_mutex_lock(&cache_lock);
+    s_cls = &slabclass[slab_rebal.s_clsid];
+
+    for (x = 0; x < slab_bulk_check; x++) {
+        item *it = slab_rebal.slab_pos;
+
+        if (it->it_flags & ITEM_CHUNK) {
+            /* Part of a big item; the whole item has to go */
+            item *head = CHUNK_head((item_chunk *)it);
+            if ((head->it_flags & ITEM_LINKED) && head->refcount == 0) {
+                do_item_unlink(head);
+                slab_rebal_stats.evictions++;
+            } else {
+                was_busy++;
+            }
+        } else if (it->it_flags & ITEM_LINKED) {
+            if (it->refcount == 0 && (it->it_flags & ITEM_CHUNKED)) {
+                do_item_unlink(it);
+                slab_rebal_stats.evictions++;
+            } else if (it->refcount == 0) {
+                item *new_it = slabs_alloc(ITEM_ntotal(it), slab_rebal.s_clsid,
+                                           SLABS_ALLOC_NO_NEWPAGE);
+                if (new_it != NULL) {
+                    do_item_relocate(it, new_it);
+                    slab_rebal_stats.rescues++;
+                } else {
+                    do_item_unlink(it);
+                    slab_rebal_stats.evictions++;
+                }
+            } else {
+                was_busy++;
+            }
+        } else if ((it->it_flags & ITEM_SLABBED) == 0 && it->slabs_clsid != 0) {
+            /* Allocated and not stored yet, or unlinked and still in use */
+            was_busy++;
+        }
+
+        slab_rebal.slab_pos = (char *)slab_rebal.slab_pos + s_cls->size;
+        if (slab_rebal.slab_pos >= slab_rebal.slab_end)
+            break;
+    }
+
+    pthread_mutex_lock(&slabs_lock);
+    slab_rebal.busy_items += was_busy;
+    if (slab_rebal.slab_pos >= slab_rebal.slab_end) {
+        /* Some items were busy, start again from the top */
+        if (slab_rebal.busy_items) {
+            slab_rebal.slab_pos = slab_rebal.slab_start;
+            slab_rebal.busy_items = 0;
+            slab_rebal_stats.busy_passes++;
+        } else {
+            slab_rebal.done++;
+        }
+    }
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&cache_lock);
+
+    return was_busy;
+}
+
+/* Gives the cleared out page to the destination class. */
+static void slab_rebalance_finish(void) {
+    slabclass_t *s_cls;
+    slabclass_t *d_cls;
+    int d_clsid = slab_rebal.d_clsid;
+
+    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&slabs_lock);
+
+    s_cls = &slabclass[slab_rebal.s_clsid];
+    d_cls = &slabclass[d_clsid];
+
+    s_cls->slab_list[s_cls->killing - 1] = s_cls->slab_list[s_cls->slabs - 1];
+    s_cls->slabs--;
+    s_cls->killing = 0;
+
+    if (d_clsid == SLAB_SHRINK) {
+        /* The cache is over its limit; the page goes away */
+        if (mem_base == NULL) {
+            free(slab_rebal.slab_start);
+        } else {
+            page_release(slab_rebal.slab_start);
+            if (page_live != NULL)
+                page_live[PAGE_INDEX(slab_rebal.slab_start)] = 0;
+            released_pages[released_count++] = slab_rebal.slab_start;
+        }
+        mem_malloced -= settings.slab_page_size;
+        if (CLASS_RETIRED(slab_rebal.s_clsid))
+            slab_rebal_stats.drained++;
+        else
+            slab_rebal_stats.shrunk++;
+    } else {
+        memset(slab_rebal.slab_start, 0, (size_t)settings.slab_page_size);
+
+        if (grow_slab_list(d_clsid) == 0) {
+            /* Can't track another page in the destination; give it back */
+            d_clsid = slab_rebal.s_clsid;
+            d_cls = s_cls;
+        }
+        d_cls->slab_list[d_cls->slabs++] = slab_rebal.slab_start;
+        split_slab_page_into_freelist(slab_rebal.slab_start, d_clsid);
+    }
+
+    slab_rebal.done = 0;
+    slab_rebal.s_clsid = 0;
+    slab_rebal.d_clsid = 0;
+    slab_rebal.slab_start = NULL;
+    slab_rebal.slab_end = NULL;
+    slab_rebal.slab_pos = NULL;
+
+    slab_rebalance_signal = 0;
+    if (d_clsid != SLAB_SHRINK)
+        slab_rebal_stats.slabs_moved++;
+
+    /* Keep going until the cache fits */
+    slab_shrink_start();
+
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&cache_lock);
+
+    if (settings.verbose > 1) {
+        fprintf(stderr, "finished a slab move\n");
+    }
+}
+
+/*
+ * Moves pages between classes when asked to with slabs_reassign(). Holds
+ * slabs_rebalance_lock for the duration of a move, so a second request
+ * fails instead of queueing up.
+ */
+static void *slab_rebalance_thread(void *arg) {
+    int was_busy = 0;
+
+    pthread_mutex_lock(&slabs_rebalance_lock);
+    while (do_run_slab_rebalance_thread) {
+        if (slab_rebalance_signal == 1) {
+            if (slab_rebalance_start() < 0) {
+                /* Handle errors with more specifity as required. */
+                slab_rebalance_signal = 0;
+            }
+            was_busy = 0;
+        } else if (slab_rebalance_signal && slab_rebal.slab_start != NULL) {
+            was_busy = slab_rebalance_move();
+        }
+
+        if (slab_rebal.done) {
+            slab_rebalance_finish();
+        } else if (was_busy) {
+            /* Stuck waiting for some items to unlock, so slow down a bit
+             * to give them a chance to free up */
+            usleep(50);
+        }
+
+        if (slab_rebalance_signal == 0) {
+            pthread_cond_wait(&slab_rebalance_cond, &slabs_rebalance_lock);
+        }
+    }
+    pthread_mutex_unlock(&slabs_rebalance_lock);
+    return NULL;
+}
+
+/*
+ * GDSF version of the choice below: of the classes that evicted items
+ * during the window, the destination is the one whose next victim has the
+ * highest priority, and the source is the class with a spare page whose
+ * next victim has the lowest, as long as that is lower than the
+ * destination's. Across the cache that evicts the lowest priority items,
+ * not just the lowest in each class.
+ */
+static int slab_automove_gdsf(const unsigned int *evicted_diff,
+                              const double *priority,
+                              const unsigned int *total_pages,
+                              const bool *retired, int *src, int *dst) {
+    int source = 0, dest = 0;
+    int i;
+
+    for (i = POWER_SMALLEST; i < POWER_LARGEST; i++) {
+        if (evicted_diff[i] > 0 && !retired[i] &&
+            (dest == 0 || priority[i] > priority[dest])) {
+            dest = i;
+        }
+    }
+    if (dest == 0)
+        return 0;
+
+    for (i = POWER_SMALLEST; i < POWER_LARGEST; i++) {
+        if (i != dest && total_pages[i] >= 2 &&
+            (source == 0 || priority[i] < priority[source])) {
+            source = i;
+        }
+    }
+
+    if (source == 0 || priority[source] >= priority[dest])
+        return 0;
+
+    *src = source;
+    *dst = dest;
+    return 1;
+}
+
+/*
+ * Picks a page to move, at most once every slab_automove_window seconds.
+ *
+ * The destination is the class that evicted items during the window and
+ * whose ghost list saw the most hits: keys stored again soon after being
+ * evicted, which an extra page would have kept. The source is the class
+ * with a spare page that evicted nothing and has the oldest LRU tail, as
+ * long as that tail is older than the destination's. With -o gdsf,
+ * slab_automove_gdsf() chooses instead. Returns 1 and fills in src and
+ * dst if a page should move.
+ */
+static int slab_automove_decision(int *src, int *dst) {
+    static unsigned int evicted_old[POWER_LARGEST];
+    static unsigned int ghost_hits_old[POWER_LARGEST];
+    static rel_time_t next_run = 0;
+    unsigned int evicted[POWER_LARGEST];
+    unsigned int ghost_hits[POWER_LARGEST];
+    rel_time_t age[POWER_LARGEST];
+    double priority[POWER_LARGEST];
+    unsigned int total_pages[POWER_LARGEST];
+    bool retired[POWER_LARGEST];
+    unsigned int evicted_diff[POWER_LARGEST], ghost_diff;
+    unsigned int best_evicted = 0, best_ghost = 0;
+    int source = 0, dest = 0;
+    int i;
+
+    if (current_time < next_run)
+        return 0;
+    next_run = current_time + settings.slab_automove_window;
+
+    item_stats_automove(evicted, ghost_hits, age, priority);
+    pthread_mutex_lock(&slabs_lock);
+    for (i = POWER_SMALLEST; i < POWER_LARGEST; i++) {
+        total_pages[i] = i <= power_largest ? slabclass[i].slabs : 0;
+        retired[i] = CLASS_RETIRED(i);
+    }
+    pthread_mutex_unlock(&slabs_lock);
+
+    for (i = POWER_SMALLEST; i < POWER_LARGEST; i++) {
+        /* "stats reset" zeroes the counters under us */
+        evicted_diff[i] = evicted[i] >= evicted_old[i] ?
+            evicted[i] - evicted_old[i] : evicted[i];
+        ghost_diff = ghost_hits[i] >= ghost_hits_old[i] ?
+            ghost_hits[i] - ghost_hits_old[i] : ghost_hits[i];
+        evicted_old[i] = evicted[i];
+        ghost_hits_old[i] = ghost_hits[i];
+
+        if (evicted_diff[i] > 0 && ghost_diff > 0 && !retired[i] &&
+            (ghost_diff > best_ghost ||
+             (ghost_diff == best_ghost && evicted_diff[i] > best_evicted))) {
+            dest = i;
+            best_ghost = ghost_diff;
+            best_evicted = evicted_diff[i];
+        }
+    }
+
+    if (settings.gdsf)
+        return slab_automove_gdsf(evicted_diff, priority, total_pages,
+                                  retired, src, dst);
+
+    for (i = POWER_SMALLEST; i < POWER_LARGEST; i++) {
+        /* Marks classes that can give up a page */
+        if (evicted_diff[i] > 0 || total_pages[i] < 2)
+            total_pages[i] = 0;
+    }
+
+    if (dest == 0)
+        return 0;
+
+    for (i = POWER_SMALLEST; i < POWER_LARGEST; i++) {
+        if (i != dest && total_pages[i] != 0 &&
+            (source == 0 || age[i] > age[source])) {
+            source = i;
+        }
+    }
+
+    if (source == 0 || age[source] <= age[dest])
+        return 0;
+
+    *src = source;
+    *dst = dest;
+    return 1;
+}
+
+/* True if the next new page would go over the limit or isn't there */
+static bool slabs_out_of_pages(void) {
+    const size_t len = settings.slab_page_size;
+
+    return (mem_limit && mem_malloced + len > mem_limit) ||
+        (mem_base != NULL && mem_avail < len && released_count == 0);
+}
+
+/*
+ * If the cache is over its memory limit (after cache_memlimit lowered it)
+ * and the page mover is idle, has it take a page away from the class with
+ * the most pages. The page mover evicts the items in it a few at a time, so
+ * the cache shrinks a page at a time without stalling anyone. Pages of
+ * retired classes go first, and go whenever memory runs out or a class
+ * couldn't get a page, since only the current classes get new items. Must
+ * be called with slabs_lock held and the page mover not running.
+ */
+static void slab_shrink_start(void) {
+    unsigned int most = 0;
+    int id, src = 0;
+
+    if (slab_rebalance_signal != 0)
+        return;
+    if (mem_shrinking && mem_malloced <= mem_limit)
+        mem_shrinking = false;
+
+    if (draining) {
+        draining = false;
+        for (id = POWER_SMALLEST; id <= power_largest; id++) {
+            if (!CLASS_RETIRED(id) || slabclass[id].slabs == 0)
+                continue;
+            draining = true;
+            if (slabclass[id].slabs > most) {
+                most = slabclass[id].slabs;
+                src = id;
+            }
+        }
+        if (!mem_shrinking && pages_wanted == 0 && !slabs_out_of_pages())
+            src = 0;
+    }
+    if (src == 0 && mem_shrinking) {
+        most = 1;
+        for (id = POWER_SMALLEST; id <= power_largest; id++) {
+            if (slabclass[id].slabs > most) {
+                most = slabclass[id].slabs;
+                src = id;
+            }
+        }
+    }
+    pages_wanted = 0;
+    if (src == 0) {
+        mem_shrinking = false;
+        return;
+    }
+
+    slab_rebal.s_clsid = src;
+    slab_rebal.d_clsid = SLAB_SHRINK;
+    slab_rebalance_signal = 1;
+    pthread_cond_signal(&slab_rebalance_cond);
+}
+
+/* Starts shrinking the cache unless the page mover is busy */
+static void slab_shrink_check(void) {
+    if (pthread_mutex_trylock(&slabs_rebalance_lock) != 0)
+        return;
+    pthread_mutex_lock(&slabs_lock);
+    slab_shrink_start();
+    /* A drain started from do_slabs_newslab() can signal the page mover
+     * just before it waits; now it surely is waiting */
+    if (slab_rebalance_signal == 1)
+        pthread_cond_signal(&slab_rebalance_cond);
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&slabs_rebalance_lock);
+}
+
+/*
+ * Sets a new limit on the memory used for items. Raising it takes effect
+ * right away; if it is lowered below what is in use, the page mover frees
+ * pages until the cache fits. Returns false if the limit can't be raised
+ * that far because all memory was allocated at startup.
+ */
+bool slabs_adjust_mem_limit(size_t new_limit) {
+    pthread_mutex_lock(&slabs_lock);
+    if (mem_base != NULL && new_limit > mem_limit_max) {
+        pthread_mutex_unlock(&slabs_lock);
+        return false;
+    }
+    mem_limit = new_limit;
+    mem_shrinking = mem_malloced > mem_limit;
+    pthread_mutex_unlock(&slabs_lock);
+
+    slab_shrink_check();
+    return true;
+}
+
+/* Bucket of the size histogram an item of this size goes in */
+static int size_bucket(const size_t size) {
+    size_t s = size - 1;
+    int log2 = 8;
+
+    if (s < 256)
+        return s >> 3;
+    while ((s >> (log2 + 1)) != 0)
+        log2++;
+    log2 = SIZE_HIST_LINEAR + (log2 - 8) * SIZE_HIST_SUB +
+        ((s >> (log2 - 5)) & (SIZE_HIST_SUB - 1));
+    return log2 < SIZE_HIST_BUCKETS ? log2 : SIZE_HIST_BUCKETS - 1;
+}
+
+/* Largest item size that goes in a bucket */
+static size_t bucket_limit(const int b) {
+    int shift;
+
+    if (b < SIZE_HIST_LINEAR)
+        return (size_t)(b + 1) * 8;
+    shift = (b - SIZE_HIST_LINEAR) / SIZE_HIST_SUB + 3;
+    return (size_t)(SIZE_HIST_SUB + (b - SIZE_HIST_LINEAR) % SIZE_HIST_SUB + 1)
+        << shift;
+}
+
+void slabs_size_sample(const size_t size) {
+    int b = size_bucket(size);
+    int i;
+
+    size_hist.count[b]++;
+    size_hist.bytes[b] += size;
+    if (++size_hist.samples >= SIZE_HIST_DECAY) {
+        /* Keep the average size in each bucket as it was */
+        for (i = 0; i < SIZE_HIST_BUCKETS; i++) {
+            uint64_t count = size_hist.count[i];
+            if (count == 0)
+                continue;
+            size_hist.count[i] = count / 2;
+            size_hist.bytes[i] = size_hist.bytes[i] / count * (count / 2);
+        }
+        size_hist.samples /= 2;
+    }
+}
+
+/*
+ * Bytes the items in the histogram would waste with these chunk sizes,
+ * rounding each bucket up as a whole. *chunks gets the bytes of chunks
+ * they would take up.
+ */
+static uint64_t ladder_waste(const struct size_hist *h,
+                             const unsigned int *sizes, const int nsizes,
+                             uint64_t *chunks) {
+    uint64_t waste = 0, total = 0;
+    int b, x = 0;
+
+    for (b = 0; b < SIZE_HIST_BUCKETS; b++) {
+        size_t limit = bucket_limit(b);
+        uint64_t taken;
+
+        if (h->count[b] == 0)
+            continue;
+        while (x < nsizes - 1 && sizes[x] < limit)
+            x++;
+        taken = h->count[b] * sizes[x];
+        total += taken;
+        waste += taken > h->bytes[b] ? taken - h->bytes[b] : 0;
+    }
+    *chunks = total;
+    return waste;
+}
+
+/*
+ * Picks up to nsizes chunk sizes, the last one slab_chunk_size_max, that
+ * waste the least on the sizes in the histogram. Each size is the top of a
+ * bucket, and the buckets from there down to the size below all round up
+ * to it; dynamic programming finds the split with the least waste. No size
+ * may be more than twice the one below it (or the growth factor, if that
+ * is larger), so sizes that haven't shown up yet don't land in chunks many
+ * times too big. Returns the number of sizes, or 0 if that takes more.
+ */
+static int ladder_propose(const struct size_hist *h, const int nsizes,
+                          unsigned int *sizes) {
+    const size_t top = settings.slab_chunk_size_max;
+    const double bound = settings.factor > 2.0 ? settings.factor : 2.0;
+    uint64_t *dp, *n, *s, best = UINT64_MAX, all_n = 0, all_s = 0;
+    uint16_t *from;
+    int first, m, k, c, i, j, best_c = -1, best_j = -1, ret = 0;
+
+    for (first = 0; first < SIZE_HIST_BUCKETS && h->count[first] == 0;
+         first++)
+        continue;
+    for (m = 0; first + m < SIZE_HIST_BUCKETS &&
+             bucket_limit(first + m) < top; m++)
+        continue;
+    k = nsizes - 1;
+    if (first == SIZE_HIST_BUCKETS)
+        return 0;
+    if (m == 0 || k < 1) {
+        sizes[0] = top;
+        return 1;
+    }
+
+    /* Item counts and bytes of the buckets before each one, from first */
+    n = calloc(m + 1, sizeof(uint64_t));
+    s = calloc(m + 1, sizeof(uint64_t));
+    dp = malloc((size_t)k * m * sizeof(uint64_t));
+    from = malloc((size_t)k * m * sizeof(uint16_t));
+    if (n == NULL || s == NULL || dp == NULL || from == NULL)
+        goto out;
+    for (j = 0; j < m; j++) {
+        n[j + 1] = n[j] + h->count[first + j];
+        s[j + 1] = s[j] + h->bytes[first + j];
+    }
+    for (i = first; i < SIZE_HIST_BUCKETS; i++) {
+        all_n += h->count[i];
+        all_s += h->bytes[i];
+    }
+
+#define RUN_WASTE(i, j) \
+    (bucket_limit(first + (j)) * (n[(j) + 1] - n[i]) - (s[(j) + 1] - s[i]))
+#define DP(c, j) dp[(size_t)(c) * m + (j)]
+
+    /* DP(c, j): least waste for buckets up to j in c + 1 sizes, the last
+     * of which is bucket j's limit */
+    for (j = 0; j < m; j++) {
+        DP(0, j) = RUN_WASTE(0, j);
+        from[j] = 0;
+    }
+    for (c = 1; c < k; c++) {
+        for (j = 0; j < m; j++) {
+            double limit = bucket_limit(first + j);
+            DP(c, j) = UINT64_MAX;
+            for (i = j; i > 0 && limit <= bound * bucket_limit(first + i - 1);
+                 i--) {
+                uint64_t w;
+                if (DP(c - 1, i - 1) == UINT64_MAX)
+                    continue;
+                w = DP(c - 1, i - 1) + RUN_WASTE(i, j);
+                if (w < DP(c, j)) {
+                    DP(c, j) = w;
+                    from[(size_t)c * m + j] = i;
+                }
+            }
+        }
+    }
+
+    /* Everything above the last size goes in the largest chunks */
+    for (c = 0; c < k; c++) {
+        for (j = 0; j < m; j++) {
+            uint64_t w;
+            if (DP(c, j) == UINT64_MAX ||
+                (double)top > bound * bucket_limit(first + j))
+                continue;
+            w = DP(c, j) + (all_n - n[j + 1]) * top - (all_s - s[j + 1]);
+            if (w < best) {
+                best = w;
+                best_c = c;
+                best_j = j;
+            }
+        }
+    }
+    if (best_c < 0)
+        goto out;
+
+    ret = best_c + 2;
+    sizes[ret - 1] = top;
+    for (c = best_c, j = best_j; c >= 0; c--) {
+        sizes[c] = bucket_limit(first + j);
+        j = from[(size_t)c * m + j] - 1;
+    }
+#undef RUN_WASTE
+#undef DP
+
+out:
+    free(n);
+    free(s);
+    free(dp);
+    free(from);
+    return ret;
+}
+
+/* Chunk sizes of the current classes; returns how many */
+static int ladder_current(unsigned int *sizes) {
+    int id, x = 0;
+
+    for (id = clsid_smallest; id <= clsid_largest; id++)
+        sizes[x++] = slabclass[id].size;
+    return x;
+}
+
+/* Waste of a ladder in percent of the chunk memory it would take up */
+static double waste_pct(const uint64_t waste, const uint64_t chunks) {
+    return chunks ? (double)waste * 100 / chunks : 0.0;
+}
+
+/*
+ * "stats ladder": the chunk sizes in use and the ones the sizes seen so far
+ * call for, with the waste of both estimated from the histogram, and the
+ * memory actually wasted in chunks now.
+ */
+static void slabs_ladder_stats(ADD_STAT add_stats, void *c) {
+    struct size_hist *h = malloc(sizeof(struct size_hist));
+    unsigned int current[POWER_LARGEST], proposed[POWER_LARGEST];
+    uint64_t waste, chunks, actual = 0, used = 0;
+    unsigned int retired = 0;
+    int ncurrent, nproposed, i;
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+
+    if (h == NULL)
+        return;
+    pthread_mutex_lock(&cache_lock);
+    memcpy(h, &size_hist, sizeof(struct size_hist));
+    pthread_mutex_unlock(&cache_lock);
+
+    pthread_mutex_lock(&slabs_lock);
+    ncurrent = ladder_current(current);
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        slabclass_t *p = &slabclass[i];
+        uint64_t taken;
+        if (p->slabs == 0)
+            continue;
+        taken = (uint64_t)(p->slabs * p->perslab - p->sl_curr -
+                           p->end_page_free) * p->size;
+        used += taken;
+        actual += taken > p->requested ? taken - p->requested : 0;
+        if (CLASS_RETIRED(i))
+            retired += p->slabs;
+    }
+    pthread_mutex_unlock(&slabs_lock);
+
+    nproposed = ladder_propose(h, ncurrent, proposed);
+
+    APPEND_STAT("samples", "%llu", (unsigned long long)h->samples);
+    waste = ladder_waste(h, current, ncurrent, &chunks);
+    APPEND_STAT("current_classes", "%d", ncurrent);
+    APPEND_STAT("current_waste_pct", "%.2f", waste_pct(waste, chunks));
+    if (nproposed > 0) {
+        waste = ladder_waste(h, proposed, nproposed, &chunks);
+        APPEND_STAT("proposed_classes", "%d", nproposed);
+        APPEND_STAT("proposed_waste_pct", "%.2f", waste_pct(waste, chunks));
+    }
+    APPEND_STAT("actual_waste_bytes", "%llu", (unsigned long long)actual);
+    APPEND_STAT("actual_waste_pct", "%.2f", waste_pct(actual, used));
+    APPEND_STAT("retired_pages", "%u", retired);
+    APPEND_STAT("ladders_adopted", "%llu", (unsigned long long)ladders_adopted);
+    for (i = 0; i < ncurrent || i < nproposed; i++) {
+        if (i < ncurrent) {
+            APPEND_NUM_STAT(i + 1, "current", "%u", current[i]);
+        }
+        if (i < nproposed) {
+            APPEND_NUM_STAT(i + 1, "proposed", "%u", proposed[i]);
+        }
+    }
+    add_stats(NULL, 0, NULL, 0, c);
+    free(h);
+}
+
+/*
+ * Switches new items over to the chunk sizes "stats ladder" proposes. They
+ * get class ids of their own; the old classes keep their items and are
+ * drained by the page mover as the new ones need memory. Unless forced,
+ * only switches if the proposal wastes less than 3/4 of what the current
+ * sizes do.
+ */
+enum ladder_result_type slabs_ladder_adopt(const bool force) {
+    struct size_hist *h = malloc(sizeof(struct size_hist));
+    unsigned int current[POWER_LARGEST], proposed[POWER_LARGEST];
+    uint64_t chunks, old_waste, new_waste;
+    int ncurrent, nproposed, start, id, x;
+
+    /* The log doesn't round sizes up, so no chunk sizes can do better */
+    if (settings.allocator == ALLOCATOR_LOG) {
+        free(h);
+        return LADDER_SAME;
+    }
+    if (h == NULL)
+        return LADDER_NOSAMPLES;
+    pthread_mutex_lock(&cache_lock);
+    memcpy(h, &size_hist, sizeof(struct size_hist));
+    pthread_mutex_unlock(&cache_lock);
+
+    pthread_mutex_lock(&slabs_lock);
+    ncurrent = ladder_current(current);
+    pthread_mutex_unlock(&slabs_lock);
+
+    if (h->samples < LADDER_MIN_SAMPLES) {
+        free(h);
+        return LADDER_NOSAMPLES;
+    }
+    nproposed = ladder_propose(h, ncurrent, proposed);
+    old_waste = ladder_waste(h, current, ncurrent, &chunks);
+    new_waste = ladder_waste(h, proposed, nproposed, &chunks);
+    free(h);
+    if (nproposed == 0 ||
+        (nproposed == ncurrent &&
+         memcmp(current, proposed, ncurrent * sizeof(unsigned int)) == 0) ||
+        (!force && new_waste * 4 >= old_waste * 3))
+        return LADDER_SAME;
+
+    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&slabs_lock);
+    /* The new classes need ids no page or item is using */
+    for (start = POWER_SMALLEST; start + nproposed <= POWER_LARGEST; start++) {
+        for (x = 0; x < nproposed; x++) {
+            id = start + x;
+            if (!CLASS_RETIRED(id) || slabclass[id].slabs != 0 ||
+                slabclass[id].killing != 0 || slab_rebal.s_clsid == id)
+                break;
+        }
+        if (x == nproposed)
+            break;
+        start += x;
+    }
+    if (start + nproposed > POWER_LARGEST) {
+        pthread_mutex_unlock(&slabs_lock);
+        pthread_mutex_unlock(&cache_lock);
+        return LADDER_NOROOM;
+    }
+
+    for (x = 0; x < nproposed; x++) {
+        slabclass_t *p = &slabclass[start + x];
+        p->size = proposed[x];
+        p->perslab = settings.slab_page_size / p->size;
+        p->sl_curr = 0;
+        p->end_page_ptr = 0;
+        p->end_page_free = 0;
+        p->requested = 0;
+        if (settings.verbose > 1) {
+            fprintf(stderr, "slab class %3d: chunk size %9u perslab %7u\n",
+                    start + x, p->size, p->perslab);
+        }
+    }
+    clsid_smallest = start;
+    clsid_largest = start + nproposed - 1;
+    if (clsid_largest > power_largest)
+        power_largest = clsid_largest;
+    ladders_adopted++;
+    draining = true;
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&cache_lock);
+
+    slab_shrink_check();
+    return LADDER_OK;
+}
+
+/* Pages given back to the OS per slabs_lock acquisition */
+#define SLAB_RELEASE_BATCH 64
+
+/*
+ * Gives back up to SLAB_RELEASE_BATCH pages that no longer hold any items,
+ * keeping at least one page in each class and slab_release_floor megabytes
+ * overall. Their chunks come off the free list under slabs_lock, and the
+ * madvise() calls happen outside of it. Returns the number of pages given
+ * back.
+ */
+static int slabs_release_pages(void) {
+    const size_t len = settings.slab_page_size;
+    const size_t floor = (size_t)settings.slab_release_floor * 1024 * 1024;
+    void *batch[SLAB_RELEASE_BATCH];
+    int nbatch = 0;
+    int i, id;
+
+    pthread_mutex_lock(&slabs_lock);
+    for (id = POWER_SMALLEST; id <= power_largest &&
+             nbatch < SLAB_RELEASE_BATCH; id++) {
+        slabclass_t *p = &slabclass[id];
+        unsigned int x, kept;
+        int found = 0;
+
+        if (p->killing)
+            continue;
+        for (x = 0; x < p->slabs && p->slabs > (CLASS_RETIRED(id) ? 0 : 1) &&
+                 nbatch < SLAB_RELEASE_BATCH &&
+                 mem_malloced >= floor + len; ) {
+            char *page = p->slab_list[x];
+            if (page_live[PAGE_INDEX(page)] != 0 ||
+                ((char *)p->end_page_ptr >= page &&
+                 (char *)p->end_page_ptr < page + len)) {
+                x++;
+                continue;
+            }
+            page_live[PAGE_INDEX(page)] = PAGE_RELEASING;
+            p->slab_list[x] = p->slab_list[--p->slabs];
+            mem_malloced -= len;
+            batch[nbatch++] = page;
+            found++;
+        }
+        if (found == 0)
+            continue;
+
+        for (x = 0, kept = 0; x < p->sl_curr; x++) {
+            void *ptr = p->slots[x];
+            if (page_live[PAGE_INDEX(ptr)] != PAGE_RELEASING)
+                p->slots[kept++] = ptr;
+        }
+        p->sl_curr = kept;
+    }
+    pthread_mutex_unlock(&slabs_lock);
+
+    if (nbatch == 0)
+        return 0;
+
+    for (i = 0; i < nbatch; i++) {
+        if (!page_release(batch[i]) && settings.slab_release) {
+            /* Huge pages can't be given back a part at a time */
+            fprintf(stderr, "Can't release slab pages: %s\n", strerror(errno));
+            settings.slab_release = false;
+        }
+    }
+
+    pthread_mutex_lock(&slabs_lock);
+    for (i = 0; i < nbatch; i++) {
+        page_live[PAGE_INDEX(batch[i])] = 0;
+        released_pages[released_count++] = batch[i];
+    }
+    slabs_released += nbatch;
+    pthread_mutex_unlock(&slabs_lock);
+
+    if (settings.verbose > 1) {
+        fprintf(stderr, "Released %d slab pages\n", nbatch);
+    }
+    return nbatch;
+}
+
+/*
+ * Runs the automove policy once a second while it is enabled, and hands
+ * its decisions to the rebalance thread. Gives empty pages back to the OS
+ * too with -o slab_release, switches chunk sizes with -o slab_autotune, and
+ * starts shrinking the cache if it's over its limit.
+ */
+static void *slab_maintenance_thread(void *arg) {
+    rel_time_t next_autotune = 0;
+    int src, dst;
+
+    while (do_run_slab_thread) {
+        if (settings.slab_automove && slab_automove_decision(&src, &dst) == 1) {
+            if (slabs_reassign(src, dst) == REASSIGN_OK) {
+                pthread_mutex_lock(&slabs_lock);
+                slab_rebal_stats.automoves++;
+                pthread_mutex_unlock(&slabs_lock);
+                if (settings.verbose > 1) {
+                    fprintf(stderr, "Automoving a page from class %d to %d\n",
+                            src, dst);
+                }
+            }
+        }
+        if (settings.slab_release) {
+            while (slabs_release_pages() == SLAB_RELEASE_BATCH)
+                continue;
+        }
+        if (settings.slab_autotune && current_time >= next_autotune) {
+            next_autotune = current_time + settings.slab_autotune_window;
+            if (slabs_ladder_adopt(false) == LADDER_OK && settings.verbose > 1)
+                fprintf(stderr, "Switched to new slab chunk sizes\n");
+        }
+        slab_shrink_check();
+        sleep(1);
+    }
+    return NULL;
+}
+
+static enum reassign_result_type do_slabs_reassign(int src, int dst) {
+    if (slab_rebalance_signal != 0)
+        return REASSIGN_RUNNING;
+
+    if (src == dst)
+        return REASSIGN_SRC_DST_SAME;
+
+    if (src < POWER_SMALLEST || src > power_largest ||
+        dst < POWER_SMALLEST || dst > power_largest || CLASS_RETIRED(dst))
+        return REASSIGN_BADCLASS;
+
+    if (slabclass[src].slabs < (CLASS_RETIRED(src) ? 1 : 2))
+        return REASSIGN_NOSPARE;
+
+    slab_rebal.s_clsid = src;
+    slab_rebal.d_clsid = dst;
+
+    slab_rebalance_signal = 1;
+    pthread_cond_signal(&slab_rebalance_cond);
+
+    return REASSIGN_OK;
+}
+
+enum reassign_result_type slabs_reassign(int src, int dst) {
+    enum reassign_result_type ret;
+    if (pthread_mutex_trylock(&slabs_rebalance_lock) != 0) {
+        return REASSIGN_RUNNING;
+    }
+    pthread_mutex_lock(&slabs_lock);
+    ret = do_slabs_reassign(src, dst);
+    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&slabs_rebalance_lock);
+    return ret;
+}
+
+int start_slab_maintenance_thread(void) {
+    int ret;
+    char *env = getenv("MEMCACHED_SLAB_BULK_CHECK");
+
+    slab_rebalance_signal = 0;
+    slab_rebal.slab_start = NULL;
+    if (env != NULL) {
+        slab_bulk_check = atoi(env);
+        if (slab_bulk_check == 0) {
+            slab_bulk_check = DEFAULT_SLAB_BULK_CHECK;
+        }
+    }
+
+    if ((ret = pthread_create(&maintenance_tid, NULL,
+                              slab_maintenance_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create slab maint thread: %s\n", strerror(ret));
+        return -1;
+    }
+    if ((ret = pthread_create(&rebalance_tid, NULL,
+                              slab_rebalance_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create rebal thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void stop_slab_maintenance_thread(void) {
+    do_run_slab_thread = 0;
+    pthread_mutex_lock(&slabs_rebalance_lock);
+    do_run_slab_rebalance_thread = 0;
+    pthread_cond_signal(&slab_rebalance_cond);
+    pthread_mutex_unlock(&slabs_rebalance_lock);
+
+    /* Wait for the maintenance threads to stop */
+    pthread_join(maintenance_tid, NULL);
+    pthread_join(rebalance_tid, NULL);
+}
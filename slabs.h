@@ -18,8 +18,16 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc);
 
 unsigned int slabs_clsid(const size_t size);
 
+/** Don't allocate a new page if the class has no free chunk left */
+#define SLABS_ALLOC_NO_NEWPAGE 1
+/** The log cleaner is moving an item; it may use the reserved segment */
+#define SLABS_ALLOC_CLEANER 2
+
 /** Allocate object of given length. 0 on error */ /*@null@*/
-void *slabs_alloc(const size_t size, unsigned int id);
+void *slabs_alloc(const size_t size, unsigned int id, const int flags);
+
+/** Allocate zeroed memory that lives as long as the process */
+void *slabs_alloc_static(size_t size);
 
 /** Free previously allocated object */
 void slabs_free(void *ptr, size_t size, unsigned int id);
@@ -30,4 +38,44 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c);
 /** Fill buffer with stats */ /*@null@*/
 void slabs_stats(ADD_STAT add_stats, void *c);
 
+/** Memory in slab pages, in the allocator's own lists, and the page limit */
+void slabs_memory(size_t *pages, size_t *metadata, size_t *limit);
+
+enum reassign_result_type {
+    REASSIGN_OK=0, REASSIGN_RUNNING, REASSIGN_BADCLASS, REASSIGN_NOSPARE,
+    REASSIGN_SRC_DST_SAME
+};
+
+/** Ask the page mover to move one page from class src to class dst */
+enum reassign_result_type slabs_reassign(int src, int dst);
+
+/** Destination class of a page the mover frees to shrink the cache */
+#define SLAB_SHRINK 0
+
+/** Change the memory limit; false if it can't go that high */
+bool slabs_adjust_mem_limit(size_t new_limit);
+
+/** Count an item of this size for "stats ladder". Call with cache_lock held */
+void slabs_size_sample(const size_t size);
+
+enum ladder_result_type {
+    LADDER_OK=0, LADDER_NOSAMPLES, LADDER_NOROOM, LADDER_SAME
+};
+
+/** Switch new items to the proposed chunk sizes; unless forced, only if
+    they waste notably less than the current ones */
+enum ladder_result_type slabs_ladder_adopt(const bool force);
+
+/** With -o allocator=log, copy the live items out of the segment with
+    the most dead space if it has at least need bytes of it (and, unless
+    any, a fair share of the segment). Call with cache_lock held. Returns
+    true if a segment was freed */
+bool slabs_log_clean(const size_t need, const bool any);
+
+/** Bytes still in use in the log segment ptr is in */
+uint32_t slabs_log_live(const void *ptr);
+
+int start_slab_maintenance_thread(void);
+void stop_slab_maintenance_thread(void);
+
 #endif
@@ -116,6 +116,14 @@ static PREFIX_STATS *stats_prefix_find(const char *key, const size_t nkey) {
     return pfs;
 }
 
+/*
+ * Returns the memory taken by the prefix stats. NOTE: the stats lock is
+ * assumed to be held when this is called.
+ */
+size_t stats_prefix_memory(void) {
+    return (size_t)num_prefixes * (sizeof(PREFIX_STATS) + 1) + total_prefix_size;
+}
+
 /*
  * Records a "get" of a key.
  */
@@ -6,3 +6,4 @@ void stats_prefix_record_delete(const char *key, const size_t nkey);
 void stats_prefix_record_set(const char *key, const size_t nkey);
 /*@null@*/
 char *stats_prefix_dump(int *length);
+size_t stats_prefix_memory(void);
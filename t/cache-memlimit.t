@@ -0,0 +1,57 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 12;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 32 -o slab_page_size=64k');
+my $sock = $server->sock;
+
+print $sock "cache_memlimit 4\r\n";
+is(scalar <$sock>, "MEMLIMIT_TOO_SMALL cannot set the limit below 8 megabytes\r\n",
+   "too small");
+print $sock "cache_memlimit x\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n", "bad limit");
+
+my $value = 'x' x 1000;
+sub fill {
+    my ($sock, $count) = @_;
+    foreach my $i (1 .. $count) {
+        print $sock "set key$i 0 0 1000 noreply\r\n$value\r\n";
+    }
+    mem_get_is($sock, "key$count", $value);
+}
+
+fill($sock, 40000);
+my $full = mem_stats($sock, 'slabs');
+cmp_ok($full->{total_malloced}, '>', 30 * 1024 * 1024, "cache is full");
+
+# Lowering the limit frees pages in the background
+print $sock "cache_memlimit 12\r\n";
+is(scalar <$sock>, "OK\r\n", "lowered the limit");
+is(mem_stats($sock)->{limit_maxbytes}, 12 * 1024 * 1024, "limit_maxbytes");
+
+my $slabs;
+for (1 .. 50) {
+    $slabs = mem_stats($sock, 'slabs');
+    last if $slabs->{shrink_remaining} == 0;
+    select undef, undef, undef, 0.1;
+}
+is($slabs->{shrink_remaining}, 0, "shrunk to the new limit");
+cmp_ok($slabs->{total_malloced}, '<=', 12 * 1024 * 1024, "total_malloced");
+cmp_ok($slabs->{slabs_shrunk}, '>', 0, "pages were freed");
+
+# Raising it back lets the cache grow again
+print $sock "cache_memlimit 32 noreply\r\n";
+fill($sock, 40000);
+cmp_ok(mem_stats($sock, 'slabs')->{total_malloced}, '>', 30 * 1024 * 1024,
+       "cache grew again");
+
+# Preallocated memory can't grow past what was allocated
+$server = new_memcached('-m 32 -L');
+$sock = $server->sock;
+print $sock "cache_memlimit 64\r\n";
+is(scalar <$sock>, "MEMLIMIT_ADJUST_FAILED cannot raise the limit of " .
+   "preallocated memory\r\n", "can't grow preallocated memory");
@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 19;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-I 4m');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{item_size_max}, 4 * 1024 * 1024, "item size limit raised");
+is($settings->{slab_chunk_max}, 512 * 1024, "chunks stay at half a 1MB page");
+
+# A value spread over several chunks, with a pattern so misplaced pieces
+# show up.
+my $big = join('', map { sprintf("%07d,", $_) } 0 .. 393215);
+is(length($big), 3 * 1024 * 1024, "built a 3MB value");
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a chunked item");
+
+my $slabs = mem_stats($sock, 'slabs');
+my ($largest) = sort { $b <=> $a } map { /^(\d+):chunk_size$/ ? $1 : () }
+    keys %$slabs;
+is($slabs->{"$largest:chunk_size"}, 512 * 1024, "largest class is one chunk");
+mem_get_is($sock, "big", $big);
+mem_gets_is($sock, 1, "big", $big);
+
+# Just over one chunk: the rest goes into a small chunk.
+my $medium = "m" x (600 * 1024);
+print $sock "set medium 0 0 " . length($medium) . "\r\n$medium\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored an item just over a chunk");
+mem_get_is($sock, "medium", $medium);
+
+print $sock "append medium 0 0 5\r\ntail!\r\n";
+is(scalar <$sock>, "STORED\r\n", "appended to a chunked item");
+print $sock "prepend medium 0 0 5\r\nhead!\r\n";
+is(scalar <$sock>, "STORED\r\n", "prepended to a chunked item");
+mem_get_is($sock, "medium", "head!" . $medium . "tail!");
+
+print $sock "set small 0 0 5\r\nsmall\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a small item");
+print $sock "append small 0 0 " . length($medium) . "\r\n$medium\r\n";
+is(scalar <$sock>, "STORED\r\n", "small item grew into a chunked one");
+mem_get_is($sock, "small", "small" . $medium);
+
+print $sock "incr big 1\r\n";
+is(scalar <$sock>, "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n",
+   "can't incr a chunked item");
+
+my $toobig = "x" x (4 * 1024 * 1024);
+print $sock "set toobig 0 0 " . length($toobig) . "\r\n$toobig\r\n";
+is(scalar <$sock>, "SERVER_ERROR object too large for cache\r\n",
+   "item size limit still applies");
+
+print $sock "delete big\r\n";
+is(scalar <$sock>, "DELETED\r\n", "deleted the chunked item");
+mem_get_is($sock, "big", undef);
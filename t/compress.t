@@ -0,0 +1,77 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = eval { new_memcached('-o compress') };
+plan skip_all => 'needs a build with --enable-lz4' unless $server;
+plan tests => 22;
+
+eval {
+    my $server = new_memcached('-o compress,allocator=log');
+};
+ok($@ && $@ =~ m/^Failed/, "Shouldn't start with compress,allocator=log");
+
+my $sock = $server->sock;
+is(mem_stats($sock, 'settings')->{compress_min}, 256, "compress_min");
+
+sub class_stats {
+    my ($sock, $stat) = @_;
+    my $slabs = mem_stats($sock, 'slabs');
+    my $total = 0;
+    $total += $slabs->{$_} foreach (grep { /^\d+:$stat$/ } keys %$slabs);
+    return $total;
+}
+
+# Compressible values move down a class and come back as they were stored
+my $text = join(" ", map { "line $_ of some text" } 1 .. 200);
+print $sock "set text 5 0 " . length($text) . "\r\n$text\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored text");
+mem_get_is({ sock => $sock, flags => 5 }, "text", $text);
+is(class_stats($sock, 'compress_kept'), 1, "compress_kept");
+is(class_stats($sock, 'compress_bytes_in'), length($text),
+   "compress_bytes_in");
+cmp_ok(class_stats($sock, 'compress_bytes_out'), '<', length($text) / 2,
+       "compress_bytes_out");
+is(class_stats($sock, 'decompress_count'), 1, "decompress_count");
+
+# Values that don't shrink enough stay as they are
+srand(7);
+my $noise = join('', map { chr(33 + int(rand(90))) } 1 .. 2000);
+print $sock "set noise 0 0 2000\r\n$noise\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored noise");
+mem_get_is($sock, "noise", $noise);
+is(class_stats($sock, 'compress_tries'), 2, "compress_tries");
+
+# Numbers are never compressed, so incr still works on them
+my $number = ('0' x 297) . '123';
+print $sock "set number 0 0 300\r\n$number\r\nincr number 1\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored number");
+is(scalar <$sock>, "124\r\n", "incr on a long number");
+
+# Appends and prepends see the value the client stored
+print $sock "append text 0 0 4\r\ntail\r\nprepend text 0 0 4\r\nhead\r\n";
+is(scalar <$sock>, "STORED\r\n", "appended");
+is(scalar <$sock>, "STORED\r\n", "prepended");
+mem_get_is({ sock => $sock, flags => 5 }, "text", "head${text}tail");
+
+# Values too big for one chunk come back whole too
+my $big = $text x 200;
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+<$sock>;
+mem_get_is($sock, "big", $big);
+
+# Text that only starts like a number is still compressed
+my $kept = class_stats($sock, 'compress_kept');
+my $report = "2024 annual report: $text";
+print $sock "set report 0 0 " . length($report) . "\r\n$report\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored text starting with digits");
+my $spaced = " $text";
+print $sock "set spaced 0 0 " . length($spaced) . "\r\n$spaced\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored text starting with a space");
+is(class_stats($sock, 'compress_kept'), $kept + 2, "both were compressed");
+mem_get_is($sock, "report", $report);
+mem_get_is($sock, "spaced", $spaced);
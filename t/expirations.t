@@ -1,7 +1,7 @@
 #!/usr/bin/perl
 
 use strict;
-use Test::More tests => 15;
+use Test::More tests => 18;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -62,3 +62,14 @@ sleep(2.3);
 print $sock "add add 0 2 7\r\naddval3\r\n";
 is(scalar <$sock>, "STORED\r\n", "stored add again");
 mem_get_is($sock, "add", "addval3");
+
+# Expired items are reclaimed in the background without being fetched.
+for (my $i = 0; $i < 20; $i++) {
+    print $sock "set bg$i 0 1 1 noreply\r\nx\r\n";
+}
+print $sock "set keeper 0 0 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored keeper");
+sleep(3);
+my $stats = mem_stats($sock);
+is($stats->{curr_items}, 1, "expired items were unlinked");
+cmp_ok($stats->{expired}, '>=', 20, "expired counter went up");
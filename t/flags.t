@@ -1,7 +1,7 @@
 #!/usr/bin/perl
 
 use strict;
-use Test::More tests => 6;
+use Test::More tests => 13;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -10,9 +10,22 @@ my $server = new_memcached();
 my $sock = $server->sock;
 
 # set foo (and should get it)
-for my $flags (0, 123, 2**16-1) {
+for my $flags (0, 123, 2**16-1, 2**32-1) {
     print $sock "set foo $flags 0 6\r\nfooval\r\n";
     is(scalar <$sock>, "STORED\r\n", "stored foo");
     mem_get_is({ sock => $sock,
                  flags => $flags }, "foo", "fooval", "got flags $flags back");
 }
+
+# The flags are kept in binary, so whatever makes a new copy of the item
+# has to carry them over.
+print $sock "set foo 42 0 1\r\n1\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+print $sock "append foo 0 0 1\r\n2\r\n";
+is(scalar <$sock>, "STORED\r\n", "appended to foo");
+mem_get_is({ sock => $sock,
+             flags => 42 }, "foo", "12", "append kept the flags");
+print $sock "incr foo 88\r\n";
+is(scalar <$sock>, "100\r\n", "incremented foo");
+mem_get_is({ sock => $sock,
+             flags => 42 }, "foo", "100", "incr kept the flags");
@@ -1,7 +1,7 @@
 #!/usr/bin/perl
 
 use strict;
-use Test::More tests => 14;
+use Test::More tests => 29;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -42,3 +42,60 @@ is(scalar <$sock>, "STORED\r\n", "stored foo = '1234'");
 mem_get_is($sock, "foo", '1234');
 sleep(2.2);
 mem_get_is($sock, "foo", undef);
+
+# flush_all doesn't walk the cache; items stay linked until they're fetched
+# or the LRU crawler gets to them.
+$server = new_memcached('-o lru_crawler');
+$sock = $server->sock;
+for (my $i = 0; $i < 10; $i++) {
+    print $sock "set lazy$i 0 0 6 noreply\r\nlazyvl\r\n";
+}
+my $sizes = mem_stats($sock, 'sizes');
+is((values %$sizes)[0], 10, "stats sizes counts the items");
+print $sock "flush_all\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_all");
+is(mem_stats($sock)->{curr_items}, 10, "items are still linked");
+mem_get_is($sock, "lazy0", undef);
+is(mem_stats($sock)->{curr_items}, 9, "fetching unlinked the item");
+
+print $sock "lru_crawler crawl all\r\n";
+is(scalar <$sock>, "OK\r\n", "started a crawl");
+my $items = 9;
+for (my $tries = 0; $tries < 50 && $items != 0; $tries++) {
+    select undef, undef, undef, 0.1;
+    $items = mem_stats($sock)->{curr_items};
+}
+is($items, 0, "crawler reclaimed the rest");
+$sizes = mem_stats($sock, 'sizes');
+is(scalar(keys %$sizes), 0, "stats sizes is empty");
+
+# Without CAS ids an immediate flush_all still hides everything.
+$server = new_memcached('-C');
+$sock = $server->sock;
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+print $sock "flush_all\r\n";
+is(scalar <$sock>, "OK\r\n", "did flush_all");
+mem_get_is($sock, "foo", undef);
+
+# Items stored right after an immediate flush_all are kept, even in the
+# same second and without CAS ids.
+foreach my $args ('', '-C') {
+    $server = new_memcached($args);
+    $sock = $server->sock;
+    my ($replies, $kept, $flushed) = ('', 0, 0);
+    for (my $i = 0; $i < 5; $i++) {
+        print $sock "set old 0 0 3\r\nold\r\nflush_all\r\n" .
+            "set new 0 0 3\r\nnew\r\n";
+        $replies .= scalar <$sock> for (1 .. 3);
+        print $sock "get new\r\n";
+        if (scalar <$sock> eq "VALUE new 0 3\r\n") {
+            $kept++;
+            <$sock> for (1 .. 2);
+        }
+        print $sock "get old\r\n";
+        $flushed++ if scalar <$sock> eq "END\r\n";
+    }
+    is($replies, "STORED\r\nOK\r\nSTORED\r\n" x 5, "stored and flushed ($args)");
+    is($kept . '/' . $flushed, '5/5', "new items kept, old ones flushed ($args)");
+}
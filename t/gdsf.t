@@ -0,0 +1,90 @@
+#!/usr/bin/perl
+# Test cost-aware (GreedyDual-Size-Frequency) eviction.
+
+use strict;
+use Test::More tests => 90;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 3 -o gdsf");
+my $sock = $server->sock;
+my $value = "B"x66560;
+my $key = 0;
+
+my $settings = mem_stats($sock, "settings");
+is($settings->{gdsf}, "yes", "gdsf is enabled");
+
+# Cost hints are optional and may be followed by noreply.
+print $sock "set costly 0 0 1 5000 noreply\r\na\r\n";
+mem_get_is($sock, "costly", "a");
+print $sock "set costly 0 0 1 notanumber\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n",
+   "bad cost is rejected");
+
+# Expensive items go in first, so a plain LRU would evict them first.
+for ($key = 0; $key < 10; $key++) {
+    print $sock "set expensive$key 0 0 66560 1000\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored expensive$key");
+}
+
+# Cheap items overflow the cache.
+for ($key = 0; $key < 60; $key++) {
+    print $sock "set cheap$key 0 0 66560 1\r\n$value\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored cheap$key");
+}
+
+my $stats = mem_stats($sock);
+isnt($stats->{evictions}, "0", "evictions happened");
+
+for ($key = 0; $key < 10; $key++) {
+    mem_get_is($sock, "expensive$key", $value);
+}
+mem_get_is($sock, "cheap0", undef);
+
+$stats = mem_stats($sock);
+is($stats->{get_hit_bytes}, 10 * 66560 + 1, "hit bytes counted");
+is($stats->{get_hit_cost}, 10 * 1000 + 5000, "hit cost counted");
+ok($stats->{cost_hit_ratio} > $stats->{byte_hit_ratio},
+   "expensive items were kept");
+
+# With slab automove, pages go from the class with the cheapest items to
+# the one evicting costly ones, even though both keep evicting.
+$server = new_memcached("-m 4 -o gdsf,slab_automove,slab_automove_window=1");
+$sock = $server->sock;
+my $small = "s" x 1000;
+my $n;
+for ($n = 0; $n < 3000; $n++) {
+    print $sock "set small$n 0 0 1000 1 noreply\r\n$small\r\n";
+}
+
+my $big = "B" x 20000;
+sub replay {
+    my $hits = 0;
+    for (my $i = 0; $i < 100; $i++) {
+        print $sock "get big$i\r\n";
+        my $line = scalar <$sock>;
+        if ($line =~ /^VALUE/) {
+            $hits++;
+            my $data = scalar <$sock>;
+            $line = scalar <$sock>;
+        } else {
+            print $sock "set big$i 0 0 20000 100000\r\n$big\r\n";
+            $line = scalar <$sock>;
+        }
+        for (my $j = 0; $j < 10; $j++, $n++) {
+            print $sock "set small$n 0 0 1000 1\r\n$small\r\n";
+            $line = scalar <$sock>;
+        }
+    }
+    return $hits;
+}
+
+my $hits = 0;
+for (my $tries = 0; $tries < 100 && $hits < 100; $tries++) {
+    select undef, undef, undef, 0.2;
+    $hits = replay();
+}
+is($hits, 100, "costly working set fits after moving pages");
+cmp_ok(mem_stats($sock, "slabs")->{slabs_automoved}, '>', 0,
+       "pages were automoved");
@@ -0,0 +1,38 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval {
+    my $server = new_memcached('-o hash_algorithm=md5');
+};
+ok($@, "Died with an unknown hash_algorithm");
+
+foreach my $algo ('jenkins', 'murmur3', 'crc32c') {
+    my $server = eval { new_memcached("-o hash_algorithm=$algo") };
+    SKIP: {
+        # crc32c needs SSE4.2, and a build that can use it
+        skip "$algo isn't supported here", 3 unless $server;
+        my $sock = $server->sock;
+
+        is(mem_stats($sock, 'settings')->{hash_algorithm}, $algo,
+           "hash_algorithm is $algo");
+
+        # Twenty keys go through hash_many() in more than one batch
+        my @keys = map { "hkey$_" } (1 .. 20);
+        foreach my $key (@keys) {
+            print $sock "set $key 0 0 " . length($key) . " noreply\r\n$key\r\n";
+        }
+        print $sock "get @keys nokey\r\n";
+        my $found = 0;
+        while (my $line = <$sock>) {
+            last if $line eq "END\r\n";
+            $found++ if $line =~ /^VALUE hkey/;
+        }
+        is($found, 20, "multiget finds every key with $algo");
+        mem_get_is($sock, "hkey7", "hkey7");
+    }
+}
@@ -0,0 +1,51 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 7;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o hash_table=open');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, 'settings');
+is($settings->{hash_table}, 'open', "open addressing table is in use");
+
+# The open table starts out with 57344 slots and grows at 90%, so this
+# forces at least one expansion.
+my $count = 60000;
+for (my $i = 0; $i < $count; $i++) {
+    my $val = "val$i";
+    print $sock "set key$i 0 0 " . length($val) . " noreply\r\n$val\r\n";
+}
+mem_get_is($sock, "key0", "val0");
+is(mem_stats($sock)->{curr_items}, $count, "stored all keys");
+
+sub count_missing {
+    my $missing = 0;
+    for (my $i = 0; $i < $count; $i += 50) {
+        print $sock "get key$i\r\n";
+        my $line = <$sock>;
+        if ($line =~ /^VALUE/) {
+            my $val = <$sock>;
+            $missing++ unless $val eq "val$i\r\n";
+            $line = <$sock>;
+        } else {
+            $missing++;
+        }
+    }
+    return $missing;
+}
+
+# Lookups have to check both tables while the expansion is moving items...
+is(count_missing(), 0, "found every key while expanding");
+# ...and only the new one once it's done.
+sleep(1);
+is(count_missing(), 0, "found every key after expanding");
+
+for (my $i = 0; $i < $count; $i += 2) {
+    print $sock "delete key$i noreply\r\n";
+}
+mem_get_is($sock, "key0", undef);
+mem_get_is($sock, "key1", "val1");
@@ -18,4 +18,5 @@ for ($key = 0; $key < 10; $key++) {
 
 my $first_stats = mem_stats($sock, "slabs");
 my $req = $first_stats->{"1:mem_requested"};
-ok ($req == "640" || $req == "800", "Check allocated size");
+# 32-bit, --enable-compact-items and 64-bit item headers
+ok ($req == "570" || $req == "650" || $req == "730", "Check allocated size");
@@ -0,0 +1,33 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 7;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $settings = mem_stats($sock, 'settings');
+is($settings->{large_pages}, 'no', "no large pages without -L");
+is($settings->{hash_large_pages}, 'no', "or for the hash table");
+
+# Whether huge pages can be had depends on the machine; only check that
+# the server says what it got and works with it.
+$server = new_memcached('-L -m 64 -o hash_large_pages');
+$sock = $server->sock;
+$settings = mem_stats($sock, 'settings');
+like($settings->{large_pages}, qr/^(hugetlb|thp|memcntl|unavailable)$/,
+     "-L reports what slab memory got");
+like($settings->{hash_large_pages}, qr/^(hugetlb|thp|unavailable)$/,
+     "hash_large_pages reports what the hash table got");
+
+# Grow the hash table, so the old one gets freed
+my $count = 100000;
+for (my $i = 0; $i < $count; $i++) {
+    print $sock "set key$i 0 0 1 noreply\r\nx\r\n";
+}
+mem_get_is($sock, "key0", "x");
+sleep(1);
+mem_get_is($sock, "key" . ($count - 1), "x");
+is(mem_stats($sock)->{curr_items}, $count, "kept every item");
@@ -0,0 +1,53 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+foreach my $other ('slab_release', 'slab_automove', 'slab_sizes=128-256') {
+    eval {
+        my $server = new_memcached("-o allocator=log,$other");
+    };
+    ok($@ && $@ =~ m/^Failed/, "Shouldn't start with allocator=log,$other");
+}
+
+my $server = new_memcached('-m 8 -o slab_page_size=64k,allocator=log');
+my $sock = $server->sock;
+
+is(mem_stats($sock, 'settings')->{allocator}, 'log', "allocator in settings");
+
+# Small items, big ones and one in pieces all go in the log
+my %value = (small => 'a' x 10, medium => 'b' x 3000, chunked => 'c' x 100000);
+foreach my $key (sort keys %value) {
+    print $sock "set $key 0 0 " . length($value{$key}) . "\r\n$value{$key}\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored $key");
+}
+foreach my $key (sort keys %value) {
+    mem_get_is($sock, $key, $value{$key});
+}
+
+my $slabs = mem_stats($sock, 'slabs');
+cmp_ok($slabs->{log_live_bytes}, '>', 103000, "log_live_bytes");
+
+# Mixed sizes, with overwrites, well past the limit
+srand(42);
+my (@len, @last);
+foreach my $i (0 .. 19999) {
+    my $key = int(rand(12000));
+    my $len = (10, 100, 1000, 4000)[$i % 4] + int(rand(200));
+    $len[$key] = $len;
+    @last = ($key, @last[0 .. 0]);
+    print $sock "set key$key 0 0 $len noreply\r\n", chr(97 + $key % 26) x $len,
+        "\r\n";
+}
+mem_get_is($sock, "key$_", chr(97 + $_ % 26) x $len[$_]) foreach (@last);
+
+$slabs = mem_stats($sock, 'slabs');
+my $stats = mem_stats($sock);
+cmp_ok($slabs->{log_segments_cleaned}, '>', 0, "segments were cleaned");
+cmp_ok($slabs->{log_items_relocated}, '>', 0, "live items were moved");
+cmp_ok($stats->{evictions}, '>', 0, "old items were evicted");
+cmp_ok($stats->{bytes} / $slabs->{total_malloced}, '>', 0.9,
+       "items fill most of the memory in use");
@@ -0,0 +1,106 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 29;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+use Time::HiRes qw(time);
+
+my $server = new_memcached('-o lru_crawler_batch=10');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{lru_crawler}, "no", "crawler starts out disabled");
+is($settings->{lru_crawler_batch}, "10", "batch size from the command line");
+
+print $sock "lru_crawler crawl all\r\n";
+is(scalar <$sock>, "NOTSTARTED lru crawler is disabled\r\n",
+   "can't crawl while disabled");
+
+print $sock "lru_crawler enable\r\n";
+is(scalar <$sock>, "OK\r\n", "enabled the crawler");
+$settings = mem_stats($sock, ' settings');
+is($settings->{lru_crawler}, "yes", "crawler is running");
+
+print $sock "lru_crawler crawl 0\r\n";
+is(scalar <$sock>, "BADCLASS invalid class id\r\n", "class 0 is rejected");
+print $sock "lru_crawler crawl 1,foo\r\n";
+is(scalar <$sock>, "BADCLASS invalid class id\r\n", "junk is rejected");
+
+print $sock "lru_crawler sleep 50\r\n";
+is(scalar <$sock>, "OK\r\n", "changed the sleep time");
+print $sock "lru_crawler batch 0\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n",
+   "batch must be positive");
+
+# Invalidate everything in two seconds; nobody fetches the items after.
+for (my $i = 0; $i < 50; $i++) {
+    print $sock "set key$i 0 0 1 noreply\r\nx\r\n";
+}
+print $sock "flush_all 2\r\n";
+is(scalar <$sock>, "OK\r\n", "delayed flush_all");
+is(mem_stats($sock)->{curr_items}, 50, "items are still linked");
+sleep(3);
+# Keeps the class around in "stats items".
+print $sock "set keeper 0 0 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored keeper");
+
+print $sock "lru_crawler crawl all\r\n";
+is(scalar <$sock>, "OK\r\n", "started a crawl");
+
+sub wait_reclaimed {
+    my ($sock, $want) = @_;
+    my $reclaimed = 0;
+    for (my $tries = 0; $tries < 50 && $reclaimed < $want; $tries++) {
+        select undef, undef, undef, 0.1;
+        my $stats = mem_stats($sock, 'items');
+        $reclaimed = 0;
+        $reclaimed += $stats->{$_}
+            for grep { /:crawler_reclaimed$/ } keys %$stats;
+    }
+    return $reclaimed;
+}
+
+is(wait_reclaimed($sock, 50), 50, "crawler reclaimed the flushed items");
+is(mem_stats($sock)->{curr_items}, 1, "only the keeper is left");
+mem_get_is($sock, "keeper", "x");
+
+print $sock "lru_crawler disable\r\n";
+is(scalar <$sock>, "OK\r\n", "disabled the crawler");
+$settings = mem_stats($sock, ' settings');
+is($settings->{lru_crawler}, "no", "crawler is stopped");
+
+# A crawl asked for right as the thread starts isn't lost
+for (my $i = 0; $i < 20; $i++) {
+    print $sock "set short$i 0 0 1 noreply\r\nx\r\n";
+}
+print $sock "flush_all 1\r\n";
+is(scalar <$sock>, "OK\r\n", "another delayed flush_all");
+sleep(2);
+print $sock "set keeper 0 0 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a new keeper");
+print $sock "lru_crawler enable\r\nlru_crawler crawl all\r\n";
+is(scalar <$sock>, "OK\r\n", "enabled the crawler again");
+is(scalar <$sock>, "OK\r\n", "crawl right away");
+is(wait_reclaimed($sock, 70), 70, "that crawl ran");
+
+# Disabling doesn't wait for a slow crawl to finish
+for (my $i = 0; $i < 2000; $i++) {
+    print $sock "set slow$i 0 0 1 noreply\r\nx\r\n";
+}
+print $sock "lru_crawler sleep 100000\r\nlru_crawler batch 1\r\n";
+<$sock> for (1 .. 2);
+print $sock "lru_crawler crawl all\r\n";
+is(scalar <$sock>, "OK\r\n", "started a slow crawl");
+print $sock "lru_crawler crawl all\r\n";
+like(scalar <$sock>, qr/^BUSY/, "one crawl at a time");
+my $start = time;
+print $sock "lru_crawler disable\r\n";
+is(scalar <$sock>, "OK\r\n", "disabled mid-crawl");
+cmp_ok(time - $start, '<', 2, "without waiting for the crawl");
+mem_get_is($sock, "slow1999", "x");
+
+print $sock "lru_crawler enable\r\nlru_crawler sleep 0\r\nlru_crawler crawl all\r\n";
+<$sock> for (1 .. 2);
+is(scalar <$sock>, "OK\r\n", "the stopped crawl was cleared away");
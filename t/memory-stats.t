@@ -0,0 +1,53 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 32');
+my $sock = $server->sock;
+
+my $mem = mem_stats($sock, 'memory');
+my $sum = 0;
+$sum += $mem->{$_} foreach qw(slab_pages slab_metadata hash_table connections
+                                suffix_caches threads prefix_stats);
+is($mem->{total}, $sum, "total adds up");
+cmp_ok($mem->{hash_table}, '>', 0, "hash table is counted");
+cmp_ok($mem->{connections}, '>', 0, "connections are counted");
+is($mem->{slab_limit}, 32 * 1024 * 1024, "slab pages get all of -m");
+
+# Connection buffers count for more memory
+sub connect_many {
+    my ($server, $count) = @_;
+    my @socks = map { $server->new_sock } 1 .. $count;
+    foreach my $s (@socks) {
+        print $s "version\r\n";
+        <$s>;
+    }
+    return @socks;
+}
+
+my @socks = connect_many($server, 50);
+cmp_ok(mem_stats($sock, 'memory')->{connections}, '>', $mem->{connections},
+       "more connections take more memory");
+
+print $sock "set foo 0 0 3\r\nbar\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+cmp_ok(mem_stats($sock, 'memory')->{slab_pages}, '>', 0, "slab pages counted");
+
+# With -o total_memory the overhead comes out of -m
+$server = new_memcached('-m 32 -o total_memory,slab_page_size=64k');
+$sock = $server->sock;
+is(mem_stats($sock, 'settings')->{total_memory}, "yes", "total_memory is on");
+# Wait for the budget to be worked out
+sleep(2);
+my $before = mem_stats($sock, 'memory');
+cmp_ok($before->{slab_limit}, '<=', 32 * 1024 * 1024 -
+       ($before->{total} - $before->{slab_pages}), "overhead comes off -m");
+
+@socks = connect_many($server, 100);
+sleep(2);
+cmp_ok(mem_stats($sock, 'memory')->{slab_limit}, '<', $before->{slab_limit},
+       "slab limit shrinks as connections grow");
@@ -0,0 +1,43 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 6;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# A get with many keys looks them up a batch at a time; make sure every
+# batch comes back whole and in order, with misses and expired items left
+# out, for both kinds of hash table.
+foreach my $table ('chained', 'open') {
+    my $server = new_memcached("-o hash_table=$table");
+    my $sock = $server->sock;
+
+    my @keys = map { "mkey$_" } (0 .. 99);
+    my @expect;
+    for (my $i = 0; $i < @keys; $i++) {
+        next if $i % 3 == 0;
+        my $val = "v$i";
+        my $exptime = $i == 50 ? 1 : 0;
+        print $sock "set $keys[$i] $i $exptime " . length($val) .
+            " noreply\r\n$val\r\n";
+        push @expect, "VALUE $keys[$i] $i " . length($val) . "\r\n$val\r\n"
+            unless $i == 50;
+    }
+    sleep(2);
+
+    print $sock "get @keys $keys[1]\r\n";
+    my $response = '';
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        $response .= $line;
+    }
+    is($response, join('', @expect, $expect[0]), "100-key get with $table");
+
+    print $sock "gets $keys[1] $keys[0] $keys[2]\r\n";
+    like(scalar <$sock>, qr/^VALUE mkey1 1 2 \d+\r\n/, "gets returns cas");
+    <$sock>;
+    like(scalar <$sock>, qr/^VALUE mkey2 2 2 \d+\r\n/, "gets skips a miss");
+    <$sock>;
+    <$sock>;
+}
@@ -0,0 +1,30 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 6;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval {
+    my $server = new_memcached('-o prefault=0');
+};
+ok($@, "Died with no prefault threads");
+
+my $server = new_memcached('-m 32 -t 3 -o prefault');
+my $sock = $server->sock;
+is(mem_stats($sock, 'settings')->{prefault}, 3, "one thread per worker");
+
+$server = new_memcached('-m 32 -o prefault=2');
+$sock = $server->sock;
+is(mem_stats($sock, 'settings')->{prefault}, 2, "prefault=2");
+
+# Memory that was faulted in is used without clearing it again; it has to
+# come out as it went in.
+my $value = 'x' x 5000;
+foreach my $i (1 .. 1000) {
+    print $sock "set key$i 0 0 5000 noreply\r\n$value\r\n";
+}
+mem_get_is($sock, "key1", $value);
+mem_get_is($sock, "key1000", $value);
+is(mem_stats($sock)->{curr_items}, 1000, "stored everything");
@@ -0,0 +1,70 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 16;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 8 -o slab_page_size=64k');
+my $sock = $server->sock;
+
+my $ladder = mem_stats($sock, 'ladder');
+is($ladder->{samples}, 0, "no sizes seen yet");
+ok(!defined $ladder->{proposed_classes}, "nothing proposed yet");
+
+print $sock "slabs autotune\r\n";
+is(scalar <$sock>, "NOSAMPLES not enough items stored yet\r\n",
+   "needs samples first");
+
+# Every value is 150 to 155 bytes, so most classes go unused
+sub fill {
+    my ($sock, $from, $count) = @_;
+    foreach my $i ($from .. $from + $count - 1) {
+        my $len = 150 + $i % 6;
+        print $sock "set key$i 0 0 $len noreply\r\n", 'x' x $len, "\r\n";
+    }
+}
+
+fill($sock, 0, 2000);
+$ladder = mem_stats($sock, 'ladder');
+is($ladder->{samples}, 2000, "sizes were counted");
+cmp_ok($ladder->{proposed_waste_pct}, '<', $ladder->{current_waste_pct},
+       "proposal wastes less");
+cmp_ok($ladder->{proposed_classes}, '<=', $ladder->{current_classes},
+       "with no more classes");
+my $proposed = $ladder->{'1:proposed'};
+
+print $sock "slabs autotune\r\n";
+is(scalar <$sock>, "OK\r\n", "switched chunk sizes");
+$ladder = mem_stats($sock, 'ladder');
+is($ladder->{ladders_adopted}, 1, "ladders_adopted");
+is($ladder->{'1:current'}, $proposed, "proposed sizes are in use");
+cmp_ok($ladder->{retired_pages}, '>', 0, "old classes still hold items");
+mem_get_is($sock, "key1", 'x' x 151);
+
+print $sock "slabs autotune\r\n";
+is(scalar <$sock>, "SAME no better chunk sizes found\r\n", "nothing to change");
+
+# Filling the cache drains the old classes into the new ones
+fill($sock, 2000, 150000);
+for (1 .. 50) {
+    $ladder = mem_stats($sock, 'ladder');
+    last if $ladder->{retired_pages} == 0;
+    fill($sock, 0, 2000);
+    select undef, undef, undef, 0.1;
+}
+is($ladder->{retired_pages}, 0, "old classes were drained");
+cmp_ok(mem_stats($sock, 'slabs')->{slabs_drained}, '>', 0, "slabs_drained");
+
+# The maintenance thread switches on its own with -o slab_autotune
+$server = new_memcached('-m 8 -o slab_page_size=64k,slab_autotune,' .
+                        'slab_autotune_window=1');
+$sock = $server->sock;
+is(mem_stats($sock, 'settings')->{slab_autotune}, 'yes', "slab_autotune");
+fill($sock, 0, 2000);
+for (1 .. 30) {
+    last if mem_stats($sock, 'ladder')->{ladders_adopted} == 1;
+    select undef, undef, undef, 0.1;
+}
+is(mem_stats($sock, 'ladder')->{ladders_adopted}, 1, "switched by itself");
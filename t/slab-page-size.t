@@ -0,0 +1,44 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval {
+    my $server = new_memcached('-o slab_page_size=512');
+};
+ok($@ && $@ =~ m/^Failed/, "Shouldn't start with < 1k pages");
+
+eval {
+    my $server = new_memcached('-o slab_page_size=256m');
+};
+ok($@ && $@ =~ m/^Failed/, "Shouldn't start with > 128m pages");
+
+# Small pages with a big item limit: large items are chunked.
+my $server = new_memcached('-o slab_page_size=64k -I 2m');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{slab_page_size}, 64 * 1024, "page size from the command line");
+is($settings->{slab_chunk_max}, 32 * 1024, "largest chunk is half a page");
+is($settings->{item_size_max}, 2 * 1024 * 1024, "item size limit unchanged");
+
+my $big = join('', map { sprintf("%07d,", $_) } 0 .. 131071);
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a 1MB item in 64k pages");
+mem_get_is($sock, "big", $big);
+
+my $slabs = mem_stats($sock, 'slabs');
+is($slabs->{total_malloced} % (64 * 1024), 0, "memory comes in 64k pages");
+cmp_ok($slabs->{total_mem_requested}, '>=', length($big),
+       "requested bytes include the whole value");
+cmp_ok($slabs->{total_mem_requested}, '<=', $slabs->{total_malloced},
+       "requested fits in what was allocated");
+$server->stop();
+
+# The page size no longer follows the item size limit.
+$server = new_memcached('-I 16m');
+$settings = mem_stats($server->sock, ' settings');
+is($settings->{slab_page_size}, 1024 * 1024, "pages stay at 1m");
@@ -0,0 +1,58 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 13;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 64 -o slab_page_size=64k,slab_release');
+my $sock = $server->sock;
+my $settings = mem_stats($sock, 'settings');
+is($settings->{slab_release}, "yes", "slab_release is on");
+is($settings->{slab_release_floor}, 0, "no floor");
+
+my $value = 'x' x 1000;
+sub fill {
+    my ($sock, $count) = @_;
+    foreach my $i (1 .. $count) {
+        print $sock "set key$i 0 0 1000 noreply\r\n$value\r\n";
+    }
+    # Waits for the noreply sets to be done
+    mem_get_is($sock, "key$count", $value);
+}
+
+fill($sock, 5000);
+my $full = mem_stats($sock, 'slabs');
+cmp_ok($full->{resident_pages}, '>', 50, "pages in use");
+is($full->{released_pages}, 0, "nothing released yet");
+
+foreach my $i (1 .. 5000) {
+    print $sock "delete key$i noreply\r\n";
+}
+mem_get_is($sock, "key5000", undef);
+
+# The slab maintenance thread gives pages back once a second
+sleep(3);
+my $empty = mem_stats($sock, 'slabs');
+cmp_ok($empty->{released_pages}, '>=', $full->{resident_pages} - 2,
+       "empty pages were released");
+cmp_ok($empty->{total_malloced}, '<', $full->{total_malloced} / 10,
+       "total_malloced went down");
+
+# Released pages are reused, and come back zeroed
+fill($sock, 2500);
+mem_get_is($sock, "key1", $value);
+cmp_ok(mem_stats($sock, 'slabs')->{released_pages}, '<',
+       $empty->{released_pages}, "released pages were reused");
+
+# Nothing goes below the floor
+$server = new_memcached('-m 64 -o slab_page_size=64k,slab_release,' .
+                        'slab_release_floor=64');
+$sock = $server->sock;
+fill($sock, 2000);
+foreach my $i (1 .. 2000) {
+    print $sock "delete key$i noreply\r\n";
+}
+sleep(2);
+is(mem_stats($sock, 'slabs')->{released_pages}, 0, "kept above the floor");
@@ -0,0 +1,42 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+foreach my $bad ('256-128', '128-204', '8-128', '128-524288') {
+    eval {
+        my $server = new_memcached("-o slab_sizes=$bad");
+    };
+    ok($@ && $@ =~ m/^Failed/, "Shouldn't start with slab_sizes=$bad");
+}
+
+my $server = new_memcached('-o slab_sizes=128-256-1024-4096');
+my $sock = $server->sock;
+
+is(mem_stats($sock, 'settings')->{slab_sizes}, '128-256-1024-4096',
+   "slab_sizes in stats settings");
+
+my $ladder = mem_stats($sock, 'ladder');
+is($ladder->{current_classes}, 5, "one class per size and the largest");
+is($ladder->{'1:current'}, 128, "smallest class");
+is($ladder->{'4:current'}, 4096, "largest given size");
+is($ladder->{'5:current'}, 512 * 1024, "largest chunk size");
+is(mem_stats($sock, 'slabs')->{slab_classes}, 5, "slab_classes");
+
+# Each item goes in the smallest class it fits in
+my %class = (10 => 1, 150 => 2, 2000 => 4, 5000 => 5);
+foreach my $len (sort { $a <=> $b } keys %class) {
+    print $sock "set key$len 0 0 $len\r\n", 'x' x $len, "\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored $len bytes");
+}
+my $slabs = mem_stats($sock, 'slabs');
+is(join(',', map { $slabs->{"$_:used_chunks"} || 0 } 1 .. 5), '1,1,0,1,1',
+   "items went in the expected classes");
+is($slabs->{'2:chunk_size'}, 256, "chunk size of a configured class");
+
+$server = new_memcached();
+is(mem_stats($server->sock, 'settings')->{slab_sizes}, 'none',
+   "no slab_sizes by default");
@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 11;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 4 -o slab_automove_window=1');
+my $sock = $server->sock;
+
+my $settings = mem_stats($sock, ' settings');
+is($settings->{slab_automove}, "no", "automove starts out disabled");
+is($settings->{slab_automove_window}, 1, "window from the command line");
+
+print $sock "slabs automove 2\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n",
+   "only 0 and 1 are accepted");
+print $sock "slabs automove 1\r\n";
+is(scalar <$sock>, "OK\r\n", "enabled automove");
+$settings = mem_stats($sock, ' settings');
+is($settings->{slab_automove}, "yes", "automove is on");
+
+# First the cache fills up with small items nobody asks for again...
+my $small = "s" x 1000;
+for (my $i = 0; $i < 3000; $i++) {
+    print $sock "set small$i 0 0 1000 noreply\r\n$small\r\n";
+}
+print $sock "set small 0 0 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "filled up with small items");
+sleep(2);
+
+# ... then the traffic shifts to a working set of larger items, which
+# doesn't fit in what is left for their class.
+my $big = "B" x 20000;
+sub replay {
+    my $hits = 0;
+    for (my $i = 0; $i < 100; $i++) {
+        print $sock "get big$i\r\n";
+        my $line = scalar <$sock>;
+        if ($line =~ /^VALUE/) {
+            $hits++;
+            my $data = scalar <$sock>;
+            $line = scalar <$sock>;
+        } else {
+            print $sock "set big$i 0 0 20000\r\n$big\r\n";
+            $line = scalar <$sock>;
+        }
+    }
+    return $hits;
+}
+
+replay();
+my $before = replay();
+cmp_ok($before, '<', 50, "working set doesn't fit at first");
+
+my $after = $before;
+for (my $tries = 0; $tries < 100 && $after < 100; $tries++) {
+    select undef, undef, undef, 0.2;
+    $after = replay();
+}
+cmp_ok($after, '>', $before, "hit rate improved");
+is($after, 100, "working set fits after moving pages");
+
+my $slabs = mem_stats($sock, "slabs");
+cmp_ok($slabs->{slabs_automoved}, '>', 0, "pages were automoved");
+
+my $items = mem_stats($sock, "items");
+my $ghost_hits = 0;
+$ghost_hits += $items->{$_} for grep { /:ghost_hits$/ } keys %$items;
+cmp_ok($ghost_hits, '>', 0, "ghost lists saw the evicted keys come back");
@@ -0,0 +1,66 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+# Fill one class across several pages.
+my $value = "B" x 100000;
+for (my $i = 0; $i < 40; $i++) {
+    print $sock "set big$i 0 0 100000 noreply\r\n$value\r\n";
+}
+print $sock "set small 0 0 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a small item");
+
+my $slabs = mem_stats($sock, "slabs");
+my ($src) = grep { $_ != 1 } map { /^(\d+):total_pages$/ ? $1 : () }
+    keys %$slabs;
+my ($dst) = map { /^(\d+):chunk_size$/ && $slabs->{$_} < 100 ? $1 : () }
+    keys %$slabs;
+ok(defined $src && $slabs->{"$src:total_pages"} > 2, "big items span pages");
+ok(defined $dst, "found the small item class");
+my $src_pages = $slabs->{"$src:total_pages"};
+my $dst_pages = $slabs->{"$dst:total_pages"};
+is($slabs->{slab_reassign_running}, 0, "no move running");
+is($slabs->{slabs_moved}, 0, "nothing moved yet");
+
+print $sock "slabs reassign $src $src\r\n";
+is(scalar <$sock>, "SAME src and dst class are identical\r\n",
+   "can't move a page to its own class");
+print $sock "slabs reassign 0 $dst\r\n";
+is(scalar <$sock>, "BADCLASS invalid src or dst class id\r\n",
+   "class 0 is rejected");
+print $sock "slabs reassign $src 255\r\n";
+is(scalar <$sock>, "BADCLASS invalid src or dst class id\r\n",
+   "unused class is rejected");
+print $sock "slabs reassign $dst $src\r\n";
+is(scalar <$sock>, "NOSPARE source class has no spare pages\r\n",
+   "the last page of a class stays put");
+print $sock "slabs reassign foo $dst\r\n";
+is(scalar <$sock>, "CLIENT_ERROR bad command line format\r\n",
+   "junk is rejected");
+
+print $sock "slabs reassign $src $dst\r\n";
+is(scalar <$sock>, "OK\r\n", "started a move");
+
+my $moved = 0;
+for (my $tries = 0; $tries < 50 && !$moved; $tries++) {
+    select undef, undef, undef, 0.1;
+    $slabs = mem_stats($sock, "slabs");
+    $moved = $slabs->{slabs_moved};
+}
+is($moved, 1, "page was moved");
+is($slabs->{slab_reassign_running}, 0, "move is done");
+is($slabs->{"$src:total_pages"}, $src_pages - 1, "source lost a page");
+is($slabs->{"$dst:total_pages"}, $dst_pages + 1, "destination gained a page");
+
+# Items left in the page were either copied elsewhere or evicted.
+my $items = mem_stats($sock, "items");
+is($slabs->{slab_reassign_evictions}, 40 - $items->{"items:$src:number"},
+   "items that didn't fit elsewhere were evicted");
+mem_get_is($sock, "small", "x");
@@ -38,6 +38,12 @@ my $sock = $server->sock;
 ## STAT cas_badval 0
 ## STAT auth_cmds 0
 ## STAT auth_unknowns 0
+## STAT get_hit_bytes 0
+## STAT get_miss_bytes 0
+## STAT get_hit_cost 0
+## STAT get_miss_cost 0
+## STAT byte_hit_ratio 0.0000
+## STAT cost_hit_ratio 0.0000
 ## STAT bytes_read 7
 ## STAT bytes_written 0
 ## STAT limit_maxbytes 67108864
@@ -50,6 +56,7 @@ my $sock = $server->sock;
 ## STAT total_items 0
 ## STAT evictions 0
 ## STAT reclaimed 0
+## STAT expired 0
 
 # note that auth stats are tested in auth specfic tests
 
@@ -57,7 +64,7 @@ my $sock = $server->sock;
 my $stats = mem_stats($sock);
 
 # Test number of keys
-is(scalar(keys(%$stats)), 38, "38 stats values");
+is(scalar(keys(%$stats)), 45, "45 stats values");
 
 # Test initial state
 foreach my $key (qw(curr_items total_items bytes cmd_get cmd_set get_hits evictions get_misses
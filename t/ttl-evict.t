@@ -0,0 +1,75 @@
+#!/usr/bin/perl
+# Test that items close to expiry are evicted before live data.
+
+use strict;
+use Test::More tests => 51;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $value = "B"x66560;
+
+# Fills the cache with live items, then items expiring in 30 seconds, then
+# fillers until ten items have been evicted. Returns the socket.
+sub fill {
+    my $server = shift;
+    my $sock = $server->sock;
+    my $key;
+
+    for ($key = 0; $key < 10; $key++) {
+        print $sock "set live$key 0 0 66560\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored live$key");
+    }
+    for ($key = 0; $key < 10; $key++) {
+        print $sock "set soon$key 0 30 66560\r\n$value\r\n";
+        is(scalar <$sock>, "STORED\r\n", "stored soon$key");
+    }
+    for ($key = 0; $key < 200; $key++) {
+        print $sock "set filler$key 0 0 66560\r\n$value\r\n";
+        my $res = <$sock>;
+        last if $res ne "STORED\r\n";
+        last if mem_stats($sock)->{evictions} >= 10;
+    }
+    return $sock;
+}
+
+sub present {
+    my ($sock, $prefix) = @_;
+    my $found = 0;
+    for (my $key = 0; $key < 10; $key++) {
+        print $sock "get $prefix$key\r\n";
+        my $line = scalar <$sock>;
+        if ($line =~ /^VALUE/) {
+            $found++;
+            <$sock>;
+            <$sock>;
+        }
+    }
+    return $found;
+}
+
+my $server = new_memcached("-m 3");
+my $sock = fill($server);
+my $settings = mem_stats($sock, "settings");
+is($settings->{ttl_evict_window}, "60", "default ttl_evict_window");
+
+my $stats = mem_stats($sock, "items");
+my ($class) = map { /^items:(\d+):evicted$/ && $stats->{$_} ? $1 : () }
+              keys %$stats;
+is($stats->{"items:$class:evicted_nonzero"}, "10",
+   "all evictions had an expiry time");
+is($stats->{"items:$class:evicted_ttl_remaining:16"}, "10",
+   "evicted items had 16-31 seconds left");
+is(present($sock, "soon"), 0, "items about to expire were evicted");
+is(present($sock, "live"), 10, "live items were kept");
+
+# Without the window we're back to plain LRU.
+$server = new_memcached("-m 3 -o ttl_evict_window=0");
+$sock = fill($server);
+is(present($sock, "live"), 0, "oldest items were evicted");
+is(present($sock, "soon"), 10, "newer items were kept");
+
+foreach my $bad ("abc", "-1", "256", "10s") {
+    eval { new_memcached("-o ttl_evict_window=$bad") };
+    ok($@ && $@ =~ m/^Failed/, "ttl_evict_window=$bad is rejected");
+}
@@ -190,6 +190,22 @@ static enum test_return test_safe_strtoull(void) {
     return TEST_PASS;
 }
 
+static enum test_return test_itoa(void) {
+    char buf[24];
+
+    *itoa_u32(0, buf) = '\0';
+    assert(strcmp(buf, "0") == 0);
+    *itoa_u32(123, buf) = '\0';
+    assert(strcmp(buf, "123") == 0);
+    *itoa_u32(4294967295U, buf) = '\0';
+    assert(strcmp(buf, "4294967295") == 0);
+    *itoa_u64(0, buf) = '\0';
+    assert(strcmp(buf, "0") == 0);
+    *itoa_u64(18446744073709551615ULL, buf) = '\0';
+    assert(strcmp(buf, "18446744073709551615") == 0);
+    return TEST_PASS;
+}
+
 static enum test_return test_safe_strtoll(void) {
     int64_t val;
     assert(safe_strtoll("123", &val));
@@ -1790,6 +1806,7 @@ struct testcase testcases[] = {
     { "strtoll", test_safe_strtoll },
     { "strtoul", test_safe_strtoul },
     { "strtoull", test_safe_strtoull },
+    { "itoa", test_itoa },
     { "issue_44", test_issue_44 },
     { "vperror", test_vperror },
     { "issue_101", test_issue_101 },
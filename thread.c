@@ -44,6 +44,8 @@ static pthread_mutex_t stats_lock;
 
 /* Free list of CQ_ITEM structs */
 static CQ_ITEM *cqi_freelist;
+/* Number of ITEMS_PER_ALLOC blocks of them allocated */
+static unsigned int cqi_blocks;
 static pthread_mutex_t cqi_freelist_lock;
 
 static LIBEVENT_DISPATCHER_THREAD dispatcher_thread;
@@ -141,6 +143,7 @@ static CQ_ITEM *cqi_new(void) {
         pthread_mutex_lock(&cqi_freelist_lock);
         item[ITEMS_PER_ALLOC - 1].next = cqi_freelist;
         cqi_freelist = &item[1];
+        cqi_blocks++;
         pthread_mutex_unlock(&cqi_freelist_lock);
     }
 
@@ -328,8 +331,10 @@ int is_listen_thread() {
  */
 item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes) {
     item *it;
+    /* The item keeps the hash, so nothing needs to compute it again */
+    uint32_t hv = hash(key, nkey, 0);
     pthread_mutex_lock(&cache_lock);
-    it = do_item_alloc(key, nkey, flags, exptime, nbytes);
+    it = do_item_alloc(key, nkey, flags, exptime, nbytes, hv);
     pthread_mutex_unlock(&cache_lock);
     return it;
 }
@@ -340,12 +345,28 @@ item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbyt
  */
 item *item_get(const char *key, const size_t nkey) {
     item *it;
+    uint32_t hv = hash(key, nkey, 0);
     pthread_mutex_lock(&cache_lock);
-    it = do_item_get(key, nkey);
+    it = do_item_get(key, nkey, hv);
     pthread_mutex_unlock(&cache_lock);
     return it;
 }
 
+/*
+ * item_get() for several keys, taking the lock once and looking them up
+ * together. Takes at most ITEM_GET_BATCH keys.
+ */
+void item_get_many(const char **keys, const size_t *nkeys, item **its,
+                   const int n) {
+    uint32_t hvs[ITEM_GET_BATCH];
+
+    assert(n <= ITEM_GET_BATCH);
+    hash_many(keys, nkeys, hvs, n);
+    pthread_mutex_lock(&cache_lock);
+    do_item_get_many(keys, nkeys, hvs, its, n);
+    pthread_mutex_unlock(&cache_lock);
+}
+
 /*
  * Links an item into the LRU and hashtable.
  */
@@ -421,11 +442,11 @@ enum store_item_type store_item(item *item, int comm, conn* c) {
 }
 
 /*
- * Flushes expired items after a flush_all call
+ * Invalidates all items stored before the given time (flush_all)
  */
-void item_flush_expired() {
+void item_flush_expired(const rel_time_t when) {
     pthread_mutex_lock(&cache_lock);
-    do_item_flush_expired();
+    do_item_flush_expired(when);
     pthread_mutex_unlock(&cache_lock);
 }
 
@@ -450,6 +471,17 @@ void  item_stats(ADD_STAT add_stats, void *c) {
     pthread_mutex_unlock(&cache_lock);
 }
 
+/*
+ * Per-class eviction, ghost hit, LRU age and GDSF tail priority snapshot
+ * for the slab automover
+ */
+void item_stats_automove(unsigned int *evicted, unsigned int *ghost_hits,
+                         rel_time_t *age, double *priority) {
+    pthread_mutex_lock(&cache_lock);
+    do_item_stats_automove(evicted, ghost_hits, age, priority);
+    pthread_mutex_unlock(&cache_lock);
+}
+
 /*
  * Dumps a list of objects of each size in 32-byte increments
  */
@@ -486,6 +518,10 @@ void threadlocal_stats_reset(void) {
         threads[ii].stats.conn_yields = 0;
         threads[ii].stats.auth_cmds = 0;
         threads[ii].stats.auth_errors = 0;
+        threads[ii].stats.get_hit_bytes = 0;
+        threads[ii].stats.get_hit_cost = 0;
+        threads[ii].stats.get_miss_bytes = 0;
+        threads[ii].stats.get_miss_cost = 0;
 
         for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
             threads[ii].stats.slab_stats[sid].set_cmds = 0;
@@ -495,6 +531,13 @@ void threadlocal_stats_reset(void) {
             threads[ii].stats.slab_stats[sid].decr_hits = 0;
             threads[ii].stats.slab_stats[sid].cas_hits = 0;
             threads[ii].stats.slab_stats[sid].cas_badval = 0;
+            threads[ii].stats.slab_stats[sid].compress_tries = 0;
+            threads[ii].stats.slab_stats[sid].compress_kept = 0;
+            threads[ii].stats.slab_stats[sid].compress_bytes_in = 0;
+            threads[ii].stats.slab_stats[sid].compress_bytes_out = 0;
+            threads[ii].stats.slab_stats[sid].compress_usec = 0;
+            threads[ii].stats.slab_stats[sid].decompress_count = 0;
+            threads[ii].stats.slab_stats[sid].decompress_usec = 0;
         }
 
         pthread_mutex_unlock(&threads[ii].stats.mutex);
@@ -516,6 +559,10 @@ void threadlocal_stats_aggregate(struct thread_stats *stats) {
     stats->conn_yields = 0;
     stats->auth_cmds = 0;
     stats->auth_errors = 0;
+    stats->get_hit_bytes = 0;
+    stats->get_hit_cost = 0;
+    stats->get_miss_bytes = 0;
+    stats->get_miss_cost = 0;
 
     memset(stats->slab_stats, 0,
            sizeof(struct slab_stats) * MAX_NUMBER_OF_SLAB_CLASSES);
@@ -535,6 +582,10 @@ void threadlocal_stats_aggregate(struct thread_stats *stats) {
         stats->conn_yields += threads[ii].stats.conn_yields;
         stats->auth_cmds += threads[ii].stats.auth_cmds;
         stats->auth_errors += threads[ii].stats.auth_errors;
+        stats->get_hit_bytes += threads[ii].stats.get_hit_bytes;
+        stats->get_hit_cost += threads[ii].stats.get_hit_cost;
+        stats->get_miss_bytes += threads[ii].stats.get_miss_bytes;
+        stats->get_miss_cost += threads[ii].stats.get_miss_cost;
 
         for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
             stats->slab_stats[sid].set_cmds +=
@@ -551,6 +602,20 @@ void threadlocal_stats_aggregate(struct thread_stats *stats) {
                 threads[ii].stats.slab_stats[sid].cas_hits;
             stats->slab_stats[sid].cas_badval +=
                 threads[ii].stats.slab_stats[sid].cas_badval;
+            stats->slab_stats[sid].compress_tries +=
+                threads[ii].stats.slab_stats[sid].compress_tries;
+            stats->slab_stats[sid].compress_kept +=
+                threads[ii].stats.slab_stats[sid].compress_kept;
+            stats->slab_stats[sid].compress_bytes_in +=
+                threads[ii].stats.slab_stats[sid].compress_bytes_in;
+            stats->slab_stats[sid].compress_bytes_out +=
+                threads[ii].stats.slab_stats[sid].compress_bytes_out;
+            stats->slab_stats[sid].compress_usec +=
+                threads[ii].stats.slab_stats[sid].compress_usec;
+            stats->slab_stats[sid].decompress_count +=
+                threads[ii].stats.slab_stats[sid].decompress_count;
+            stats->slab_stats[sid].decompress_usec +=
+                threads[ii].stats.slab_stats[sid].decompress_usec;
         }
 
         pthread_mutex_unlock(&threads[ii].stats.mutex);
@@ -579,6 +644,33 @@ void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out) {
     }
 }
 
+/*
+ * Memory taken by the worker threads' descriptors and connection queues,
+ * and by their suffix caches (what "get" replies are built in).
+ */
+void threads_memory(size_t *thread_bytes, size_t *suffix_bytes) {
+#ifndef HAVE_UMEM_H
+    int ii;
+#endif
+
+    pthread_mutex_lock(&cqi_freelist_lock);
+    *thread_bytes = (size_t)cqi_blocks * ITEMS_PER_ALLOC * sizeof(CQ_ITEM);
+    pthread_mutex_unlock(&cqi_freelist_lock);
+    *thread_bytes += settings.num_threads *
+        (sizeof(LIBEVENT_THREAD) + sizeof(CQ));
+
+    *suffix_bytes = 0;
+#ifndef HAVE_UMEM_H
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        cache_t *cache = threads[ii].suffix_cache;
+        pthread_mutex_lock(&cache->mutex);
+        *suffix_bytes += (size_t)cache->total * cache->bufsize +
+            (size_t)cache->freetotal * sizeof(void *);
+        pthread_mutex_unlock(&cache->mutex);
+    }
+#endif
+}
+
 /*
  * Initializes the thread subsystem, creating various worker threads.
  *
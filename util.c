@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <sys/mman.h>
 
 #include "memcached.h"
 
@@ -90,6 +91,32 @@ bool safe_strtol(const char *str, int32_t *out) {
     return false;
 }
 
+char *itoa_u32(uint32_t u, char *out) {
+    char buf[10];
+    int n = 0;
+
+    do {
+        buf[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    while (n > 0)
+        *out++ = buf[--n];
+    return out;
+}
+
+char *itoa_u64(uint64_t u, char *out) {
+    char buf[20];
+    int n = 0;
+
+    do {
+        buf[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    while (n > 0)
+        *out++ = buf[--n];
+    return out;
+}
+
 void vperror(const char *fmt, ...) {
     int old_errno = errno;
     char buf[1024];
@@ -133,3 +160,115 @@ uint64_t htonll(uint64_t val) {
 }
 #endif
 
+
+#if defined(MAP_ANONYMOUS) && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+/* The size of the huge pages the kernel hands out, 2MB if it won't say */
+static size_t huge_page_size(void) {
+    static size_t size = 0;
+    FILE *fp;
+    char line[128];
+    unsigned long kb;
+
+    if (size != 0)
+        return size;
+    size = 2 * 1024 * 1024;
+    if ((fp = fopen("/proc/meminfo", "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 && kb > 0) {
+                size = kb * 1024;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    return size;
+}
+
+static size_t huge_page_round(const size_t size) {
+    return (size + huge_page_size() - 1) & ~(huge_page_size() - 1);
+}
+
+#ifdef MADV_HUGEPAGE
+/* madvise() takes MADV_HUGEPAGE even if they've been switched off */
+static bool thp_enabled(void) {
+    FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    char line[128];
+    bool enabled = true;
+
+    if (fp != NULL) {
+        if (fgets(line, sizeof(line), fp) != NULL &&
+            strstr(line, "[never]") != NULL)
+            enabled = false;
+        fclose(fp);
+    }
+    return enabled;
+}
+#endif
+#endif
+
+void *large_pages_alloc(const size_t size, enum large_pages_type *how) {
+#if defined(MAP_ANONYMOUS) && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+    const size_t len = huge_page_round(size);
+    char *p;
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *how = LARGE_PAGES_HUGETLB;
+        return p;
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    /* Transparent huge pages only go in aligned stretches, so map a page
+     * more than needed and trim it down to an aligned start */
+    if (thp_enabled()) {
+        p = mmap(NULL, len + huge_page_size(), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            size_t head = (huge_page_size() - (uintptr_t)p % huge_page_size())
+                % huge_page_size();
+            if (head > 0)
+                munmap(p, head);
+            munmap(p + head + len, huge_page_size() - head);
+            p += head;
+            if (madvise(p, len, MADV_HUGEPAGE) == 0) {
+                *how = LARGE_PAGES_THP;
+                return p;
+            }
+            munmap(p, len);
+        }
+    }
+#endif
+#endif
+    *how = LARGE_PAGES_NONE;
+    return calloc(size, 1);
+}
+
+void large_pages_free(void *ptr, const size_t size,
+                      const enum large_pages_type how) {
+    if (ptr == NULL)
+        return;
+#if defined(MAP_ANONYMOUS) && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+    if (how == LARGE_PAGES_HUGETLB || how == LARGE_PAGES_THP) {
+        munmap(ptr, huge_page_round(size));
+        return;
+    }
+#endif
+    free(ptr);
+}
+
+const char *large_pages_name(const enum large_pages_type how) {
+    switch (how) {
+    case LARGE_PAGES_OFF:
+        return "no";
+    case LARGE_PAGES_HUGETLB:
+        return "hugetlb";
+    case LARGE_PAGES_THP:
+        return "thp";
+    case LARGE_PAGES_MEMCNTL:
+        return "memcntl";
+    case LARGE_PAGES_NONE:
+        return "unavailable";
+    }
+    return "unknown";
+}
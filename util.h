@@ -12,6 +12,14 @@ bool safe_strtoll(const char *str, int64_t *out);
 bool safe_strtoul(const char *str, uint32_t *out);
 bool safe_strtol(const char *str, int32_t *out);
 
+/*
+ * Write the decimal form of an unsigned integer to out (no terminating
+ * null) and return the position just past it. out needs room for 10 or 20
+ * characters.
+ */
+char *itoa_u32(uint32_t u, char *out);
+char *itoa_u64(uint64_t u, char *out);
+
 #ifndef HAVE_HTONLL
 extern uint64_t htonll(uint64_t);
 extern uint64_t ntohll(uint64_t);